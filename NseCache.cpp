@@ -0,0 +1,231 @@
+//===-- NseCache.cpp - On-disk cache of instrumentation results -----------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#define DEBUG_TYPE "NseCache"
+
+#include "clang/Basic/SourceManager.h"
+#include "clang/Basic/Version.h"
+#include "clang/Frontend/CompilerInstance.h"
+#include "clang/Frontend/FrontendAction.h"
+#include "clang/Lex/PPCallbacks.h"
+#include "clang/Lex/Preprocessor.h"
+#include "clang/Tooling/Tooling.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+#include "NseCache.h"
+#include "NseReplacementIO.h"
+
+#include <cstring>
+
+using namespace clang;
+
+static const char *CacheEntryMagic = "nse-cache 1\n";
+
+namespace {
+
+/// Feeds the name and contents of every file that the preprocessor enters
+/// into an MD5 hash. Since the predefines buffer is entered like any other
+/// file, macros defined on the command line are covered as well.
+class HashingPPCallbacks : public PPCallbacks {
+public :
+  HashingPPCallbacks(SourceManager &SM, llvm::MD5 &Hash)
+      : SM(SM), Hash(Hash) {}
+
+  virtual void FileChanged(SourceLocation Loc, FileChangeReason Reason,
+      SrcMgr::CharacteristicKind FileType, FileID PrevFID) override {
+
+    if (Reason != EnterFile)
+      return;
+
+    bool Invalid = false;
+    const llvm::MemoryBuffer *Buffer = SM.getBuffer(SM.getFileID(Loc), &Invalid);
+    if (Invalid)
+      return;
+
+    Hash.update(SM.getBufferName(Loc));
+    Hash.update(StringRef("\0", 1));
+    Hash.update(Buffer->getBuffer());
+    Hash.update(StringRef("\0", 1));
+  }
+
+private:
+  SourceManager &SM;
+  llvm::MD5 &Hash;
+};
+
+/// Runs the preprocessor over the main file like PreprocessOnlyAction
+class HashingAction : public PreprocessorFrontendAction {
+public :
+  HashingAction(llvm::MD5 &Hash)
+      : Hash(Hash) {}
+
+protected:
+  virtual void ExecuteAction() override {
+    Preprocessor &PP = getCompilerInstance().getPreprocessor();
+    PP.addPPCallbacks(new HashingPPCallbacks(PP.getSourceManager(), Hash));
+    PP.IgnorePragmas();
+
+    Token Tok;
+    PP.EnterMainSourceFile();
+    do {
+      PP.Lex(Tok);
+    } while (Tok.isNot(tok::eof));
+  }
+
+private:
+  llvm::MD5 &Hash;
+};
+
+class HashingActionFactory : public tooling::FrontendActionFactory {
+public :
+  HashingActionFactory(llvm::MD5 &Hash)
+      : Hash(Hash) {}
+
+  virtual FrontendAction *create() override {
+    return new HashingAction(Hash);
+  }
+
+private:
+  llvm::MD5 &Hash;
+};
+
+} // end anonymous namespace
+
+static std::string stringifyHash(llvm::MD5 &Hash) {
+  llvm::MD5::MD5Result Result;
+  Hash.final(Result);
+
+  SmallString<32> Str;
+  llvm::MD5::stringifyResult(Result, Str);
+  return Str.str();
+}
+
+bool NseCache::computeKey(
+  const tooling::CompilationDatabase &Compilations,
+  StringRef File,
+  std::string &Key) {
+
+  llvm::MD5 Hash;
+  Hash.update(CacheEntryMagic);
+  Hash.update(getClangFullVersion());
+  Hash.update(ToolKey);
+
+  for (const tooling::CompileCommand &Command :
+         Compilations.getCompileCommands(File)) {
+    Hash.update(Command.Directory);
+    for (const std::string &Arg : Command.CommandLine) {
+      Hash.update(StringRef("\0", 1));
+      Hash.update(Arg);
+    }
+  }
+
+  tooling::ClangTool Tool(Compilations, File.str());
+  HashingActionFactory Factory(Hash);
+  if (Tool.run(&Factory))
+    return false;
+
+  Key = stringifyHash(Hash);
+  return true;
+}
+
+std::string NseCache::getEntryPath(StringRef Key) const {
+  SmallString<128> Path(Directory);
+  llvm::sys::path::append(Path, Key);
+  return Path.str();
+}
+
+bool NseCache::lookup(
+  const tooling::CompilationDatabase &Compilations,
+  StringRef File,
+  std::string &Key,
+  tooling::Replacements &Replace) {
+
+  Key.clear();
+  if (!computeKey(Compilations, File, Key)) {
+    Key.clear();
+    ++Misses;
+    return false;
+  }
+
+  llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> Entry =
+    llvm::MemoryBuffer::getFile(getEntryPath(Key));
+  if (!Entry) {
+    ++Misses;
+    return false;
+  }
+
+  // layout: magic, key line, checksum line, serialized replacements
+  StringRef Buffer = (*Entry)->getBuffer();
+  StringRef Checksum;
+  bool Valid = Buffer.startswith(CacheEntryMagic);
+  if (Valid) {
+    Buffer = Buffer.substr(strlen(CacheEntryMagic));
+    std::pair<StringRef, StringRef> KeyLine = Buffer.split('\n');
+    std::pair<StringRef, StringRef> ChecksumLine = KeyLine.second.split('\n');
+    Valid = KeyLine.first == Key;
+    Checksum = ChecksumLine.first;
+    Buffer = ChecksumLine.second;
+  }
+
+  if (Valid) {
+    llvm::MD5 Hash;
+    Hash.update(Buffer);
+    Valid = Checksum == stringifyHash(Hash);
+  }
+
+  tooling::Replacements Cached;
+  if (!Valid || !readReplacements(Buffer, Cached)) {
+    DEBUG(llvm::errs() << "Ignore corrupted cache entry: "
+                       << getEntryPath(Key) << '\n');
+    ++Misses;
+    return false;
+  }
+
+  Replace.insert(Cached.begin(), Cached.end());
+  ++Hits;
+  return true;
+}
+
+void NseCache::store(
+  StringRef Key,
+  const tooling::Replacements &Replace) {
+
+  if (llvm::sys::fs::create_directories(Directory))
+    return;
+
+  std::string Payload;
+  llvm::raw_string_ostream PayloadStream(Payload);
+  writeReplacements(Replace, PayloadStream);
+  PayloadStream.flush();
+
+  llvm::MD5 Hash;
+  Hash.update(Payload);
+
+  // write to a unique temporary file first so that concurrent readers
+  // and interrupted runs never observe a partially written entry
+  int FD;
+  SmallString<128> TempPath;
+  if (llvm::sys::fs::createUniqueFile(getEntryPath(Key) + "-%%%%%%%%.tmp",
+        FD, TempPath))
+    return;
+
+  {
+    llvm::raw_fd_ostream OS(FD, /*shouldClose=*/true);
+    OS << CacheEntryMagic << Key << '\n' << stringifyHash(Hash) << '\n'
+       << Payload;
+  }
+
+  if (llvm::sys::fs::rename(TempPath.str(), getEntryPath(Key)))
+    llvm::sys::fs::remove(TempPath.str());
+}
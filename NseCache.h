@@ -0,0 +1,73 @@
+//===-- NseCache.h - On-disk cache of instrumentation results ---*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief Skips translation units whose instrumentation cannot have changed
+///
+/// A cache entry is keyed by an MD5 hash over the compile command, the
+/// contents of every file the preprocessor enters, the tool version and the
+/// instrumentation options. The entry itself holds the replacements that
+/// were computed for the translation unit, protected by a checksum.
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef CLANG_CRV_CACHE_H
+#define CLANG_CRV_CACHE_H
+
+#include "clang/Tooling/CompilationDatabase.h"
+#include "clang/Tooling/Refactoring.h"
+#include "llvm/ADT/StringRef.h"
+
+#include <atomic>
+#include <string>
+
+/// Thread-safe, so a single instance can be shared by all workers
+class NseCache {
+public :
+  /// \p ToolKey must change whenever the tool or any option that
+  /// influences the replacements changes.
+  NseCache(llvm::StringRef Directory, llvm::StringRef ToolKey)
+      : Directory(Directory),
+        ToolKey(ToolKey),
+        Hits(0),
+        Misses(0) {}
+
+  /// Adds the cached replacements of the translation unit \p File to
+  /// \p Replace and returns true on a hit. On a miss, \p Key is set to the
+  /// key under which the replacements of \p File should be stored, or left
+  /// empty if \p File could not be preprocessed.
+  bool lookup(
+    const clang::tooling::CompilationDatabase &Compilations,
+    llvm::StringRef File,
+    std::string &Key,
+    clang::tooling::Replacements &Replace);
+
+  /// Atomically replaces the entry for \p Key
+  void store(
+    llvm::StringRef Key,
+    const clang::tooling::Replacements &Replace);
+
+  unsigned getHits() const { return Hits; }
+  unsigned getMisses() const { return Misses; }
+
+private:
+  bool computeKey(
+    const clang::tooling::CompilationDatabase &Compilations,
+    llvm::StringRef File,
+    std::string &Key);
+
+  std::string getEntryPath(llvm::StringRef Key) const;
+
+  const std::string Directory;
+  const std::string ToolKey;
+  std::atomic<unsigned> Hits;
+  std::atomic<unsigned> Misses;
+};
+
+#endif
@@ -0,0 +1,61 @@
+//===-- NseFileFilter.cpp - Files to instrument ---------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "NseFileFilter.h"
+
+using namespace clang;
+
+bool NseHeaderRegistry::claim(const llvm::sys::fs::UniqueID &File,
+  unsigned Owner) {
+
+  std::lock_guard<std::mutex> Lock(Mutex);
+  return Owners.insert(std::make_pair(File, Owner)).first->second == Owner;
+}
+
+unsigned NseHeaderRegistry::size() const {
+  std::lock_guard<std::mutex> Lock(Mutex);
+  return Owners.size();
+}
+
+void NseFileFilter::reset() {
+  Instrumented.clear();
+  if (Registry)
+    Owner = Registry->newOwner();
+}
+
+bool NseFileFilter::isInstrumented(const SourceManager &SM,
+  SourceLocation Loc) {
+
+  if (SM.isWrittenInMainFile(Loc))
+    return true;
+
+  if (!isUserFile(SM, Loc))
+    return false;
+
+  const FileID FID = SM.getFileID(Loc);
+  llvm::DenseMap<FileID, bool>::iterator I = Instrumented.find(FID);
+  if (I != Instrumented.end())
+    return I->second;
+
+  const FileEntry *File = SM.getFileEntryForID(FID);
+  const bool Claimed = File && Registry->claim(File->getUniqueID(), Owner);
+  Instrumented[FID] = Claimed;
+  return Claimed;
+}
+
+bool NseFileFilter::isUserFile(const SourceManager &SM,
+  SourceLocation Loc) const {
+
+  if (SM.isWrittenInMainFile(Loc))
+    return true;
+
+  // like isWrittenInMainFile(), macro expansions do not count
+  return Registry && Loc.isFileID() && !SM.isInSystemHeader(Loc) &&
+    SM.getFileEntryForID(SM.getFileID(Loc));
+}
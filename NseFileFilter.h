@@ -0,0 +1,86 @@
+//===-- NseFileFilter.h - Files to instrument -------------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief Decides which files of a translation unit are instrumented
+///
+/// By default, only the main file of a translation unit is instrumented.
+/// In project mode, user headers are instrumented, too, but system headers
+/// are not. Every translation unit that includes a header would compute the
+/// same replacements for it again, so a header is instead claimed by the
+/// first translation unit that reaches it, and all other translation units
+/// leave it alone.
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef CLANG_CRV_FILE_FILTER_H
+#define CLANG_CRV_FILE_FILTER_H
+
+#include "clang/Basic/SourceManager.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/Support/FileSystem.h"
+
+#include <atomic>
+#include <map>
+#include <mutex>
+
+/// Owners of the headers of a project. Thread-safe, so a single instance
+/// can be shared by all workers.
+class NseHeaderRegistry {
+public :
+  NseHeaderRegistry()
+      : NextOwner(1) {}
+
+  /// Returns a new owner, one for each translation unit
+  unsigned newOwner() { return NextOwner++; }
+
+  /// Makes \p Owner the owner of \p File unless it already has one, and
+  /// returns whether \p Owner owns it
+  bool claim(const llvm::sys::fs::UniqueID &File, unsigned Owner);
+
+  /// Number of headers that have been claimed
+  unsigned size() const;
+
+private:
+  std::atomic<unsigned> NextOwner;
+  mutable std::mutex Mutex;
+  std::map<llvm::sys::fs::UniqueID, unsigned> Owners;
+};
+
+/// Which files of the current translation unit are instrumented
+class NseFileFilter {
+public :
+  /// Instruments user headers claimed in \p Registry, if not null, besides
+  /// the main file
+  NseFileFilter(NseHeaderRegistry *Registry)
+      : Registry(Registry),
+        Owner(0) {}
+
+  /// Forgets the files of the previous translation unit
+  void reset();
+
+  /// Whether \p Loc is written in a file that is instrumented by the
+  /// current translation unit
+  bool isInstrumented(const clang::SourceManager &SM,
+    clang::SourceLocation Loc);
+
+  /// Whether \p Loc is written in the main file or, in project mode, in a
+  /// user header, no matter which translation unit instruments it
+  bool isUserFile(const clang::SourceManager &SM,
+    clang::SourceLocation Loc) const;
+
+private:
+  NseHeaderRegistry *Registry;
+  unsigned Owner;
+
+  /// Files of the current translation unit that have been looked up before
+  llvm::DenseMap<clang::FileID, bool> Instrumented;
+};
+
+#endif
@@ -0,0 +1,404 @@
+//===-- NseFold.cpp - Constant folding of instrumented code ---------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#define DEBUG_TYPE "NseFold"
+
+#include "clang/AST/ExprCXX.h"
+#include "clang/AST/RecursiveASTVisitor.h"
+#include "clang/Basic/SourceManager.h"
+#include "clang/Lex/Lexer.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/Support/Debug.h"
+#include "NseFold.h"
+
+using namespace clang;
+
+namespace {
+
+/// Collects the integral variables of a translation unit and those of them
+/// that are used other than by reading their value
+class KnownVarFinder : public RecursiveASTVisitor<KnownVarFinder> {
+public :
+  bool shouldVisitTemplateInstantiations() const { return true; }
+
+  bool VisitVarDecl(VarDecl *V) {
+    const QualType T = V->getType();
+    if (!isa<ParmVarDecl>(V) && T->isIntegralOrEnumerationType() &&
+        !T.isVolatileQualified())
+      Vars.insert(V->getCanonicalDecl());
+    return true;
+  }
+
+  // parents are visited before their children
+  bool VisitImplicitCastExpr(ImplicitCastExpr *E) {
+    if (E->getCastKind() == CK_LValueToRValue)
+      if (const DeclRefExpr *Ref =
+            dyn_cast<DeclRefExpr>(E->getSubExpr()->IgnoreParens()))
+        Reads.insert(Ref);
+    return true;
+  }
+
+  bool VisitDeclRefExpr(DeclRefExpr *E) {
+    if (const VarDecl *V = dyn_cast<VarDecl>(E->getDecl()))
+      if (!Reads.count(E))
+        Written.insert(V->getCanonicalDecl());
+    return true;
+  }
+
+  llvm::DenseSet<const VarDecl *> Vars;
+  llvm::DenseSet<const VarDecl *> Written;
+
+private:
+  llvm::DenseSet<const DeclRefExpr *> Reads;
+};
+
+} // end anonymous namespace
+
+/// Converts \p Value to the width and signedness of \p T
+static llvm::APSInt convert(
+  const llvm::APSInt &Value,
+  QualType T,
+  ASTContext &Context) {
+
+  if (T->isBooleanType())
+    return llvm::APSInt(llvm::APInt(Context.getIntWidth(T),
+      Value.getBoolValue()), /*isUnsigned=*/true);
+
+  llvm::APSInt Result = Value.extOrTrunc(Context.getIntWidth(T));
+  Result.setIsUnsigned(!T->isSignedIntegerOrEnumerationType());
+  return Result;
+}
+
+/// Applies \p Op to the integral operands \p L and \p R. Returns false if
+/// the result is undefined or the operator is not supported.
+static bool applyBinaryOperator(
+  BinaryOperatorKind Op,
+  const llvm::APSInt &L,
+  const llvm::APSInt &R,
+  llvm::APSInt &Result) {
+
+  // the operands of shifts and logical operators are converted separately
+  const bool SameType = L.getBitWidth() == R.getBitWidth() &&
+    L.isSigned() == R.isSigned();
+  bool Overflow = false;
+
+  switch (Op) {
+  case BO_Shl:
+  case BO_Shr: {
+    if (R.isNegative() || R.getActiveBits() > 32 ||
+        R.getZExtValue() >= L.getBitWidth())
+      return false;
+
+    const unsigned Amount = R.getZExtValue();
+    if (Op == BO_Shr) {
+      Result = L >> Amount;
+      return true;
+    }
+
+    // shifting into or out of the sign bit is undefined
+    if (L.isSigned() && (L.isNegative() || L.countLeadingZeros() <= Amount))
+      return false;
+    Result = llvm::APSInt(L.shl(Amount), L.isUnsigned());
+    return true;
+  }
+  case BO_LAnd:
+    Result = llvm::APSInt::get(L.getBoolValue() && R.getBoolValue());
+    return true;
+  case BO_LOr:
+    Result = llvm::APSInt::get(L.getBoolValue() || R.getBoolValue());
+    return true;
+  default:
+    break;
+  }
+
+  if (!SameType)
+    return false;
+
+  switch (Op) {
+  case BO_Mul:
+    Result = L.isSigned() ? llvm::APSInt(L.smul_ov(R, Overflow), false)
+                          : L * R;
+    return !Overflow;
+  case BO_Add:
+    Result = L.isSigned() ? llvm::APSInt(L.sadd_ov(R, Overflow), false)
+                          : L + R;
+    return !Overflow;
+  case BO_Sub:
+    Result = L.isSigned() ? llvm::APSInt(L.ssub_ov(R, Overflow), false)
+                          : L - R;
+    return !Overflow;
+  case BO_Div:
+  case BO_Rem:
+    if (!R || (L.isSigned() && L.isMinSignedValue() && R.isAllOnesValue()))
+      return false;
+    Result = Op == BO_Div ? L / R : L % R;
+    return true;
+  case BO_LT: Result = llvm::APSInt::get(L < R); return true;
+  case BO_GT: Result = llvm::APSInt::get(L > R); return true;
+  case BO_LE: Result = llvm::APSInt::get(L <= R); return true;
+  case BO_GE: Result = llvm::APSInt::get(L >= R); return true;
+  case BO_EQ: Result = llvm::APSInt::get(L == R); return true;
+  case BO_NE: Result = llvm::APSInt::get(L != R); return true;
+  case BO_And: Result = L & R; return true;
+  case BO_Xor: Result = L ^ R; return true;
+  case BO_Or: Result = L | R; return true;
+  default:
+    return false;
+  }
+}
+
+void ConstantFolder::analyze(ASTContext &Context) {
+  Constants.clear();
+
+  KnownVarFinder Finder;
+  Finder.TraverseDecl(Context.getTranslationUnitDecl());
+
+  for (const VarDecl *V : Finder.Vars) {
+    const bool Const = V->getType().isConstQualified();
+    if (!Const && (!V->hasGlobalStorage() || Finder.Written.count(V)))
+      continue;
+
+    // another translation unit may write a global with external linkage
+    if (!Const && V->hasExternalFormalLinkage())
+      continue;
+
+    // extern declarations are defined by another translation unit
+    const VarDecl *Definition = V->getDefinition();
+    if (!Definition)
+      continue;
+
+    if (!Definition->hasInit()) {
+      // only static storage is zero-initialized
+      if (!Const && V->hasGlobalStorage())
+        Constants[V] = llvm::APSInt(
+          llvm::APInt(Context.getIntWidth(V->getType()), 0));
+      continue;
+    }
+
+    const APValue *Init = Definition->evaluateValue();
+    if (Init && Init->isInt())
+      Constants[V] = Init->getInt();
+  }
+
+  DEBUG(llvm::dbgs() << "ConstantFolder: " << Constants.size()
+                     << " known variables\n");
+}
+
+bool ConstantFolder::isConstant(const Expr *E, ASTContext &Context) const {
+  llvm::APSInt Value;
+  return evaluate(E, Context, Value);
+}
+
+bool ConstantFolder::evaluate(
+  const Expr *E,
+  ASTContext &Context,
+  llvm::APSInt &Value) const {
+
+  E = E->IgnoreParens();
+  const QualType T = E->getType();
+  if (E->isTypeDependent() || E->isValueDependent() ||
+      !T->isIntegralOrEnumerationType())
+    return false;
+
+  if (const IntegerLiteral *L = dyn_cast<IntegerLiteral>(E)) {
+    Value = convert(llvm::APSInt(L->getValue()), T, Context);
+    return true;
+  }
+
+  if (const CharacterLiteral *L = dyn_cast<CharacterLiteral>(E)) {
+    Value = convert(llvm::APSInt::get(L->getValue()), T, Context);
+    return true;
+  }
+
+  if (const CXXBoolLiteralExpr *L = dyn_cast<CXXBoolLiteralExpr>(E)) {
+    Value = convert(llvm::APSInt::get(L->getValue()), T, Context);
+    return true;
+  }
+
+  if (const DeclRefExpr *Ref = dyn_cast<DeclRefExpr>(E)) {
+    if (const EnumConstantDecl *C = dyn_cast<EnumConstantDecl>(Ref->getDecl())) {
+      Value = convert(C->getInitVal(), T, Context);
+      return true;
+    }
+
+    const VarDecl *V = dyn_cast<VarDecl>(Ref->getDecl());
+    if (!V)
+      return false;
+
+    llvm::DenseMap<const VarDecl *, llvm::APSInt>::const_iterator Known =
+      Constants.find(V->getCanonicalDecl());
+    if (Known == Constants.end())
+      return false;
+
+    Value = convert(Known->second, T, Context);
+    return true;
+  }
+
+  if (const ImplicitCastExpr *Cast = dyn_cast<ImplicitCastExpr>(E)) {
+    switch (Cast->getCastKind()) {
+    case CK_LValueToRValue:
+    case CK_NoOp:
+    case CK_IntegralCast:
+    case CK_IntegralToBoolean:
+      break;
+    default:
+      return false;
+    }
+
+    if (!evaluate(Cast->getSubExpr(), Context, Value))
+      return false;
+    Value = convert(Value, T, Context);
+    return true;
+  }
+
+  if (const UnaryOperator *U = dyn_cast<UnaryOperator>(E)) {
+    llvm::APSInt Operand;
+    if (!evaluate(U->getSubExpr(), Context, Operand))
+      return false;
+
+    switch (U->getOpcode()) {
+    case UO_Plus:
+      break;
+    case UO_Minus:
+      if (Operand.isSigned() && Operand.isMinSignedValue())
+        return false;
+      Operand = -Operand;
+      break;
+    case UO_Not:
+      Operand = ~Operand;
+      break;
+    case UO_LNot:
+      Operand = llvm::APSInt::get(!Operand.getBoolValue());
+      break;
+    default:
+      return false;
+    }
+
+    Value = convert(Operand, T, Context);
+    return true;
+  }
+
+  if (const BinaryOperator *B = dyn_cast<BinaryOperator>(E)) {
+    llvm::APSInt L, R, Result;
+    if (!evaluate(B->getLHS(), Context, L) ||
+        !evaluate(B->getRHS(), Context, R) ||
+        !applyBinaryOperator(B->getOpcode(), L, R, Result))
+      return false;
+
+    Value = convert(Result, T, Context);
+    return true;
+  }
+
+  // only the selected operand is evaluated at runtime
+  if (const ConditionalOperator *C = dyn_cast<ConditionalOperator>(E)) {
+    llvm::APSInt Cond;
+    if (!evaluate(C->getCond(), Context, Cond) ||
+        !evaluate(Cond.getBoolValue() ? C->getTrueExpr() : C->getFalseExpr(),
+          Context, Value))
+      return false;
+
+    Value = convert(Value, T, Context);
+    return true;
+  }
+
+  return false;
+}
+
+std::string ConstantFolder::getLiteral(
+  const llvm::APSInt &Value,
+  QualType T,
+  ASTContext &Context) {
+
+  if (T->isBooleanType()) {
+    if (Context.getLangOpts().Bool)
+      return Value.getBoolValue() ? "true" : "false";
+    return Value.getBoolValue() ? "1" : "0";
+  }
+
+  const char *Suffix = nullptr;
+  if (const BuiltinType *BT = dyn_cast<BuiltinType>(T.getCanonicalType())) {
+    switch (BT->getKind()) {
+    case BuiltinType::Int: Suffix = ""; break;
+    case BuiltinType::UInt: Suffix = "U"; break;
+    case BuiltinType::Long: Suffix = "L"; break;
+    case BuiltinType::ULong: Suffix = "UL"; break;
+    case BuiltinType::LongLong: Suffix = "LL"; break;
+    case BuiltinType::ULongLong: Suffix = "ULL"; break;
+    default: break;
+    }
+  }
+
+  // other integral types have no literals, so cast one of a wider type
+  if (!Suffix) {
+    QualType Literal = Context.IntTy;
+    if (Context.getIntWidth(T) >= Context.getIntWidth(Context.IntTy))
+      Literal = T->isSignedIntegerOrEnumerationType() ? Context.LongLongTy
+        : Context.UnsignedLongLongTy;
+    return "((" + T.getUnqualifiedType().getAsString() + ")" +
+      getLiteral(convert(Value, Literal, Context), Literal, Context) + ")";
+  }
+
+  // the literal for the minimum value would not fit into its own type
+  if (Value.isSigned() && Value.isMinSignedValue()) {
+    llvm::APSInt Next = Value;
+    ++Next;
+    return "(" + Next.toString(10) + Suffix + " - 1)";
+  }
+
+  if (Value.isNegative())
+    return "(" + Value.toString(10) + Suffix + ")";
+
+  return Value.toString(10) + Suffix;
+}
+
+unsigned ConstantFolder::fold(
+  const Expr *E,
+  const SymbolicTaintAnalysis &Taint,
+  ASTContext &Context,
+  NseReplacementBuffer &Replace) const {
+
+  if (!E)
+    return 0;
+
+  // the operands of sizeof and alignof are never evaluated
+  E = E->IgnoreParens();
+  if (isa<UnaryExprOrTypeTraitExpr>(E))
+    return 0;
+
+  // an implicit cast is not written, so the literal replaces its operand
+  if (const ImplicitCastExpr *Cast = dyn_cast<ImplicitCastExpr>(E))
+    return fold(Cast->getSubExpr(), Taint, Context, Replace);
+
+  llvm::APSInt Value;
+  if (evaluate(E, Context, Value)) {
+    // literals and expressions over native variables are left alone
+    if (!Taint.isSymbolicExpr(E))
+      return 0;
+
+    SourceManager &SM = Context.getSourceManager();
+    if (E->getLocStart().isMacroID() || E->getLocEnd().isMacroID())
+      return 0;
+
+    CharSourceRange Range = Lexer::makeFileCharRange(
+      CharSourceRange::getTokenRange(E->getSourceRange()), SM,
+      Context.getLangOpts());
+    if (Range.isInvalid())
+      return 0;
+
+    Replace.insert(SM, Range, getLiteral(Value, E->getType(), Context));
+    return 1;
+  }
+
+  unsigned Folded = 0;
+  for (Stmt::const_child_iterator I = E->child_begin(), End = E->child_end();
+       I != End; ++I)
+    if (const Expr *Child = dyn_cast_or_null<Expr>(*I))
+      Folded += fold(Child, Taint, Context, Replace);
+  return Folded;
+}
@@ -0,0 +1,77 @@
+//===-- NseFold.h - Constant folding of instrumented code -------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief Replaces constant subexpressions that read instrumented variables
+///
+/// Once a variable is instrumented, every expression that reads it builds
+/// crv::Internal expression nodes at runtime, even if its value is known at
+/// compile time, e.g. (N * 4 + 1) where N is never modified. The folder
+/// evaluates such integral subexpressions and replaces them by a literal, so
+/// neither the runtime nor the solver ever see them.
+///
+/// A variable is known if it is const or constexpr, or if it has static
+/// storage duration, internal linkage or none, is defined in the translation
+/// unit and all its uses are reads. In both cases, its initializer must be a
+/// constant expression. A non-const global with external linkage is never
+/// known, since another translation unit may write it.
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef CLANG_CRV_FOLD_H
+#define CLANG_CRV_FOLD_H
+
+#include "clang/AST/ASTContext.h"
+#include "clang/AST/Decl.h"
+#include "clang/AST/Expr.h"
+#include "llvm/ADT/APSInt.h"
+#include "llvm/ADT/DenseMap.h"
+#include "NseReplacementBuffer.h"
+#include "NseTaint.h"
+
+#include <string>
+
+class ConstantFolder {
+public :
+  /// Discards the known variables of the previous translation unit and
+  /// finds those of \p Context
+  void analyze(clang::ASTContext &Context);
+
+  /// True if \p E is an integral expression whose value is known
+  bool isConstant(const clang::Expr *E, clang::ASTContext &Context) const;
+
+  /// Replaces every maximal known subexpression of \p E that reads an
+  /// instrumented variable by a literal. Returns the number of replaced
+  /// subexpressions.
+  unsigned fold(
+    const clang::Expr *E,
+    const SymbolicTaintAnalysis &Taint,
+    clang::ASTContext &Context,
+    NseReplacementBuffer &Replace) const;
+
+  /// Spells \p Value as a literal of type \p T
+  static std::string getLiteral(
+    const llvm::APSInt &Value,
+    clang::QualType T,
+    clang::ASTContext &Context);
+
+private:
+  /// Evaluates the integral expression \p E into \p Value. Returns false
+  /// if \p E is not known, or if evaluating it is undefined, such as a
+  /// division by zero.
+  bool evaluate(
+    const clang::Expr *E,
+    clang::ASTContext &Context,
+    llvm::APSInt &Value) const;
+
+  /// Values of the known variables, keyed by canonical declaration
+  llvm::DenseMap<const clang::VarDecl *, llvm::APSInt> Constants;
+};
+
+#endif
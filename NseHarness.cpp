@@ -0,0 +1,539 @@
+//===-- NseHarness.cpp - Generated path exploration harness ---------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "NseHarness.h"
+
+#include <algorithm>
+
+const char *NseSlicedBranchFunctionName = "nse_sliced_branch";
+
+std::string getHarnessBranchFunction(
+  const std::string& NseStrategy,
+  const std::string& NseBranch,
+  const NseHarnessOptions &Options) {
+
+  switch (Options.Kind) {
+  case SequentialHarness:
+    break;
+  case ParallelHarness:
+    return "nse_harness_branch";
+  case SnapshotHarness:
+    return "nse_snapshot_branch";
+  }
+
+  return NseStrategy + "." + NseBranch;
+}
+
+static std::string makeParallelPrologue(
+  const std::string& NseStrategy,
+  const std::string& NseBranch) {
+
+  return
+    "#include <algorithm>\n"
+    "#include <atomic>\n"
+    "#include <csignal>\n"
+    "#include <cstdio>\n"
+    "#include <new>\n"
+    "#include <utility>\n"
+    "#include <vector>\n"
+    "#include <sys/mman.h>\n"
+    "#include <sys/wait.h>\n"
+    "#include <unistd.h>\n"
+    "\n"
+    "struct nse_path_abandoned {};\n"
+    "\n"
+    "struct nse_harness_state {\n"
+    "  unsigned split_depth;\n"
+    "  unsigned long prefix;\n"
+    "  unsigned depth;\n"
+    "};\n"
+    "\n"
+    "inline nse_harness_state& nse_harness() {\n"
+    "  static nse_harness_state state = {0, 0, 0};\n"
+    "  return state;\n"
+    "}\n"
+    "\n"
+    "template<typename T>\n"
+    "inline bool nse_harness_branch(T&& cond) {\n"
+    "  nse_harness_state& h = nse_harness();\n"
+    "  const bool direction = " + NseStrategy + "." + NseBranch +
+        "(std::forward<T>(cond));\n"
+    "  if (h.depth < h.split_depth) {\n"
+    "    if (direction != (((h.prefix >> h.depth) & 1) != 0))\n"
+    "      throw nse_path_abandoned();\n"
+    "    ++h.depth;\n"
+    "  }\n"
+    "  return direction;\n"
+    "}\n"
+    "\n";
+}
+
+static std::string makeSnapshotPrologue(
+  const std::string& NseStrategy,
+  const std::string& NseBranch) {
+
+  return
+    "#include <atomic>\n"
+    "#include <cerrno>\n"
+    "#include <cstdio>\n"
+    "#include <new>\n"
+    "#include <utility>\n"
+    "#include <vector>\n"
+    "#include <sys/mman.h>\n"
+    "#include <sys/wait.h>\n"
+    "#include <unistd.h>\n"
+    "\n"
+    "struct nse_snapshot_bug {};\n"
+    "\n"
+    "// shared by all processes of a run\n"
+    "struct nse_snapshot_counters {\n"
+    "  std::atomic<unsigned long> taken;\n"
+    "  std::atomic<unsigned long> resumed;\n"
+    "  std::atomic<unsigned long> runs;\n"
+    "  std::atomic<unsigned long> paths;\n"
+    "  std::atomic<unsigned long> points_not_replayed;\n"
+    "};\n"
+    "\n"
+    "struct nse_snapshot_state {\n"
+    "  unsigned max_snapshots;\n"
+    "  bool is_child;\n"
+    "  // symbolic branch points reached by the current run of nse_main()\n"
+    "  unsigned point;\n"
+    "  // directions taken at the snapshots of this process and its ancestors\n"
+    "  std::vector<bool> forced;\n"
+    "  nse_snapshot_counters* counters;\n"
+    "};\n"
+    "\n"
+    "inline nse_snapshot_state& nse_snapshot() {\n"
+    "  static nse_snapshot_state state = {0, false, 0, std::vector<bool>(), nullptr};\n"
+    "  return state;\n"
+    "}\n"
+    "\n"
+    "inline bool nse_is_concrete(bool) { return true; }\n"
+    "template<typename T>\n"
+    "inline bool nse_is_concrete(const T& cond) { return cond.is_literal(); }\n"
+    "\n"
+    "inline bool nse_concrete_value(bool cond) { return cond; }\n"
+    "template<typename T>\n"
+    "inline bool nse_concrete_value(const T& cond) { return cond.literal(); }\n"
+    "\n"
+    "template<typename T>\n"
+    "inline bool nse_snapshot_branch(T&& cond) {\n"
+    "  nse_snapshot_state& s = nse_snapshot();\n"
+    "  if (nse_is_concrete(cond))\n"
+    "    return nse_concrete_value(cond);\n"
+    "\n"
+    "  // replay the direction of a snapshot after the strategy backtracked\n"
+    "  if (s.point < s.forced.size()) {\n"
+    "    const bool direction = s.forced[s.point++];\n"
+    "    if (direction)\n"
+    "      " + NseStrategy + ".add_assertion(cond);\n"
+    "    else\n"
+    "      " + NseStrategy + ".add_assertion(!cond);\n"
+    "    return direction;\n"
+    "  }\n"
+    "\n"
+    "  if (s.forced.size() < s.max_snapshots) {\n"
+    "    std::fflush(nullptr);\n"
+    "    std::cout.flush();\n"
+    "    const pid_t pid = fork();\n"
+    "    if (pid == 0) {\n"
+    "      s.is_child = true;\n"
+    "      s.forced.push_back(true);\n"
+    "      ++s.point;\n"
+    "      " + NseStrategy + ".add_assertion(cond);\n"
+    "      return true;\n"
+    "    }\n"
+    "\n"
+    "    if (pid > 0) {\n"
+    "      ++s.counters->taken;\n"
+    "      int status;\n"
+    "      while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {}\n"
+    "      if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)\n"
+    "        throw nse_snapshot_bug();\n"
+    "\n"
+    "      // without the snapshot, the strategy would have replayed them\n"
+    "      ++s.counters->resumed;\n"
+    "      s.counters->points_not_replayed += s.point;\n"
+    "      s.forced.push_back(false);\n"
+    "      ++s.point;\n"
+    "      " + NseStrategy + ".add_assertion(!cond);\n"
+    "      return false;\n"
+    "    }\n"
+    "\n"
+    "    std::perror(\"fork\");\n"
+    "    s.max_snapshots = s.forced.size();\n"
+    "  }\n"
+    "\n"
+    "  return " + NseStrategy + "." + NseBranch + "(std::forward<T>(cond));\n"
+    "}\n"
+    "\n";
+}
+
+static std::string makeMemoizePrologue() {
+  return
+    "#include <cstring>\n"
+    "#include <map>\n"
+    "#include <tuple>\n"
+    "#include <type_traits>\n"
+    "#include <utility>\n"
+    "#include <vector>\n"
+    "\n"
+    "struct nse_memo_counters {\n"
+    "  unsigned long hits;\n"
+    "  unsigned long misses;\n"
+    "};\n"
+    "\n"
+    "inline nse_memo_counters& nse_memo_stats() {\n"
+    "  static nse_memo_counters counters = {0, 0};\n"
+    "  return counters;\n"
+    "}\n"
+    "\n"
+    "typedef std::vector<unsigned long long> nse_memo_key_type;\n"
+    "\n"
+    "template<typename T>\n"
+    "inline typename std::enable_if<std::is_arithmetic<T>::value, bool>::type\n"
+    "nse_memo_key(const T& arg, nse_memo_key_type& key) {\n"
+    "  if (sizeof(T) > sizeof(unsigned long long))\n"
+    "    return false;\n"
+    "\n"
+    "  unsigned long long bits = 0;\n"
+    "  std::memcpy(&bits, &arg, sizeof(T));\n"
+    "  key.push_back(0);\n"
+    "  key.push_back(bits);\n"
+    "  return true;\n"
+    "}\n"
+    "\n"
+    "template<typename T>\n"
+    "inline typename std::enable_if<!std::is_arithmetic<T>::value, bool>::type\n"
+    "nse_memo_key(const T& arg, nse_memo_key_type& key) {\n"
+    "  if (arg.is_literal())\n"
+    "    return nse_memo_key(arg.literal(), key);\n"
+    "\n"
+    "  // the address of the shared expression of a crv::Internal\n"
+    "  key.push_back(1);\n"
+    "  key.push_back((unsigned long long)(arg.term.addr()));\n"
+    "  return true;\n"
+    "}\n"
+    "\n"
+    "inline bool nse_memo_keys(nse_memo_key_type&) { return true; }\n"
+    "\n"
+    "template<typename T, typename... Ts>\n"
+    "inline bool nse_memo_keys(nse_memo_key_type& key, const T& arg, const Ts&... args) {\n"
+    "  return nse_memo_key(arg, key) && nse_memo_keys(key, args...);\n"
+    "}\n"
+    "\n"
+    "// every pure function passes a lambda of its own type, so each one gets\n"
+    "// its own cache\n"
+    "template<typename F, typename... Args>\n"
+    "inline auto nse_memoize(F&& body, const Args&... args) -> decltype(body()) {\n"
+    "  typedef typename std::decay<decltype(body())>::type result_type;\n"
+    "  struct entry {\n"
+    "    // keeps the argument expressions alive, so no identity is reused\n"
+    "    std::tuple<Args...> args;\n"
+    "    result_type result;\n"
+    "  };\n"
+    "  static std::map<nse_memo_key_type, entry> cache;\n"
+    "\n"
+    "  nse_memo_counters& stats = nse_memo_stats();\n"
+    "  nse_memo_key_type key;\n"
+    "  if (!nse_memo_keys(key, args...)) {\n"
+    "    ++stats.misses;\n"
+    "    return body();\n"
+    "  }\n"
+    "\n"
+    "  typename std::map<nse_memo_key_type, entry>::const_iterator known = cache.find(key);\n"
+    "  if (known != cache.end()) {\n"
+    "    ++stats.hits;\n"
+    "    return known->second.result;\n"
+    "  }\n"
+    "\n"
+    "  // the body may assign to the parameters\n"
+    "  std::tuple<Args...> saved(args...);\n"
+    "  ++stats.misses;\n"
+    "  result_type result = body();\n"
+    "  if (cache.size() >= 4096)\n"
+    "    cache.clear();\n"
+    "  cache.insert(std::make_pair(std::move(key), entry{std::move(saved), result}));\n"
+    "  return result;\n"
+    "}\n"
+    "\n";
+}
+
+static std::string makeSlicePrologue() {
+  return
+    "inline bool " + std::string(NseSlicedBranchFunctionName) +
+    "(bool cond) { return cond; }\n"
+    "template<typename T>\n"
+    "inline bool " + std::string(NseSlicedBranchFunctionName) +
+    "(const T& cond) {\n"
+    "  // no assertion depends on the direction, so any will do\n"
+    "  return cond.is_literal() && cond.literal();\n"
+    "}\n"
+    "\n";
+}
+
+std::string makeHarnessPrologue(
+  const std::string& NseStrategy,
+  const std::string& NseBranch,
+  const NseHarnessOptions &Options) {
+
+  const std::string Memoize = (Options.Memoize ? makeMemoizePrologue() : "") +
+    (Options.Slice ? makeSlicePrologue() : "");
+  switch (Options.Kind) {
+  case SequentialHarness:
+    break;
+  case ParallelHarness:
+    return Memoize + makeParallelPrologue(NseStrategy, NseBranch);
+  case SnapshotHarness:
+    return Memoize + makeSnapshotPrologue(NseStrategy, NseBranch);
+  }
+
+  return Memoize;
+}
+
+/// Returns the statement that prints the hits and misses of nse_memoize()
+static std::string makeMemoizeReport(const NseHarnessOptions &Options) {
+  if (!Options.Memoize)
+    return "";
+
+  return
+    "  std::cout << \"Memoized calls: \" << nse_memo_stats().hits << \" hits, \"\n"
+    "            << nse_memo_stats().misses << \" misses\" << std::endl;\n";
+}
+
+static std::string makeSequentialMain(
+  const std::string& NseStrategy,
+  const NseHarnessOptions &Options) {
+
+  return
+    "int main() {\n"
+    "  bool error = false;\n"
+    "  unsigned long paths = 0;\n"
+    "  std::chrono::seconds seconds(std::chrono::seconds::zero());\n"
+    "  {\n"
+    "    smt::NonReentrantTimer<std::chrono::seconds> timer(seconds);\n"
+    "\n"
+    "    do {\n"
+    "      nse_main();\n"
+    "      ++paths;\n"
+    "      error |= smt::sat == " + NseStrategy + ".check();\n"
+    "    } while (" + NseStrategy + ".find_next_path() && !error);\n"
+    "  }\n"
+    "\n"
+    "  if (error)\n"
+    "    std::cout << \"Found bug!\" << std::endl;\n"
+    "  else\n"
+    "    std::cout << \"Could not find any bugs.\" << std::endl;\n"
+    "\n"
+    "  report_statistics(" + NseStrategy + ".solver().stats(), " + NseStrategy + ".stats(), seconds);\n" +
+    makeMemoizeReport(Options) +
+    "  std::cout << \"Explored \" << paths << \" paths\" << std::endl;\n"
+    "\n"
+    "  return error;\n"
+    "}";
+}
+
+static std::string makeParallelMain(
+  const std::string& NseStrategy,
+  const NseHarnessOptions &Options) {
+
+  const std::string Jobs = std::to_string(Options.Jobs);
+  // prefixes are numbered by an unsigned long
+  const std::string SplitDepth =
+    std::to_string(std::min(Options.SplitDepth, 31u));
+
+  return
+    "// explores the paths that start with the branch decisions in prefix and\n"
+    "// adds their number to explored, which all workers share\n"
+    "static int nse_explore_prefix(unsigned split_depth, unsigned long prefix,\n"
+    "  std::atomic<unsigned long>& explored) {\n"
+    "  nse_harness_state& h = nse_harness();\n"
+    "  h.split_depth = split_depth;\n"
+    "  h.prefix = prefix;\n"
+    "\n"
+    "  bool error = false;\n"
+    "  unsigned long paths = 0;\n"
+    "  std::chrono::seconds seconds(std::chrono::seconds::zero());\n"
+    "  {\n"
+    "    smt::NonReentrantTimer<std::chrono::seconds> timer(seconds);\n"
+    "\n"
+    "    do {\n"
+    "      h.depth = 0;\n"
+    "      try {\n"
+    "        nse_main();\n"
+    "\n"
+    "        // a path with fewer decisions belongs to the prefix padded with zeros\n"
+    "        if ((h.prefix >> h.depth) == 0) {\n"
+    "          ++paths;\n"
+    "          error |= smt::sat == " + NseStrategy + ".check();\n"
+    "        }\n"
+    "      } catch (const nse_path_abandoned&) {}\n"
+    "    } while (" + NseStrategy + ".find_next_path() && !error);\n"
+    "  }\n"
+    "\n"
+    "  explored += paths;\n"
+    "  std::cout << \"Prefix \" << prefix << \": \" << paths << \" paths\" << std::endl;\n"
+    "  report_statistics(" + NseStrategy + ".solver().stats(), " + NseStrategy + ".stats(), seconds);\n" +
+    makeMemoizeReport(Options) +
+    "  std::cout.flush();\n"
+    "  return error ? 1 : 0;\n"
+    "}\n"
+    "\n"
+    "int main() {\n"
+    "  unsigned jobs = " + Jobs + ";\n"
+    "  if (jobs == 0) {\n"
+    "    long cores = sysconf(_SC_NPROCESSORS_ONLN);\n"
+    "    jobs = cores > 0 ? cores : 1;\n"
+    "  }\n"
+    "\n"
+    "  unsigned split_depth = " + SplitDepth + ";\n"
+    "  if (split_depth == 0)\n"
+    "    while ((1ul << ++split_depth) < 4ul * jobs) {}\n"
+    "\n"
+    "  void* shared = mmap(nullptr, sizeof(std::atomic<unsigned long>),\n"
+    "    PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);\n"
+    "  if (shared == MAP_FAILED) {\n"
+    "    std::perror(\"mmap\");\n"
+    "    return 2;\n"
+    "  }\n"
+    "  std::atomic<unsigned long>& paths = *new (shared) std::atomic<unsigned long>(0);\n"
+    "\n"
+    "  const unsigned long prefixes = 1ul << split_depth;\n"
+    "  unsigned long next_prefix = 0;\n"
+    "  std::vector<pid_t> workers;\n"
+    "  bool error = false;\n"
+    "  std::chrono::seconds seconds(std::chrono::seconds::zero());\n"
+    "  {\n"
+    "    smt::NonReentrantTimer<std::chrono::seconds> timer(seconds);\n"
+    "\n"
+    "    while (!error && (next_prefix < prefixes || !workers.empty())) {\n"
+    "      if (next_prefix < prefixes && workers.size() < jobs) {\n"
+    "        std::cout.flush();\n"
+    "        const pid_t pid = fork();\n"
+    "        if (pid == 0)\n"
+    "          _exit(nse_explore_prefix(split_depth, next_prefix, paths));\n"
+    "\n"
+    "        if (pid > 0) {\n"
+    "          workers.push_back(pid);\n"
+    "          ++next_prefix;\n"
+    "          continue;\n"
+    "        }\n"
+    "\n"
+    "        std::perror(\"fork\");\n"
+    "        if (workers.empty())\n"
+    "          return 2;\n"
+    "      }\n"
+    "\n"
+    "      int status;\n"
+    "      const pid_t pid = wait(&status);\n"
+    "      if (pid < 0)\n"
+    "        break;\n"
+    "\n"
+    "      workers.erase(std::remove(workers.begin(), workers.end(), pid), workers.end());\n"
+    "      if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)\n"
+    "        error = true;\n"
+    "    }\n"
+    "\n"
+    "    for (pid_t pid : workers)\n"
+    "      kill(pid, SIGKILL);\n"
+    "    for (pid_t pid : workers)\n"
+    "      waitpid(pid, nullptr, 0);\n"
+    "  }\n"
+    "\n"
+    "  if (error)\n"
+    "    std::cout << \"Found bug!\" << std::endl;\n"
+    "  else\n"
+    "    std::cout << \"Could not find any bugs.\" << std::endl;\n"
+    "\n"
+    "  std::cout << \"Prefixes: \" << next_prefix << \" of \" << prefixes\n"
+    "            << \" started with \" << jobs << \" workers in \"\n"
+    "            << seconds.count() << \" seconds\" << std::endl;\n"
+    "  std::cout << \"Explored \" << paths << \" paths\" << std::endl;\n"
+    "\n"
+    "  return error;\n"
+    "}";
+}
+
+static std::string makeSnapshotMain(
+  const std::string& NseStrategy,
+  const NseHarnessOptions &Options) {
+
+  const std::string MaxSnapshots = std::to_string(Options.MaxSnapshots);
+
+  return
+    "int main() {\n"
+    "  nse_snapshot_state& s = nse_snapshot();\n"
+    "  s.max_snapshots = " + MaxSnapshots + ";\n"
+    "\n"
+    "  void* shared = mmap(nullptr, sizeof(nse_snapshot_counters),\n"
+    "    PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);\n"
+    "  if (shared == MAP_FAILED) {\n"
+    "    std::perror(\"mmap\");\n"
+    "    return 2;\n"
+    "  }\n"
+    "  s.counters = new (shared) nse_snapshot_counters();\n"
+    "\n"
+    "  bool error = false;\n"
+    "  std::chrono::seconds seconds(std::chrono::seconds::zero());\n"
+    "  {\n"
+    "    smt::NonReentrantTimer<std::chrono::seconds> timer(seconds);\n"
+    "\n"
+    "    // forked snapshots return from nse_main() into this loop, too\n"
+    "    do {\n"
+    "      s.point = 0;\n"
+    "      ++s.counters->runs;\n"
+    "      try {\n"
+    "        nse_main();\n"
+    "        ++s.counters->paths;\n"
+    "        error |= smt::sat == " + NseStrategy + ".check();\n"
+    "      } catch (const nse_snapshot_bug&) {\n"
+    "        error = true;\n"
+    "      }\n"
+    "    } while (!error && " + NseStrategy + ".find_next_path());\n"
+    "  }\n"
+    "\n"
+    "  if (s.is_child) {\n"
+    "    std::cout.flush();\n"
+    "    _exit(error ? 1 : 0);\n"
+    "  }\n"
+    "\n"
+    "  if (error)\n"
+    "    std::cout << \"Found bug!\" << std::endl;\n"
+    "  else\n"
+    "    std::cout << \"Could not find any bugs.\" << std::endl;\n"
+    "\n"
+    "  report_statistics(" + NseStrategy + ".solver().stats(), " + NseStrategy + ".stats(), seconds);\n" +
+    makeMemoizeReport(Options) +
+    "\n"
+    "  std::cout << \"Snapshots: \" << s.counters->taken << \" taken, \"\n"
+    "            << s.counters->resumed << \" resumed, \"\n"
+    "            << s.counters->points_not_replayed << \" branch points not replayed, \"\n"
+    "            << s.counters->runs << \" runs of nse_main()\" << std::endl;\n"
+    "  std::cout << \"Explored \" << s.counters->paths << \" paths\" << std::endl;\n"
+    "\n"
+    "  return error;\n"
+    "}";
+}
+
+std::string makeHarnessMain(
+  const std::string& NseStrategy,
+  const NseHarnessOptions &Options) {
+
+  switch (Options.Kind) {
+  case SequentialHarness:
+    return makeSequentialMain(NseStrategy, Options);
+  case ParallelHarness:
+    return makeParallelMain(NseStrategy, Options);
+  case SnapshotHarness:
+    return makeSnapshotMain(NseStrategy, Options);
+  }
+
+  return "";
+}
@@ -0,0 +1,114 @@
+//===-- NseHarness.h - Generated path exploration harness -------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief Code that replaces main() to explore all paths through nse_main()
+///
+/// The sequential harness lets the strategy enumerate the paths one after
+/// another. The parallel harness partitions the paths by their first branch
+/// decisions, called the prefix, and explores the prefixes in forked worker
+/// processes, each with its own strategy and solver. Since there are more
+/// prefixes than workers, a worker that finishes early simply takes the next
+/// unexplored prefix. A worker follows the strategy as usual, but abandons
+/// every path whose leading decisions differ from its prefix, so each path
+/// is checked by exactly one worker. The first worker that finds a bug stops
+/// all others.
+///
+/// The snapshot harness forks at symbolic branch points instead. The child
+/// takes the then-branch while the parent waits as a snapshot and resumes
+/// with the else-branch, so neither direction replays the path prefix. Once
+/// a process has as many snapshots as allowed, it falls back to the strategy,
+/// which replays from the top of nse_main(), and snapshot directions are then
+/// enforced by assertions. Conditions are considered concrete if they are
+/// bool or their is_literal() member returns true, in which case literal()
+/// must yield their value.
+///
+/// With memoization, the prologue also defines nse_memoize(), which runs the
+/// body of a pure function only if it has not seen the arguments before.
+/// Arguments are keyed by value if they are concrete and otherwise by the
+/// address of the expression that their term member shares, so a call
+/// hits if it passes the very expressions of an earlier one. The hits and
+/// misses of the process that prints the statistics are reported after
+/// them.
+///
+/// With slicing, the prologue also defines nse_sliced_branch(), which
+/// decides a branch that no assertion depends on without forking, see
+/// AssertionSlice. A concrete condition takes its direction, and a symbolic
+/// one is taken as false, so loops outside the slice stop. Since nothing
+/// in the slice depends on the direction, it is not recorded either.
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef CLANG_CRV_HARNESS_H
+#define CLANG_CRV_HARNESS_H
+
+#include <string>
+
+enum NseHarnessKind {
+  SequentialHarness,
+  ParallelHarness,
+  SnapshotHarness
+};
+
+struct NseHarnessOptions {
+  NseHarnessOptions()
+      : Kind(SequentialHarness),
+        Jobs(0),
+        SplitDepth(0),
+        MaxSnapshots(32),
+        Memoize(false),
+        Slice(false) {}
+
+  NseHarnessKind Kind;
+
+  /// Worker processes of the parallel harness, 0 for one per core
+  unsigned Jobs;
+
+  /// Number of leading branch decisions that form a prefix, 0 to choose
+  /// enough for about four prefixes per worker
+  unsigned SplitDepth;
+
+  /// Maximum number of ancestors of a process of the snapshot harness,
+  /// each of which is suspended in fork()
+  unsigned MaxSnapshots;
+
+  /// Whether pure functions are wrapped in nse_memoize()
+  bool Memoize;
+
+  /// Whether branches outside of the assertion slice are passed to
+  /// nse_sliced_branch()
+  bool Slice;
+};
+
+/// The function that the conditions of branches outside of the assertion
+/// slice are passed to
+extern const char *NseSlicedBranchFunctionName;
+
+/// Returns the function that instrumented conditions are passed to.
+/// \p NseStrategy is the expression that yields the strategy, such as
+/// "crv::sequential_dfs_checker()".
+std::string getHarnessBranchFunction(
+  const std::string& NseStrategy,
+  const std::string& NseBranch,
+  const NseHarnessOptions &Options);
+
+/// Returns the code that must precede the first instrumented branch of a
+/// translation unit, possibly empty. It only consists of inline definitions
+/// so that every translation unit of a program can include it.
+std::string makeHarnessPrologue(
+  const std::string& NseStrategy,
+  const std::string& NseBranch,
+  const NseHarnessOptions &Options);
+
+/// Returns the definition of main() that is appended to nse_main()
+std::string makeHarnessMain(
+  const std::string& NseStrategy,
+  const NseHarnessOptions &Options);
+
+#endif
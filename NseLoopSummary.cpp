@@ -0,0 +1,293 @@
+//===-- NseLoopSummary.cpp - Counted loop summarization -------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#define DEBUG_TYPE "NseLoopSummary"
+
+#include "clang/AST/RecursiveASTVisitor.h"
+#include "llvm/Support/Debug.h"
+#include "NseLoopSummary.h"
+
+using namespace clang;
+
+/// The variable that \p E names, if it is nothing else
+static const VarDecl *getVar(const Expr *E) {
+  const DeclRefExpr *Ref = dyn_cast<DeclRefExpr>(E->IgnoreParenImpCasts());
+  return Ref ? dyn_cast<VarDecl>(Ref->getDecl()) : nullptr;
+}
+
+/// Whether the value of \p V can only change by a write that names it
+static bool isTracked(const VarDecl *V) {
+  return V && V->getType()->isIntegerType() &&
+    !V->getType()->isBooleanType() && !V->getType().isVolatileQualified();
+}
+
+/// Whether \p E is a literal or a tracked variable, possibly negated, which
+/// the summary can copy verbatim
+static bool isOperand(const Expr *E) {
+  E = E->IgnoreParenImpCasts();
+  if (const UnaryOperator *U = dyn_cast<UnaryOperator>(E))
+    if (U->getOpcode() == UO_Minus)
+      E = U->getSubExpr()->IgnoreParenImpCasts();
+
+  if (E->getLocStart().isMacroID() || E->getLocEnd().isMacroID())
+    return false;
+
+  if (isa<IntegerLiteral>(E) || isa<CharacterLiteral>(E))
+    return true;
+
+  if (const DeclRefExpr *Ref = dyn_cast<DeclRefExpr>(E))
+    if (isa<EnumConstantDecl>(Ref->getDecl()))
+      return true;
+
+  return isTracked(getVar(E));
+}
+
+/// Whether \p E increments \p Index if \p Increasing, or decrements it
+static bool isStep(const Stmt *S, const VarDecl *Index, bool Increasing) {
+  const UnaryOperator *U = dyn_cast_or_null<UnaryOperator>(S);
+  if (!U || getVar(U->getSubExpr()) != Index)
+    return false;
+  return Increasing ? U->isIncrementOp() : U->isDecrementOp();
+}
+
+/// Adds the update of \p S to \p Summary, or returns false if \p S is no
+/// update
+static bool addUpdate(const Stmt *S, LoopSummary &Summary) {
+  if (isa<NullStmt>(S))
+    return true;
+
+  LoopSummary::Update Update;
+  if (const CompoundAssignOperator *E = dyn_cast<CompoundAssignOperator>(S)) {
+    if (E->getOpcode() != BO_AddAssign && E->getOpcode() != BO_SubAssign)
+      return false;
+    if (!isOperand(E->getRHS()))
+      return false;
+
+    Update.Var = getVar(E->getLHS());
+    Update.Add = E->getOpcode() == BO_AddAssign;
+    Update.Step = E->getRHS();
+  } else if (const UnaryOperator *E = dyn_cast<UnaryOperator>(S)) {
+    if (!E->isIncrementDecrementOp())
+      return false;
+
+    Update.Var = getVar(E->getSubExpr());
+    Update.Add = E->isIncrementOp();
+    Update.Step = nullptr;
+  } else {
+    return false;
+  }
+
+  if (!isTracked(Update.Var) || Update.Var == Summary.Index)
+    return false;
+  for (const LoopSummary::Update &Other : Summary.Updates)
+    if (Other.Var == Update.Var)
+      return false;
+
+  Summary.Updates.push_back(Update);
+  return true;
+}
+
+/// Whether the operand \p E reads a variable that the loop writes
+static bool isWritten(const Expr *E, const LoopSummary &Summary) {
+  E = E->IgnoreParenImpCasts();
+  if (const UnaryOperator *U = dyn_cast<UnaryOperator>(E))
+    E = U->getSubExpr();
+
+  const VarDecl *V = getVar(E);
+  if (!V)
+    return false;
+
+  if (V == Summary.Index)
+    return true;
+  for (const LoopSummary::Update &Update : Summary.Updates)
+    if (Update.Var == V)
+      return true;
+  return false;
+}
+
+/// Sets the index, bound and direction of \p Summary from the loop
+/// condition \p Cond
+static bool matchCondition(const Expr *Cond, LoopSummary &Summary) {
+  if (!Cond)
+    return false;
+
+  const BinaryOperator *E =
+    dyn_cast<BinaryOperator>(Cond->IgnoreParenImpCasts());
+  if (!E || (E->getOpcode() != BO_LT && E->getOpcode() != BO_GT))
+    return false;
+
+  const VarDecl *Index = getVar(E->getLHS());
+  if (!isTracked(Index) || !isOperand(E->getRHS()) ||
+      Index->getDeclContext()->isDependentContext())
+    return false;
+  if (Summary.Index && Summary.Index != Index)
+    return false;
+
+  // the index is compared in its own type, so it cannot wrap before it
+  // reaches the bound
+  ASTContext &Context = Index->getASTContext();
+  if (!Context.hasSameUnqualifiedType(E->getLHS()->getType(),
+        Index->getType()) ||
+      !Context.hasSameUnqualifiedType(E->getRHS()->getType(),
+        Index->getType()))
+    return false;
+
+  Summary.Index = Index;
+  Summary.Bound = E->getRHS();
+  Summary.Increasing = E->getOpcode() == BO_LT;
+  Summary.Condition = Cond;
+  return true;
+}
+
+/// Checks what the body, the condition and the initialization of a loop
+/// have in common once they are known
+static bool isSummarizable(const LoopSummary &Summary) {
+  if (isWritten(Summary.Bound, Summary))
+    return false;
+
+  ASTContext &Context = Summary.Index->getASTContext();
+  const unsigned Width = Context.getIntWidth(Summary.Index->getType());
+  for (const LoopSummary::Update &Update : Summary.Updates) {
+    if (Update.Step && isWritten(Update.Step, Summary))
+      return false;
+    if (Context.getIntWidth(Update.Var->getType()) > Width)
+      return false;
+  }
+  return true;
+}
+
+/// Collects the loops that LoopSummarization summarizes
+class LoopCollector : public RecursiveASTVisitor<LoopCollector> {
+public :
+  LoopCollector(const SymbolicTaintAnalysis &Taint)
+      : Taint(Taint) {}
+
+  bool VisitForStmt(ForStmt *S) {
+    if (S->getLocStart().isMacroID() || S->getConditionVariable() ||
+        !S->getBody())
+      return true;
+
+    LoopSummary Summary;
+    if (const DeclStmt *Init = dyn_cast_or_null<DeclStmt>(S->getInit())) {
+      const VarDecl *V = Init->isSingleDecl() ?
+        dyn_cast<VarDecl>(Init->getSingleDecl()) : nullptr;
+      if (!V || !V->getInit() || !isOperand(V->getInit()))
+        return true;
+
+      Summary.Index = V;
+      Summary.Init = V->getInit();
+      Summary.DeclaresIndex = true;
+    } else if (const BinaryOperator *Init =
+                 dyn_cast_or_null<BinaryOperator>(S->getInit())) {
+      if (Init->getOpcode() != BO_Assign || !isOperand(Init->getRHS()))
+        return true;
+
+      Summary.Index = getVar(Init->getLHS());
+      Summary.Init = Init->getRHS();
+      if (!Summary.Index)
+        return true;
+    } else if (S->getInit()) {
+      return true;
+    }
+
+    if (!matchCondition(S->getCond(), Summary) ||
+        !isStep(S->getInc(), Summary.Index, Summary.Increasing))
+      return true;
+
+    if (const CompoundStmt *Body = dyn_cast<CompoundStmt>(S->getBody())) {
+      for (CompoundStmt::const_body_iterator I = Body->body_begin(),
+           End = Body->body_end(); I != End; ++I)
+        if (!addUpdate(*I, Summary))
+          return true;
+    } else if (!addUpdate(S->getBody(), Summary)) {
+      return true;
+    }
+
+    add(S, Summary);
+    return true;
+  }
+
+  bool VisitWhileStmt(WhileStmt *S) {
+    if (S->getLocStart().isMacroID() || S->getConditionVariable())
+      return true;
+
+    LoopSummary Summary;
+    const CompoundStmt *Body = dyn_cast<CompoundStmt>(S->getBody());
+    if (!Body || Body->body_empty() || !matchCondition(S->getCond(), Summary) ||
+        !isStep(Body->body_back(), Summary.Index, Summary.Increasing))
+      return true;
+
+    for (CompoundStmt::const_body_iterator I = Body->body_begin(),
+         End = Body->body_end() - 1; I != End; ++I)
+      if (!addUpdate(*I, Summary))
+        return true;
+
+    add(S, Summary);
+    return true;
+  }
+
+  /// Hands the loops that change symbolic values to \p Summarization
+  void finish(LoopSummarization &Summarization) const;
+
+private:
+  void add(const Stmt *Loop, const LoopSummary &Summary) {
+    if (!isSummarizable(Summary))
+      return;
+
+    // a concrete loop runs natively and is not worth the effort
+    bool Symbolic = Taint.isSymbolicExpr(Summary.Condition);
+    for (const LoopSummary::Update &Update : Summary.Updates)
+      Symbolic |= Taint.isSymbolic(Update.Var);
+
+    // the closed form lets the bound and index flow into every update and
+    // the bound into an index that outlives the loop, flows that the taint
+    // analysis never saw, so their targets must already be symbolic
+    const bool SymbolicBound = Taint.isSymbolicExpr(Summary.Bound);
+    const bool SymbolicIndex = Taint.isSymbolic(Summary.Index);
+    if (SymbolicBound && !Summary.DeclaresIndex && !SymbolicIndex)
+      return;
+    if (SymbolicBound || SymbolicIndex)
+      for (const LoopSummary::Update &Update : Summary.Updates)
+        if (!Taint.isSymbolic(Update.Var))
+          return;
+
+    if (Symbolic)
+      Loops.push_back(std::make_pair(Loop, Summary));
+  }
+
+  const SymbolicTaintAnalysis &Taint;
+  std::vector<std::pair<const Stmt *, LoopSummary>> Loops;
+};
+
+void LoopCollector::finish(LoopSummarization &Summarization) const {
+  for (const auto &Loop : Loops) {
+    Summarization.Summaries[Loop.first] = Loop.second;
+    Summarization.Conditions.insert(Loop.second.Condition);
+  }
+}
+
+void LoopSummarization::analyze(ASTContext &Context,
+  const SymbolicTaintAnalysis &Taint) {
+
+  Summaries.clear();
+  Conditions.clear();
+
+  LoopCollector Collector(Taint);
+  Collector.TraverseDecl(Context.getTranslationUnitDecl());
+  Collector.finish(*this);
+
+  DEBUG(llvm::dbgs() << "LoopSummarization: " << Summaries.size()
+                     << " loops\n");
+}
+
+const LoopSummary *LoopSummarization::getSummary(const Stmt *Loop) const {
+  llvm::DenseMap<const Stmt *, LoopSummary>::const_iterator Known =
+    Summaries.find(Loop);
+  return Known == Summaries.end() ? nullptr : &Known->second;
+}
@@ -0,0 +1,100 @@
+//===-- NseLoopSummary.h - Counted loop summarization -----------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief Finds counted loops whose effect has a closed form
+///
+/// A loop such as for (i = 0; i < n; i++) sum += k; with a symbolic bound
+/// decides its condition once per iteration, so every trip count is a path
+/// of its own, and each iteration adds another node to the expression of
+/// sum. If the loop only counts, its effect is that of
+///
+///   i = 0; if (i < n) { sum += (n - i) * (k); i = n; }
+///
+/// with a single branch.
+///
+/// A loop qualifies if its condition compares an index variable with < to a
+/// bound that it increments by one, or with > to a bound that it decrements
+/// by one, and its body consists of nothing but += and -= of loop-invariant
+/// operands and increments and decrements of other variables. An operand is
+/// a literal or a variable that the loop does not write. All variables are
+/// integral, and the index is at least as wide as each of them, so that the
+/// closed form wraps around just like the loop. A while loop qualifies if
+/// the last statement of its body is the increment.
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef CLANG_CRV_LOOP_SUMMARY_H
+#define CLANG_CRV_LOOP_SUMMARY_H
+
+#include "clang/AST/ASTContext.h"
+#include "clang/AST/Decl.h"
+#include "clang/AST/Expr.h"
+#include "clang/AST/Stmt.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include "NseTaint.h"
+
+#include <vector>
+
+struct LoopSummary {
+  LoopSummary()
+      : Index(nullptr), Init(nullptr), DeclaresIndex(false), Bound(nullptr),
+        Increasing(true), Condition(nullptr) {}
+
+  /// A variable that the loop adds Step to, or one if Step is null, on
+  /// every iteration, or subtracts from unless Add
+  struct Update {
+    const clang::VarDecl *Var;
+    bool Add;
+    const clang::Expr *Step;
+  };
+
+  const clang::VarDecl *Index;
+
+  /// Value assigned to Index before the first iteration, if any
+  const clang::Expr *Init;
+
+  /// Whether Init is the initializer of a declaration in the for-init
+  bool DeclaresIndex;
+
+  const clang::Expr *Bound;
+
+  /// Whether the loop compares with < and increments, or with > and
+  /// decrements
+  bool Increasing;
+
+  const clang::Expr *Condition;
+  std::vector<Update> Updates;
+};
+
+class LoopSummarization {
+public :
+  /// Discards the loops of the previous translation unit and finds those
+  /// of \p Context that instrument a symbolic condition or variable
+  void analyze(clang::ASTContext &Context,
+    const SymbolicTaintAnalysis &Taint);
+
+  /// Returns the summary of the for or while loop \p Loop, or null if it
+  /// is not summarized
+  const LoopSummary *getSummary(const clang::Stmt *Loop) const;
+
+  /// Whether \p E is the condition of a summarized loop
+  bool isSummarizedCondition(const clang::Expr *E) const {
+    return Conditions.count(E);
+  }
+
+private:
+  friend class LoopCollector;
+
+  llvm::DenseMap<const clang::Stmt *, LoopSummary> Summaries;
+  llvm::DenseSet<const clang::Expr *> Conditions;
+};
+
+#endif
@@ -0,0 +1,196 @@
+//===-- NseMerge.cpp - Static branch merging ------------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#define DEBUG_TYPE "NseMerge"
+
+#include "clang/AST/RecursiveASTVisitor.h"
+#include "llvm/Support/Debug.h"
+#include "NseMerge.h"
+
+using namespace clang;
+
+/// The variable that \p E names, if it is nothing else
+static const VarDecl *getVar(const Expr *E) {
+  const DeclRefExpr *Ref = dyn_cast<DeclRefExpr>(E->IgnoreParenImpCasts());
+  return Ref ? dyn_cast<VarDecl>(Ref->getDecl()) : nullptr;
+}
+
+/// Whether \p E only consists of variables, literals and operators without
+/// side effects, and reads none of \p Assigned. Its text is copied
+/// verbatim, so it must not contain anything that another replacer would
+/// change, such as a cast or a subscript.
+static bool isSimple(const Expr *E,
+  const llvm::DenseSet<const VarDecl *> &Assigned) {
+
+  if (E->getLocStart().isMacroID() || E->getLocEnd().isMacroID())
+    return false;
+
+  E = E->IgnoreParenImpCasts();
+  if (isa<IntegerLiteral>(E) || isa<CharacterLiteral>(E) ||
+      isa<CXXBoolLiteralExpr>(E))
+    return true;
+
+  if (const DeclRefExpr *Ref = dyn_cast<DeclRefExpr>(E)) {
+    if (isa<EnumConstantDecl>(Ref->getDecl()))
+      return true;
+
+    const VarDecl *V = dyn_cast<VarDecl>(Ref->getDecl());
+    return V && !Assigned.count(V) && !V->getType()->isArrayType() &&
+      !V->getType().isVolatileQualified();
+  }
+
+  if (const UnaryOperator *U = dyn_cast<UnaryOperator>(E)) {
+    switch (U->getOpcode()) {
+    case UO_Plus:
+    case UO_Minus:
+    case UO_Not:
+    case UO_LNot:
+      return isSimple(U->getSubExpr(), Assigned);
+    default:
+      return false;
+    }
+  }
+
+  // a comma would hide a second expression, and the logical operators
+  // stay values just as they are in an instrumented condition. Both arms
+  // are evaluated, so an operator that may trap or be undefined on the
+  // values of the arm not taken, such as n / d under d != 0, is not simple.
+  if (const BinaryOperator *B = dyn_cast<BinaryOperator>(E)) {
+    switch (B->getOpcode()) {
+    case BO_Comma:
+    case BO_Div:
+    case BO_Rem:
+    case BO_Shl:
+    case BO_Shr:
+      return false;
+    default:
+      return !B->isAssignmentOp() &&
+        isSimple(B->getLHS(), Assigned) && isSimple(B->getRHS(), Assigned);
+    }
+  }
+
+  return false;
+}
+
+/// \p S if it is an assignment with =
+static const BinaryOperator *getAssignment(const Stmt *S) {
+  const BinaryOperator *E = dyn_cast_or_null<BinaryOperator>(S);
+  return E && E->getOpcode() == BO_Assign ? E : nullptr;
+}
+
+/// Collects the assignments of the arm \p S, or returns false if it is not
+/// a sequence of assignments
+static bool addArm(const Stmt *S, bool Then, BranchMerge &Merge) {
+  std::vector<const Stmt *> Stmts;
+  if (const CompoundStmt *Body = dyn_cast_or_null<CompoundStmt>(S)) {
+    Stmts.assign(Body->body_begin(), Body->body_end());
+  } else if (S) {
+    Stmts.push_back(S);
+  }
+
+  if (Stmts.empty() || Stmts.size() > BranchMerging::MaxAssignments)
+    return false;
+
+  for (const Stmt *Child : Stmts) {
+    const BinaryOperator *E = getAssignment(Child);
+    const VarDecl *V = E ? getVar(E->getLHS()) : nullptr;
+    if (!V)
+      return false;
+
+    BranchMerge::Assignment *Known = nullptr;
+    for (BranchMerge::Assignment &Other : Merge.Assignments)
+      if (Other.Var == V)
+        Known = &Other;
+
+    if (!Known) {
+      BranchMerge::Assignment Assignment = { V, nullptr, nullptr };
+      Merge.Assignments.push_back(Assignment);
+      Known = &Merge.Assignments.back();
+    }
+
+    const Expr *&Value = Then ? Known->Then : Known->Else;
+    if (Value)
+      return false;
+    Value = E->getRHS();
+  }
+  return true;
+}
+
+/// Collects the if statements that BranchMerging merges
+class MergeCollector : public RecursiveASTVisitor<MergeCollector> {
+public :
+  MergeCollector(const SymbolicTaintAnalysis &Taint)
+      : Taint(Taint) {}
+
+  bool VisitIfStmt(IfStmt *S) {
+    if (S->getLocStart().isMacroID() || S->getConditionVariable() ||
+        !S->getElse() || !Taint.isSymbolicExpr(S->getCond()))
+      return true;
+
+    BranchMerge Merge;
+    Merge.Condition = S->getCond();
+    if (!addArm(S->getThen(), true, Merge) ||
+        !addArm(S->getElse(), false, Merge))
+      return true;
+
+    llvm::DenseSet<const VarDecl *> Assigned;
+    for (const BranchMerge::Assignment &Assignment : Merge.Assignments) {
+      const VarDecl *V = Assignment.Var;
+      if (!V->hasLocalStorage() ||
+          !V->getType()->isIntegralOrEnumerationType() ||
+          V->getType().isVolatileQualified() || !Taint.isSymbolic(V))
+        return true;
+      Assigned.insert(V);
+    }
+
+    if (!isSimple(Merge.Condition, Assigned))
+      return true;
+    for (const BranchMerge::Assignment &Assignment : Merge.Assignments)
+      if ((Assignment.Then && !isSimple(Assignment.Then, Assigned)) ||
+          (Assignment.Else && !isSimple(Assignment.Else, Assigned)))
+        return true;
+
+    Merges.push_back(std::make_pair(S, Merge));
+    return true;
+  }
+
+  /// Hands the merged if statements to \p Merging
+  void finish(BranchMerging &Merging) const;
+
+private:
+  const SymbolicTaintAnalysis &Taint;
+  std::vector<std::pair<const IfStmt *, BranchMerge>> Merges;
+};
+
+void MergeCollector::finish(BranchMerging &Merging) const {
+  for (const auto &Merge : Merges) {
+    Merging.Merges[Merge.first] = Merge.second;
+    Merging.Conditions.insert(Merge.second.Condition);
+  }
+}
+
+void BranchMerging::analyze(ASTContext &Context,
+  const SymbolicTaintAnalysis &Taint) {
+
+  Merges.clear();
+  Conditions.clear();
+
+  MergeCollector Collector(Taint);
+  Collector.TraverseDecl(Context.getTranslationUnitDecl());
+  Collector.finish(*this);
+
+  DEBUG(llvm::dbgs() << "BranchMerging: " << Merges.size()
+                     << " if statements\n");
+}
+
+const BranchMerge *BranchMerging::getMerge(const IfStmt *S) const {
+  llvm::DenseMap<const IfStmt *, BranchMerge>::const_iterator Known =
+    Merges.find(S);
+  return Known == Merges.end() ? nullptr : &Known->second;
+}
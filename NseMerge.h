@@ -0,0 +1,89 @@
+//===-- NseMerge.h - Static branch merging ----------------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief Finds if statements that can select a value instead of branching
+///
+/// Every instrumented if statement asks the runtime for a branch decision,
+/// which doubles the number of paths. An if statement such as
+///
+///   if (x > y) m = x; else m = y;
+///
+/// only chooses the value of m, so it has the same effect as
+///
+///   m = crv::ite(x > y, x, y);
+///
+/// which builds a single expression without a branch. A variable that only
+/// one arm assigns keeps its value in the other, as in m = crv::ite(c, x, m).
+///
+/// An if statement is merged if it has an else branch and both arms are a
+/// single assignment or a compound statement of at most MaxAssignments
+/// assignments with =. Every assigned variable is an instrumented local of
+/// integral type that is assigned at most once per arm. The condition and
+/// the assigned values consist of nothing but variables, literals and
+/// operators without side effects, and none of them reads an assigned
+/// variable, so that the assignments can be done in any order.
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef CLANG_CRV_MERGE_H
+#define CLANG_CRV_MERGE_H
+
+#include "clang/AST/ASTContext.h"
+#include "clang/AST/Decl.h"
+#include "clang/AST/Expr.h"
+#include "clang/AST/Stmt.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include "NseTaint.h"
+
+#include <vector>
+
+struct BranchMerge {
+  BranchMerge()
+      : Condition(nullptr) {}
+
+  /// A variable together with the values that each arm assigns to it. If
+  /// an arm leaves it alone, its value is null.
+  struct Assignment {
+    const clang::VarDecl *Var;
+    const clang::Expr *Then;
+    const clang::Expr *Else;
+  };
+
+  const clang::Expr *Condition;
+  std::vector<Assignment> Assignments;
+};
+
+class BranchMerging {
+public :
+  /// Longest arm that is merged
+  static const unsigned MaxAssignments = 4;
+
+  /// Discards the if statements of the previous translation unit and finds
+  /// those of \p Context whose condition is symbolic
+  void analyze(clang::ASTContext &Context,
+    const SymbolicTaintAnalysis &Taint);
+
+  /// Returns how \p S is merged, or null if it is not
+  const BranchMerge *getMerge(const clang::IfStmt *S) const;
+
+  /// Whether \p E is the condition of a merged if statement
+  bool isMergedCondition(const clang::Expr *E) const {
+    return Conditions.count(E);
+  }
+
+private:
+  friend class MergeCollector;
+
+  llvm::DenseMap<const clang::IfStmt *, BranchMerge> Merges;
+  llvm::DenseSet<const clang::Expr *> Conditions;
+};
+
+#endif
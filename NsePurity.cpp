@@ -0,0 +1,144 @@
+//===-- NsePurity.cpp - Pure function analysis ----------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#define DEBUG_TYPE "NsePurity"
+
+#include "clang/AST/DeclCXX.h"
+#include "clang/AST/ExprCXX.h"
+#include "clang/AST/RecursiveASTVisitor.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/Debug.h"
+#include "NsePurity.h"
+
+using namespace clang;
+
+namespace {
+
+/// Checks the body of a single function and collects its callees. Any
+/// node that could branch, write memory or read mutable state makes the
+/// function impure.
+class PureBodyChecker : public RecursiveASTVisitor<PureBodyChecker> {
+public :
+  PureBodyChecker()
+      : Pure(true) {}
+
+  bool VisitStmt(Stmt *S) {
+    if (isa<IfStmt>(S) || isa<ForStmt>(S) || isa<WhileStmt>(S) ||
+        isa<DoStmt>(S) || isa<SwitchStmt>(S) || isa<GotoStmt>(S) ||
+        isa<IndirectGotoStmt>(S) || isa<AbstractConditionalOperator>(S) ||
+        isa<AsmStmt>(S) || isa<CXXTryStmt>(S) || isa<CXXThrowExpr>(S) ||
+        isa<LambdaExpr>(S) || isa<CXXThisExpr>(S) || isa<CXXNewExpr>(S) ||
+        isa<CXXDeleteExpr>(S) || isa<CXXConstructExpr>(S) ||
+        isa<ArraySubscriptExpr>(S) || isa<MemberExpr>(S))
+      Pure = false;
+    return Pure;
+  }
+
+  bool VisitBinaryOperator(BinaryOperator *E) {
+    if (E->isLogicalOp())
+      Pure = false;
+    return Pure;
+  }
+
+  bool VisitUnaryOperator(UnaryOperator *E) {
+    if (E->getOpcode() == UO_Deref || E->getOpcode() == UO_AddrOf)
+      Pure = false;
+    return Pure;
+  }
+
+  bool VisitVarDecl(VarDecl *V) {
+    if (V->hasGlobalStorage() || V->getType().isVolatileQualified())
+      Pure = false;
+    return Pure;
+  }
+
+  bool VisitDeclRefExpr(DeclRefExpr *E) {
+    if (const VarDecl *V = dyn_cast<VarDecl>(E->getDecl()))
+      if (V->hasGlobalStorage() && !V->getType().isConstQualified())
+        Pure = false;
+    return Pure;
+  }
+
+  bool VisitCallExpr(CallExpr *E) {
+    const FunctionDecl *Callee = E->getDirectCallee();
+    if (!Callee || isa<CXXMethodDecl>(Callee) ||
+        (Callee->getIdentifier() && Callee->getName().startswith("nse_")))
+      Pure = false;
+    else
+      Callees.push_back(Callee->getCanonicalDecl());
+    return Pure;
+  }
+
+  bool Pure;
+  llvm::SmallVector<const FunctionDecl *, 4> Callees;
+};
+
+} // end anonymous namespace
+
+/// Whether the signature and the kind of \p F allow it to be pure
+static bool isCandidate(const FunctionDecl *F) {
+  if (isa<CXXMethodDecl>(F) || F->isMain() || F->isVariadic() ||
+      F->isConstexpr() || F->isDeleted() || F->isDefaulted() ||
+      F->isDependentContext() || F->isTemplateInstantiation() ||
+      !F->doesThisDeclarationHaveABody())
+    return false;
+
+  const QualType Return = F->getReturnType();
+  if (!Return->isFundamentalType() || Return->isVoidType())
+    return false;
+
+  for (const ParmVarDecl *P : F->params())
+    if (!P->getType()->isFundamentalType() ||
+        P->getType().isVolatileQualified())
+      return false;
+
+  return true;
+}
+
+void PurityAnalysis::analyze(ASTContext &Context) {
+  Pure.clear();
+
+  // pure functions may only call each other, so remove those that call
+  // anything else until nothing changes
+  typedef llvm::SmallVector<const FunctionDecl *, 4> CalleeList;
+  llvm::DenseMap<const FunctionDecl *, CalleeList> Callees;
+  for (const Decl *D : Context.getTranslationUnitDecl()->decls()) {
+    const FunctionDecl *F = dyn_cast<FunctionDecl>(D);
+    if (!F || !isCandidate(F))
+      continue;
+
+    PureBodyChecker Checker;
+    Checker.TraverseStmt(F->getBody());
+    if (!Checker.Pure)
+      continue;
+
+    Pure.insert(F->getCanonicalDecl());
+    Callees[F->getCanonicalDecl()] = Checker.Callees;
+  }
+
+  bool Changed = true;
+  while (Changed) {
+    Changed = false;
+    for (const auto &Entry : Callees) {
+      if (!Pure.count(Entry.first))
+        continue;
+
+      for (const FunctionDecl *Callee : Entry.second)
+        if (!Pure.count(Callee)) {
+          Pure.erase(Entry.first);
+          Changed = true;
+          break;
+        }
+    }
+  }
+
+  DEBUG(llvm::dbgs() << "PurityAnalysis: " << Pure.size()
+                     << " pure functions\n");
+}
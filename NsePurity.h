@@ -0,0 +1,47 @@
+//===-- NsePurity.h - Pure function analysis --------------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief Finds functions whose result only depends on their arguments
+///
+/// A small helper such as a hash step or an absolute value that is called
+/// many times on the same symbolic arguments rebuilds the same expression
+/// tree on every call. If the function is pure, the harness can return the
+/// result of an earlier call instead, see nse_memoize() in NseHarness.h.
+///
+/// A function is pure if it is a non-member function defined in the
+/// translation unit that takes and returns fundamental types by value, only
+/// reads constant globals, never dereferences a pointer and only calls pure
+/// functions. It must not branch either, since the strategy has to see
+/// every symbolic branch on every path, so its body is straight-line code.
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef CLANG_CRV_PURITY_H
+#define CLANG_CRV_PURITY_H
+
+#include "clang/AST/ASTContext.h"
+#include "clang/AST/Decl.h"
+#include "llvm/ADT/DenseSet.h"
+
+class PurityAnalysis {
+public :
+  /// Discards the results for the previous translation unit and computes
+  /// them for \p Context
+  void analyze(clang::ASTContext &Context);
+
+  bool isPure(const clang::FunctionDecl *F) const {
+    return Pure.count(F->getCanonicalDecl());
+  }
+
+private:
+  llvm::DenseSet<const clang::FunctionDecl *> Pure;
+};
+
+#endif
@@ -0,0 +1,521 @@
+//===-- NseRange.cpp - Value-range analysis -------------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#define DEBUG_TYPE "NseRange"
+
+#include "clang/AST/ExprCXX.h"
+#include "clang/AST/RecursiveASTVisitor.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/Support/Debug.h"
+#include "NseRange.h"
+
+#include <algorithm>
+#include <limits>
+
+using namespace clang;
+
+/// Rounds after which a variable whose interval still grows is unbounded
+static const unsigned MaxRounds = 8;
+
+static ValueRange join(const ValueRange &A, const ValueRange &B) {
+  if (A.isEmpty())
+    return B;
+  if (B.isEmpty())
+    return A;
+  return ValueRange(std::min(A.Min, B.Min), std::max(A.Max, B.Max));
+}
+
+/// Values of \p Range converted to bool
+static ValueRange toBool(const ValueRange &Range) {
+  if (Range.isEmpty())
+    return Range;
+  if (Range.Min == 0 && Range.Max == 0)
+    return ValueRange(0, 0);
+  if (Range.Min > 0 || Range.Max < 0)
+    return ValueRange(1, 1);
+  return ValueRange(0, 1);
+}
+
+/// Applies \p Op to non-empty intervals. Returns false if the result could
+/// overflow int64_t or the operator is not supported.
+static bool applyBinaryOperator(
+  BinaryOperatorKind Op,
+  const ValueRange &L,
+  const ValueRange &R,
+  ValueRange &Result) {
+
+  switch (Op) {
+  case BO_Add:
+    return !__builtin_add_overflow(L.Min, R.Min, &Result.Min) &&
+      !__builtin_add_overflow(L.Max, R.Max, &Result.Max);
+  case BO_Sub:
+    return !__builtin_sub_overflow(L.Min, R.Max, &Result.Min) &&
+      !__builtin_sub_overflow(L.Max, R.Min, &Result.Max);
+  case BO_Mul:
+  case BO_Div: {
+    // division is monotonic in both operands for positive divisors
+    if (Op == BO_Div && R.Min <= 0)
+      return false;
+
+    const int64_t Ls[] = { L.Min, L.Max };
+    const int64_t Rs[] = { R.Min, R.Max };
+    Result = ValueRange(std::numeric_limits<int64_t>::max(),
+      std::numeric_limits<int64_t>::min());
+    for (int64_t A : Ls)
+      for (int64_t B : Rs) {
+        int64_t Value = 0;
+        if (Op == BO_Div)
+          Value = A / B;
+        else if (__builtin_mul_overflow(A, B, &Value))
+          return false;
+        Result.Min = std::min(Result.Min, Value);
+        Result.Max = std::max(Result.Max, Value);
+      }
+    return true;
+  }
+  case BO_Rem:
+    if (R.Min <= 0)
+      return false;
+    if (L.Min >= 0)
+      Result = ValueRange(0, std::min(L.Max, R.Max - 1));
+    else if (L.Max <= 0)
+      Result = ValueRange(std::max(L.Min, 1 - R.Max), 0);
+    else
+      Result = ValueRange(1 - R.Max, R.Max - 1);
+    return true;
+  case BO_And:
+    if (L.Min < 0 || R.Min < 0)
+      return false;
+    Result = ValueRange(0, std::min(L.Max, R.Max));
+    return true;
+  case BO_Shr:
+    if (L.Min < 0 || R.Min < 0 || R.Max >= 63)
+      return false;
+    Result = ValueRange(L.Min >> R.Max, L.Max >> R.Min);
+    return true;
+  default:
+    return false;
+  }
+}
+
+/// True if \p E reads the variable \p V without converting it
+static bool isRead(const Expr *E, const VarDecl *V) {
+  const ImplicitCastExpr *Cast = dyn_cast<ImplicitCastExpr>(E->IgnoreParens());
+  if (!Cast || Cast->getCastKind() != CK_LValueToRValue)
+    return false;
+
+  const DeclRefExpr *Ref = dyn_cast<DeclRefExpr>(
+    Cast->getSubExpr()->IgnoreParens());
+  return Ref && Ref->getDecl()->getCanonicalDecl() == V;
+}
+
+/// The variable that \p E names, if any
+static const VarDecl *getVar(const Expr *E) {
+  const DeclRefExpr *Ref = dyn_cast<DeclRefExpr>(E->IgnoreParens());
+  if (!Ref)
+    return nullptr;
+
+  const VarDecl *V = dyn_cast<VarDecl>(Ref->getDecl());
+  return V ? V->getCanonicalDecl() : nullptr;
+}
+
+/// Collects the writes to every variable and the variables that are used
+/// other than by reading or writing their value
+class WriteCollector : public RecursiveASTVisitor<WriteCollector> {
+public :
+  typedef ValueRangeAnalysis::Write Write;
+
+  WriteCollector(ASTContext &Context)
+      : Context(Context) {}
+
+  bool shouldVisitTemplateInstantiations() const { return true; }
+
+  bool VisitVarDecl(VarDecl *V) {
+    ValueRange Range;
+    if (isa<ParmVarDecl>(V) || V->getType().isVolatileQualified() ||
+        V->getDeclContext()->isDependentContext() ||
+        !ValueRangeAnalysis::getTypeRange(V->getType(), Context, Range))
+      return true;
+
+    // another translation unit could write it
+    if (V->hasGlobalStorage() && V->isExternallyVisible())
+      return true;
+
+    const VarDecl *Canonical = V->getCanonicalDecl();
+    Tracked.insert(Canonical);
+
+    Write W;
+    if (V->hasInit())
+      W.Value = V->getInit();
+    else if (!V->hasGlobalStorage())
+      return true;
+
+    // without an initializer, static storage is zero-initialized
+    Writes[Canonical].push_back(W);
+    return true;
+  }
+
+  // parents are visited before their children
+  bool VisitForStmt(ForStmt *S) {
+    const DeclStmt *Init = dyn_cast_or_null<DeclStmt>(S->getInit());
+    const UnaryOperator *Inc = dyn_cast_or_null<UnaryOperator>(
+      S->getInc() ? S->getInc()->IgnoreParens() : nullptr);
+    const BinaryOperator *Cond = dyn_cast_or_null<BinaryOperator>(
+      S->getCond() ? S->getCond()->IgnoreParenImpCasts() : nullptr);
+    if (!Init || !Init->isSingleDecl() || !Inc ||
+        !Inc->isIncrementDecrementOp() || !Cond)
+      return true;
+
+    const VarDecl *V = getVar(Inc->getSubExpr());
+    if (V && V == Init->getSingleDecl()->getCanonicalDecl())
+      Guards[Inc] = Cond;
+    return true;
+  }
+
+  bool VisitBinaryOperator(BinaryOperator *E) {
+    if (!E->isAssignmentOp())
+      return true;
+
+    const VarDecl *V = getVar(E->getLHS());
+    if (!V)
+      return true;
+
+    Write W;
+    W.Value = E->getRHS();
+    if (E->isCompoundAssignmentOp())
+      W.Op = BinaryOperator::getOpForCompoundAssignment(E->getOpcode());
+    Writes[V].push_back(W);
+    Accesses.insert(cast<DeclRefExpr>(E->getLHS()->IgnoreParens()));
+    return true;
+  }
+
+  bool VisitUnaryOperator(UnaryOperator *E) {
+    if (!E->isIncrementDecrementOp())
+      return true;
+
+    const VarDecl *V = getVar(E->getSubExpr());
+    if (!V)
+      return true;
+
+    Write W;
+    W.Step = E->isIncrementOp() ? 1 : -1;
+    W.Guard = Guards.lookup(E);
+    Writes[V].push_back(W);
+    Accesses.insert(cast<DeclRefExpr>(E->getSubExpr()->IgnoreParens()));
+    return true;
+  }
+
+  bool VisitImplicitCastExpr(ImplicitCastExpr *E) {
+    if (E->getCastKind() == CK_LValueToRValue)
+      if (const DeclRefExpr *Ref =
+            dyn_cast<DeclRefExpr>(E->getSubExpr()->IgnoreParens()))
+        Accesses.insert(Ref);
+    return true;
+  }
+
+  // taking the address or binding a reference lets anything write it
+  bool VisitDeclRefExpr(DeclRefExpr *E) {
+    if (const VarDecl *V = dyn_cast<VarDecl>(E->getDecl()))
+      if (!Accesses.count(E))
+        Escaped.insert(V->getCanonicalDecl());
+    return true;
+  }
+
+  /// Hands the writes to the variables that can be tracked to \p Analysis
+  void finish(ValueRangeAnalysis &Analysis) {
+    for (const VarDecl *V : Tracked)
+      if (!Escaped.count(V))
+        Analysis.Writes[V] = Writes[V];
+  }
+
+private:
+  ASTContext &Context;
+  llvm::DenseMap<const VarDecl *, std::vector<Write>> Writes;
+  llvm::DenseMap<const UnaryOperator *, const BinaryOperator *> Guards;
+  llvm::DenseSet<const VarDecl *> Tracked;
+  llvm::DenseSet<const VarDecl *> Escaped;
+  llvm::DenseSet<const DeclRefExpr *> Accesses;
+};
+
+bool ValueRangeAnalysis::getTypeRange(QualType T, ASTContext &Context,
+  ValueRange &Range) {
+
+  if (!T->isIntegralOrEnumerationType())
+    return false;
+
+  if (T->isBooleanType()) {
+    Range = ValueRange(0, 1);
+    return true;
+  }
+
+  const unsigned Width = Context.getIntWidth(T);
+  const bool Signed = T->isSignedIntegerOrEnumerationType();
+  if (Width > 64 || (!Signed && Width == 64))
+    return false;
+
+  if (Width == 64)
+    Range = ValueRange(std::numeric_limits<int64_t>::min(),
+      std::numeric_limits<int64_t>::max());
+  else if (Signed)
+    Range = ValueRange(-(INT64_C(1) << (Width - 1)),
+      (INT64_C(1) << (Width - 1)) - 1);
+  else
+    Range = ValueRange(0, (INT64_C(1) << Width) - 1);
+  return true;
+}
+
+void ValueRangeAnalysis::analyze(ASTContext &Context) {
+  this->Context = &Context;
+  Writes.clear();
+  Ranges.clear();
+
+  WriteCollector Collector(Context);
+  Collector.TraverseDecl(Context.getTranslationUnitDecl());
+  Collector.finish(*this);
+
+  for (unsigned Round = 0; ; ++Round) {
+    std::vector<const VarDecl *> Unbounded;
+    bool Changed = false;
+    for (const auto &Entry : Writes) {
+      const VarDecl *V = Entry.first;
+      ValueRange Range;
+      bool Bounded = true;
+      for (const Write &W : Entry.second) {
+        ValueRange WriteRange;
+        if (!evaluateWrite(V, W, WriteRange)) {
+          Bounded = false;
+          break;
+        }
+        Range = join(Range, WriteRange);
+      }
+
+      ValueRange &Current = Ranges[V];
+      if (Bounded && Range == Current)
+        continue;
+
+      Changed = true;
+      if (!Bounded || Round >= MaxRounds)
+        Unbounded.push_back(V);
+      else
+        Current = Range;
+    }
+
+    if (!Changed)
+      break;
+
+    // every later round that changes anything removes a variable
+    for (const VarDecl *V : Unbounded) {
+      Writes.erase(V);
+      Ranges.erase(V);
+    }
+  }
+
+  DEBUG(llvm::dbgs() << "ValueRangeAnalysis: " << Ranges.size()
+                     << " bounded variables\n");
+}
+
+bool ValueRangeAnalysis::getRange(const VarDecl *V, ValueRange &Range) const {
+  llvm::DenseMap<const VarDecl *, ValueRange>::const_iterator Known =
+    Ranges.find(V->getCanonicalDecl());
+  ValueRange TypeRange;
+  if (Known == Ranges.end() || Known->second.isEmpty() ||
+      !getTypeRange(V->getType(), *Context, TypeRange) ||
+      Known->second == TypeRange)
+    return false;
+
+  Range = Known->second;
+  return true;
+}
+
+bool ValueRangeAnalysis::evaluate(const Expr *E, ValueRange &Range) const {
+  E = E->IgnoreParens();
+  ValueRange Full;
+  if (E->isTypeDependent() || E->isValueDependent() ||
+      !getTypeRange(E->getType(), *Context, Full))
+    return false;
+
+  // anything that is not understood below may take any value of its type
+  Range = Full;
+
+  if (const IntegerLiteral *L = dyn_cast<IntegerLiteral>(E)) {
+    const llvm::APSInt Value(L->getValue(),
+      !E->getType()->isSignedIntegerOrEnumerationType());
+    Range = ValueRange(Value.getExtValue(), Value.getExtValue());
+  } else if (const CharacterLiteral *L = dyn_cast<CharacterLiteral>(E)) {
+    if (Full.contains(ValueRange(L->getValue(), L->getValue())))
+      Range = ValueRange(L->getValue(), L->getValue());
+  } else if (const CXXBoolLiteralExpr *L = dyn_cast<CXXBoolLiteralExpr>(E)) {
+    Range = ValueRange(L->getValue(), L->getValue());
+  } else if (const DeclRefExpr *Ref = dyn_cast<DeclRefExpr>(E)) {
+    if (const EnumConstantDecl *C = dyn_cast<EnumConstantDecl>(Ref->getDecl())) {
+      const llvm::APSInt &Value = C->getInitVal();
+      if (Value.getMinSignedBits() <= 64 && (Value.isSigned() ||
+          Value.getActiveBits() < 64))
+        Range = ValueRange(Value.getExtValue(), Value.getExtValue());
+    } else if (const VarDecl *V = dyn_cast<VarDecl>(Ref->getDecl())) {
+      llvm::DenseMap<const VarDecl *, ValueRange>::const_iterator Known =
+        Ranges.find(V->getCanonicalDecl());
+      if (Known != Ranges.end())
+        Range = Known->second;
+    }
+  } else if (const CastExpr *Cast = dyn_cast<CastExpr>(E)) {
+    ValueRange Sub;
+    switch (Cast->getCastKind()) {
+    case CK_LValueToRValue:
+    case CK_NoOp:
+    case CK_IntegralCast:
+      if (evaluate(Cast->getSubExpr(), Sub) && Full.contains(Sub))
+        Range = Sub;
+      break;
+    case CK_IntegralToBoolean:
+      if (evaluate(Cast->getSubExpr(), Sub))
+        Range = toBool(Sub);
+      break;
+    default:
+      break;
+    }
+  } else if (const UnaryOperator *U = dyn_cast<UnaryOperator>(E)) {
+    ValueRange Sub;
+    if (!evaluate(U->getSubExpr(), Sub))
+      return true;
+
+    ValueRange Result;
+    switch (U->getOpcode()) {
+    case UO_Plus:
+      Result = Sub;
+      break;
+    case UO_Minus:
+      if (!Sub.isEmpty() && (Sub.Min == std::numeric_limits<int64_t>::min()))
+        return true;
+      if (!Sub.isEmpty())
+        Result = ValueRange(-Sub.Max, -Sub.Min);
+      break;
+    case UO_Not:
+      if (!E->getType()->isSignedIntegerOrEnumerationType())
+        return true;
+      if (!Sub.isEmpty())
+        Result = ValueRange(~Sub.Max, ~Sub.Min);
+      break;
+    case UO_LNot:
+      Result = toBool(Sub);
+      if (!Result.isEmpty())
+        Result = ValueRange(1 - Result.Max, 1 - Result.Min);
+      break;
+    default:
+      return true;
+    }
+
+    if (Full.contains(Result))
+      Range = Result;
+  } else if (const BinaryOperator *B = dyn_cast<BinaryOperator>(E)) {
+    ValueRange L, R, Result;
+    if (B->isComparisonOp() || B->isLogicalOp()) {
+      Range = ValueRange(0, 1);
+    } else if (B->getOpcode() == BO_Comma) {
+      evaluate(B->getRHS(), Range);
+    } else if (evaluate(B->getLHS(), L) && evaluate(B->getRHS(), R)) {
+      if (L.isEmpty() || R.isEmpty())
+        Range = ValueRange();
+      else if (applyBinaryOperator(B->getOpcode(), L, R, Result) &&
+               Full.contains(Result))
+        Range = Result;
+    }
+  } else if (const ConditionalOperator *C = dyn_cast<ConditionalOperator>(E)) {
+    ValueRange True, False;
+    if (evaluate(C->getTrueExpr(), True) && evaluate(C->getFalseExpr(), False))
+      Range = join(True, False);
+  }
+
+  return true;
+}
+
+bool ValueRangeAnalysis::evaluateWrite(
+  const VarDecl *V,
+  const Write &W,
+  ValueRange &Range) const {
+
+  ValueRange TypeRange;
+  if (!getTypeRange(V->getType(), *Context, TypeRange))
+    return false;
+
+  if (!W.Step && !W.Value) {
+    Range = ValueRange(0, 0);
+    return true;
+  }
+
+  if (!W.Step && W.Op == BO_Assign)
+    return evaluate(W.Value, Range) && TypeRange.contains(Range);
+
+  ValueRange Before = Ranges.lookup(V);
+  if (W.Step && W.Guard)
+    applyGuard(V, W, Before);
+
+  // nothing was written yet that could be updated
+  if (Before.isEmpty()) {
+    Range = ValueRange();
+    return true;
+  }
+
+  ValueRange Operand(W.Step, W.Step);
+  if (!W.Step && !evaluate(W.Value, Operand))
+    return false;
+  if (Operand.isEmpty()) {
+    Range = ValueRange();
+    return true;
+  }
+
+  return applyBinaryOperator(W.Step ? BO_Add : W.Op, Before, Operand, Range) &&
+    TypeRange.contains(Range);
+}
+
+bool ValueRangeAnalysis::applyGuard(
+  const VarDecl *V,
+  const Write &W,
+  ValueRange &Before) const {
+
+  // the body of the loop must not write the index
+  llvm::DenseMap<const VarDecl *, std::vector<Write>>::const_iterator Known =
+    Writes.find(V);
+  if (Known == Writes.end() || Known->second.size() != 2 || !V->hasInit())
+    return false;
+
+  // put the index on the left
+  const Expr *Index = W.Guard->getLHS();
+  const Expr *Bound = W.Guard->getRHS();
+  BinaryOperatorKind Op = W.Guard->getOpcode();
+  if (!isRead(Index, V)) {
+    std::swap(Index, Bound);
+    switch (Op) {
+    case BO_LT: Op = BO_GT; break;
+    case BO_GT: Op = BO_LT; break;
+    case BO_LE: Op = BO_GE; break;
+    case BO_GE: Op = BO_LE; break;
+    default: break;
+    }
+  }
+
+  ValueRange BoundRange;
+  if (!isRead(Index, V) || !evaluate(Bound, BoundRange) ||
+      BoundRange.isEmpty())
+    return false;
+
+  const int64_t Min = std::numeric_limits<int64_t>::min();
+  const int64_t Max = std::numeric_limits<int64_t>::max();
+  if (W.Step > 0 && Op == BO_LT && BoundRange.Max > Min)
+    Before.Max = std::min(Before.Max, BoundRange.Max - 1);
+  else if (W.Step > 0 && Op == BO_LE)
+    Before.Max = std::min(Before.Max, BoundRange.Max);
+  else if (W.Step < 0 && Op == BO_GT && BoundRange.Min < Max)
+    Before.Min = std::max(Before.Min, BoundRange.Min + 1);
+  else if (W.Step < 0 && Op == BO_GE)
+    Before.Min = std::max(Before.Min, BoundRange.Min);
+  else
+    return false;
+  return true;
+}
@@ -0,0 +1,122 @@
+//===-- NseRange.h - Value-range analysis -----------------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief Proves bounds on the values of integral variables
+///
+/// An instrumented variable is a bit-vector of the full width of its declared
+/// type, even if it is a loop index that never leaves [0, 8] or a flag that
+/// is stored in a long. The analysis computes, for every integral variable of
+/// a translation unit, an interval that contains every value written to it.
+///
+/// The analysis is flow-insensitive: the interval of a variable is the join
+/// of the intervals of its initializer and of all assignments, increments and
+/// decrements, evaluated over the intervals of the variables they read. The
+/// only condition it takes into account is that of a for loop whose index is
+/// written by nothing but the loop's own initialization and increment. A
+/// variable that still grows after a few rounds, whose address is taken or
+/// that is bound to a reference is unbounded. So is a global variable that
+/// another translation unit could write.
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef CLANG_CRV_RANGE_H
+#define CLANG_CRV_RANGE_H
+
+#include "clang/AST/ASTContext.h"
+#include "clang/AST/Decl.h"
+#include "clang/AST/Expr.h"
+#include "llvm/ADT/DenseMap.h"
+
+#include <cstdint>
+#include <vector>
+
+/// Closed interval of integers, empty if Min > Max
+struct ValueRange {
+  ValueRange()
+      : Min(1), Max(0) {}
+
+  ValueRange(int64_t Min, int64_t Max)
+      : Min(Min), Max(Max) {}
+
+  bool isEmpty() const { return Min > Max; }
+
+  bool contains(const ValueRange &Other) const {
+    return Other.isEmpty() || (Min <= Other.Min && Other.Max <= Max);
+  }
+
+  bool operator==(const ValueRange &Other) const {
+    return (isEmpty() && Other.isEmpty()) ||
+      (Min == Other.Min && Max == Other.Max);
+  }
+
+  bool operator!=(const ValueRange &Other) const { return !(*this == Other); }
+
+  int64_t Min;
+  int64_t Max;
+};
+
+class ValueRangeAnalysis {
+public :
+  /// A write to a variable: an initialization or assignment of Value, a
+  /// compound assignment with operator Op, or an increment or decrement
+  struct Write {
+    Write()
+        : Value(nullptr), Op(clang::BO_Assign), Step(0), Guard(nullptr) {}
+
+    const clang::Expr *Value;
+    clang::BinaryOperatorKind Op;
+
+    /// +1 or -1 for increments and decrements, 0 otherwise
+    int Step;
+
+    /// Loop condition that holds before an increment or decrement, if any
+    const clang::BinaryOperator *Guard;
+  };
+
+  ValueRangeAnalysis()
+      : Context(nullptr) {}
+
+  /// Discards the results for the previous translation unit and computes
+  /// them for \p Context
+  void analyze(clang::ASTContext &Context);
+
+  /// Returns in \p Range the values that \p V can hold after any write to
+  /// it. False if they are not narrower than the type of \p V allows.
+  bool getRange(const clang::VarDecl *V, ValueRange &Range) const;
+
+  /// Values of integral type \p T, false if they do not fit into int64_t
+  static bool getTypeRange(clang::QualType T, clang::ASTContext &Context,
+    ValueRange &Range);
+
+private:
+  friend class WriteCollector;
+
+  /// Evaluates the integral expression \p E over the current intervals.
+  /// False if its type cannot be represented.
+  bool evaluate(const clang::Expr *E, ValueRange &Range) const;
+
+  bool evaluateWrite(const clang::VarDecl *V, const Write &W,
+    ValueRange &Range) const;
+
+  /// Narrows the value of \p W before its increment or decrement by the
+  /// condition of its loop
+  bool applyGuard(const clang::VarDecl *V, const Write &W,
+    ValueRange &Before) const;
+
+  clang::ASTContext *Context;
+
+  /// Writes to every tracked variable, keyed by canonical declaration
+  llvm::DenseMap<const clang::VarDecl *, std::vector<Write>> Writes;
+
+  /// Current interval of every tracked variable
+  llvm::DenseMap<const clang::VarDecl *, ValueRange> Ranges;
+};
+
+#endif
@@ -0,0 +1,144 @@
+//===-- NseReplacementBuffer.cpp - Append-only replacement buffer ---------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#define DEBUG_TYPE "NseReplacementBuffer"
+
+#include "llvm/Support/Debug.h"
+#include "NseReplacementBuffer.h"
+
+#include <algorithm>
+
+using namespace clang;
+
+void NseReplacementBuffer::insert(
+  const SourceManager &SM,
+  SourceLocation Loc,
+  unsigned Length,
+  StringRef Text) {
+
+  const std::pair<FileID, unsigned> Decomposed = SM.getDecomposedLoc(Loc);
+  const Entry E = { getFilePath(SM, Decomposed.first), Decomposed.second,
+    Length, intern(Text), false };
+  Entries.push_back(E);
+}
+
+void NseReplacementBuffer::insert(
+  const SourceManager &SM,
+  const CharSourceRange &Range,
+  StringRef Text) {
+
+  // measuring token ranges is left to tooling, only the path is copied
+  const tooling::Replacement Located(SM, Range, "");
+  const Entry E = { intern(Located.getFilePath()), Located.getOffset(),
+    Located.getLength(), intern(Text), false };
+  Entries.push_back(E);
+}
+
+void NseReplacementBuffer::insert(const tooling::Replacement &R) {
+  const Entry E = { intern(R.getFilePath()), R.getOffset(), R.getLength(),
+    intern(R.getReplacementText()), false };
+  Entries.push_back(E);
+}
+
+void NseReplacementBuffer::replaceExclusively(
+  const SourceManager &SM,
+  const CharSourceRange &Range,
+  StringRef Text) {
+
+  insert(SM, Range, Text);
+  Entries.back().Exclusive = true;
+}
+
+unsigned NseReplacementBuffer::flush(tooling::Replacements &Replace) {
+  std::sort(Entries.begin(), Entries.end(), isBefore);
+
+  std::vector<const Entry *> Owners;
+  for (const Entry &E : Entries)
+    if (E.Exclusive)
+      Owners.push_back(&E);
+
+  unsigned Overlaps = 0;
+  unsigned End = 0;
+  for (std::vector<Entry>::const_iterator I = Entries.begin(),
+       E = Entries.end(); I != E; ++I) {
+    if (isOwned(*I, Owners))
+      continue;
+
+    const bool SameFile = I != Entries.begin() &&
+      (I - 1)->FilePath == I->FilePath;
+    if (SameFile && !isBefore(*(I - 1), *I))
+      continue;
+
+    if (SameFile && I->Offset < End) {
+      DEBUG(llvm::dbgs() << "NseReplacementBuffer: overlapping replacement "
+                         << I->FilePath << ':' << I->Offset << '+'
+                         << I->Length << '\n');
+      ++Overlaps;
+    }
+    End = SameFile ? std::max(End, I->Offset + I->Length) :
+      I->Offset + I->Length;
+
+    Replace.insert(Replace.end(),
+      tooling::Replacement(I->FilePath, I->Offset, I->Length, I->Text));
+  }
+
+  Entries.clear();
+  FilePaths.clear();
+  Strings.clear();
+  Strings.getAllocator().Reset();
+  return Overlaps;
+}
+
+bool NseReplacementBuffer::isBefore(const Entry &LHS, const Entry &RHS) {
+  if (LHS.FilePath != RHS.FilePath)
+    return LHS.FilePath < RHS.FilePath;
+  if (LHS.Offset != RHS.Offset)
+    return LHS.Offset < RHS.Offset;
+  if (LHS.Length != RHS.Length)
+    return LHS.Length < RHS.Length;
+  return LHS.Text < RHS.Text;
+}
+
+bool NseReplacementBuffer::isOwned(
+  const Entry &E,
+  const std::vector<const Entry *> &Owners) {
+
+  for (const Entry *Owner : Owners) {
+    if (Owner == &E || E.FilePath != Owner->FilePath)
+      continue;
+
+    const unsigned OwnerEnd = Owner->Offset + Owner->Length;
+    if (E.Length == 0 ? E.Offset > Owner->Offset && E.Offset < OwnerEnd :
+        E.Offset < OwnerEnd && E.Offset + E.Length > Owner->Offset)
+      return true;
+  }
+
+  return false;
+}
+
+StringRef NseReplacementBuffer::intern(StringRef S) {
+  return Strings.GetOrCreateValue(S).getKey();
+}
+
+StringRef NseReplacementBuffer::getFilePath(
+  const SourceManager &SM,
+  FileID File) {
+
+  llvm::DenseMap<FileID, StringRef>::const_iterator Known =
+    FilePaths.find(File);
+  if (Known != FilePaths.end())
+    return Known->second;
+
+  // the path of a replacement at the start of the file is that of the file
+  const tooling::Replacement Located(SM, SM.getLocForStartOfFile(File), 0,
+    "");
+  const StringRef Path = intern(Located.getFilePath());
+  FilePaths[File] = Path;
+  return Path;
+}
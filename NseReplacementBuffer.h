@@ -0,0 +1,109 @@
+//===-- NseReplacementBuffer.h - Append-only replacement buffer -*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief Collects the replacements of a translation unit before they are
+/// handed to tooling::Replacements
+///
+/// Every insertion into tooling::Replacements allocates a set node and two
+/// strings and rebalances the set, although most of the texts are one of a
+/// few, such as "crv::Internal<", ">" or the branch function of the strategy,
+/// and all of them share a handful of file paths. The buffer instead appends
+/// a small entry to a vector, and the file path and text of the entry point
+/// into a bump-allocated pool that stores every distinct string once. Only
+/// flush() sorts the entries, drops duplicates, looks for overlaps and
+/// builds the final replacements in a single pass. A replacement that
+/// rewrites a whole statement is exclusive: flush() drops the replacements
+/// of the other replacers within it, since they edit text that is gone.
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef CLANG_CRV_REPLACEMENT_BUFFER_H
+#define CLANG_CRV_REPLACEMENT_BUFFER_H
+
+#include "clang/Basic/SourceLocation.h"
+#include "clang/Basic/SourceManager.h"
+#include "clang/Tooling/Refactoring.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Allocator.h"
+
+#include <vector>
+
+/// Not thread-safe, every NseInstrumenter owns one
+class NseReplacementBuffer {
+public :
+  /// Replaces \p Length characters at \p Loc by \p Text, like
+  /// tooling::Replacement(SM, Loc, Length, Text)
+  void insert(
+    const clang::SourceManager &SM,
+    clang::SourceLocation Loc,
+    unsigned Length,
+    llvm::StringRef Text);
+
+  /// Replaces \p Range by \p Text, like tooling::Replacement(SM, Range, Text)
+  void insert(
+    const clang::SourceManager &SM,
+    const clang::CharSourceRange &Range,
+    llvm::StringRef Text);
+
+  /// Appends a replacement that was built elsewhere
+  void insert(const clang::tooling::Replacement &R);
+
+  /// Replaces \p Range by \p Text, and drops the replacements of everybody
+  /// else within \p Range, whose original text is gone. Insertions at either
+  /// end of \p Range are kept.
+  void replaceExclusively(
+    const clang::SourceManager &SM,
+    const clang::CharSourceRange &Range,
+    llvm::StringRef Text);
+
+  /// Number of replacements appended since the last flush(), duplicates
+  /// included
+  size_t size() const { return Entries.size(); }
+
+  /// Adds the distinct replacements of the buffer to \p Replace and empties
+  /// the buffer, which must be done before the SourceManager of the
+  /// translation unit goes away. Returns the number of replacements that
+  /// overlap an earlier one of the same file. They are added nevertheless,
+  /// so that the caller reports them like conflicts between translation
+  /// units.
+  unsigned flush(clang::tooling::Replacements &Replace);
+
+private:
+  struct Entry {
+    llvm::StringRef FilePath;
+    unsigned Offset;
+    unsigned Length;
+    llvm::StringRef Text;
+    bool Exclusive;
+  };
+
+  static bool isBefore(const Entry &LHS, const Entry &RHS);
+
+  /// Whether \p E lies within another entry of \p Owners, the exclusive
+  /// ones
+  static bool isOwned(
+    const Entry &E,
+    const std::vector<const Entry *> &Owners);
+
+  /// Returns the copy of \p S in the pool
+  llvm::StringRef intern(llvm::StringRef S);
+
+  /// Returns the path that tooling::Replacement records for \p File
+  llvm::StringRef getFilePath(const clang::SourceManager &SM,
+    clang::FileID File);
+
+  std::vector<Entry> Entries;
+  llvm::StringMap<char, llvm::BumpPtrAllocator> Strings;
+  llvm::DenseMap<clang::FileID, llvm::StringRef> FilePaths;
+};
+
+#endif
@@ -0,0 +1,85 @@
+//===-- NseReplacementIO.cpp - Serialized replacement sets ----------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "NseReplacementIO.h"
+
+#include <cstring>
+
+using namespace clang;
+
+const char NseReplacementsExtension[] = ".nse-replacements";
+
+static const char *ReplacementsMagic = "nse-replacements 1\n";
+
+void writeReplacements(
+  const tooling::Replacements &Replace,
+  llvm::raw_ostream &OS) {
+
+  OS << ReplacementsMagic;
+  for (const tooling::Replacement &R : Replace) {
+    OS << "R " << R.getFilePath().size() << ' ' << R.getOffset() << ' '
+       << R.getLength() << ' ' << R.getReplacementText().size() << '\n'
+       << R.getFilePath() << R.getReplacementText() << '\n';
+  }
+  OS << "E " << Replace.size() << '\n';
+}
+
+/// Consumes the decimal number at the front of \p Buffer and the single
+/// separator character \p Sep that follows it.
+static bool consumeNumber(StringRef &Buffer, char Sep, unsigned &Number) {
+  size_t End = Buffer.find(Sep);
+  if (End == StringRef::npos || Buffer.substr(0, End).getAsInteger(10, Number))
+    return false;
+
+  Buffer = Buffer.substr(End + 1);
+  return true;
+}
+
+bool readReplacements(
+  StringRef Buffer,
+  tooling::Replacements &Replace) {
+
+  if (!Buffer.startswith(ReplacementsMagic))
+    return false;
+
+  Buffer = Buffer.substr(strlen(ReplacementsMagic));
+
+  std::vector<tooling::Replacement> Result;
+  while (Buffer.startswith("R ")) {
+    Buffer = Buffer.substr(2);
+
+    unsigned PathSize, Offset, Length, TextSize;
+    if (!consumeNumber(Buffer, ' ', PathSize) ||
+        !consumeNumber(Buffer, ' ', Offset) ||
+        !consumeNumber(Buffer, ' ', Length) ||
+        !consumeNumber(Buffer, '\n', TextSize))
+      return false;
+
+    if (Buffer.size() < PathSize + TextSize + 1 ||
+        Buffer[PathSize + TextSize] != '\n')
+      return false;
+
+    Result.push_back(tooling::Replacement(Buffer.substr(0, PathSize), Offset,
+      Length, Buffer.substr(PathSize, TextSize)));
+    Buffer = Buffer.substr(PathSize + TextSize + 1);
+  }
+
+  if (!Buffer.startswith("E "))
+    return false;
+
+  Buffer = Buffer.substr(2);
+
+  unsigned Count;
+  if (!consumeNumber(Buffer, '\n', Count) || Count != Result.size() ||
+      !Buffer.empty())
+    return false;
+
+  Replace.insert(Result.begin(), Result.end());
+  return true;
+}
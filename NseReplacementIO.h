@@ -0,0 +1,41 @@
+//===-- NseReplacementIO.h - Serialized replacement sets --------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief Compact, length-prefixed encoding of tooling::Replacements
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef CLANG_CRV_REPLACEMENT_IO_H
+#define CLANG_CRV_REPLACEMENT_IO_H
+
+#include "clang/Tooling/Refactoring.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/raw_ostream.h"
+
+/// Extension of the per-translation-unit replacement streams that
+/// clang-nse --export-replacements writes and nse-apply reads
+extern const char NseReplacementsExtension[];
+
+/// Writes \p Replace such that readReplacements() can restore it exactly.
+///
+/// Every replacement is a header line "R <path size> <offset> <length>
+/// <text size>" followed by the raw file path and replacement text. The
+/// set is terminated by "E <count>" so that truncated input is detected.
+void writeReplacements(
+  const clang::tooling::Replacements &Replace,
+  llvm::raw_ostream &OS);
+
+/// Adds the replacements encoded in \p Buffer to \p Replace. Returns false,
+/// leaving \p Replace unchanged, if \p Buffer is malformed or truncated.
+bool readReplacements(
+  llvm::StringRef Buffer,
+  clang::tooling::Replacements &Replace);
+
+#endif
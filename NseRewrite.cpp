@@ -0,0 +1,206 @@
+//===-- NseRewrite.cpp - Single-pass source rewriting ---------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "clang/Frontend/CompilerInstance.h"
+#include "clang/Rewrite/Frontend/Rewriters.h"
+#include "clang/Tooling/ArgumentsAdjusters.h"
+#include "clang/Tooling/Tooling.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+#include "NseRewrite.h"
+
+using namespace clang;
+
+const char NseRuntimeIncludes[] =
+  "#include <nse_sequential.h>\n"
+  "#include <nse_report.h>\n";
+
+void NseRewriteMacrosAction::ExecuteAction() {
+  Output.clear();
+  llvm::raw_string_ostream OS(Output);
+  RewriteMacrosInInput(getCompilerInstance().getPreprocessor(), &OS);
+  OS.flush();
+}
+
+bool NseEmitObjAction::BeginInvocation(CompilerInstance &CI) {
+  CI.getFrontendOpts().OutputFile = Object;
+  return EmitObjAction::BeginInvocation(CI);
+}
+
+namespace {
+
+class RewriteMacrosActionFactory : public tooling::FrontendActionFactory {
+public :
+  RewriteMacrosActionFactory(std::string &Output)
+      : Output(Output) {}
+
+  virtual FrontendAction *create() override {
+    return new NseRewriteMacrosAction(Output);
+  }
+
+private:
+  std::string &Output;
+};
+
+class AppendArgumentsAdjuster : public tooling::ArgumentsAdjuster {
+public :
+  AppendArgumentsAdjuster(const std::vector<std::string> &Extra)
+      : Extra(Extra) {}
+
+  virtual tooling::CommandLineArguments Adjust(
+      const tooling::CommandLineArguments &Args) override {
+    tooling::CommandLineArguments Adjusted(Args);
+    Adjusted.insert(Adjusted.end(), Extra.begin(), Extra.end());
+    return Adjusted;
+  }
+
+private:
+  const std::vector<std::string> Extra;
+};
+
+class EmitObjActionFactory : public tooling::FrontendActionFactory {
+public :
+  EmitObjActionFactory(StringRef Object)
+      : Object(Object) {}
+
+  virtual FrontendAction *create() override {
+    return new NseEmitObjAction(Object);
+  }
+
+private:
+  const std::string Object;
+};
+
+} // end anonymous namespace
+
+bool rewriteMacros(
+  const tooling::CompilationDatabase &Compilations,
+  StringRef File,
+  std::string &Output) {
+
+  tooling::ClangTool Tool(Compilations, File.str());
+  RewriteMacrosActionFactory Factory(Output);
+  return Tool.run(&Factory) == 0;
+}
+
+bool emitObject(
+  const tooling::CompilationDatabase &Compilations,
+  StringRef File,
+  const std::map<std::string, std::string> &Overlay,
+  const std::vector<std::string> &ExtraArgs,
+  StringRef Object) {
+
+  StringRef Parent = llvm::sys::path::parent_path(Object);
+  if (!Parent.empty() && llvm::sys::fs::create_directories(Parent))
+    return false;
+
+  tooling::ClangTool Tool(Compilations, File.str());
+  for (const std::pair<const std::string, std::string> &Mapped : Overlay)
+    Tool.mapVirtualFile(Mapped.first, Mapped.second);
+  if (!ExtraArgs.empty())
+    Tool.appendArgumentsAdjuster(new AppendArgumentsAdjuster(ExtraArgs));
+
+  EmitObjActionFactory Factory(Object);
+  return Tool.run(&Factory) == 0;
+}
+
+bool applyFileReplacements(
+  StringRef File,
+  StringRef Code,
+  const tooling::Replacements &Replace,
+  std::string &Result) {
+
+  tooling::Replacements FileReplace;
+  for (const tooling::Replacement &R : Replace) {
+    if (R.getFilePath() == File)
+      FileReplace.insert(R);
+  }
+
+  // an empty result means failure unless the code was empty to begin with
+  Result = tooling::applyAllReplacements(Code, FileReplace);
+  return !Result.empty() || Code.empty();
+}
+
+unsigned removeConflicts(
+  tooling::Replacements &Replace,
+  std::set<std::string> &ConflictingFiles) {
+
+  std::vector<tooling::Replacement> Sorted(Replace.begin(), Replace.end());
+  std::vector<tooling::Range> Conflicts;
+  tooling::deduplicate(Sorted, Conflicts);
+  if (Conflicts.empty())
+    return 0;
+
+  for (const tooling::Range &Conflict : Conflicts) {
+    const unsigned End = Conflict.getOffset() + Conflict.getLength();
+    const std::string &File = Sorted[Conflict.getOffset()].getFilePath();
+    llvm::errs() << File << ": conflicting replacements, file not written\n";
+    for (unsigned I = Conflict.getOffset(); I < End; ++I)
+      llvm::errs() << "  " << Sorted[I].toString() << '\n';
+    ConflictingFiles.insert(File);
+  }
+
+  for (tooling::Replacements::iterator I = Replace.begin();
+       I != Replace.end();) {
+    if (ConflictingFiles.count(I->getFilePath()))
+      Replace.erase(I++);
+    else
+      ++I;
+  }
+
+  return Conflicts.size();
+}
+
+std::string getOutputPath(
+  StringRef Directory,
+  StringRef File,
+  StringRef WorkingDirectory) {
+
+  SmallString<128> CurrentPath(WorkingDirectory);
+  StringRef Relative = llvm::sys::path::relative_path(File);
+  if ((!CurrentPath.empty() || !llvm::sys::fs::current_path(CurrentPath)) &&
+      File.startswith(CurrentPath) && File.size() > CurrentPath.size() &&
+      llvm::sys::path::is_separator(File[CurrentPath.size()]))
+    Relative = File.substr(CurrentPath.size() + 1);
+
+  SmallString<128> Path(Directory);
+  llvm::sys::path::append(Path, Relative);
+  return Path.str();
+}
+
+bool writeFileAtomically(StringRef Path, StringRef Contents) {
+  StringRef Parent = llvm::sys::path::parent_path(Path);
+  if (!Parent.empty() && llvm::sys::fs::create_directories(Parent))
+    return false;
+
+  int FD;
+  SmallString<128> TempPath;
+  if (llvm::sys::fs::createUniqueFile(Path + "-%%%%%%%%.tmp", FD, TempPath))
+    return false;
+
+  {
+    llvm::raw_fd_ostream OS(FD, /*shouldClose=*/true);
+    OS << Contents;
+    OS.close();
+    if (OS.has_error()) {
+      OS.clear_error();
+      llvm::sys::fs::remove(TempPath.str());
+      return false;
+    }
+  }
+
+  if (llvm::sys::fs::rename(TempPath.str(), Path)) {
+    llvm::sys::fs::remove(TempPath.str());
+    return false;
+  }
+
+  return true;
+}
@@ -0,0 +1,117 @@
+//===-- NseRewrite.h - Single-pass source rewriting -------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief Macro expansion, header injection and output for instrumented files
+///
+/// nse-rewrite.sh used to expand macros with clang -cc1 -rewrite-macros,
+/// write the result back, parse it again with clang-nse and finally prepend
+/// the runtime headers through a temporary file. The helpers here do the
+/// same in memory: the expanded main file is mapped into the instrumenting
+/// ClangTool as a virtual file, and only the final text of every file is
+/// written, either in place, to an output directory or to stdout. Instead of
+/// being written, the instrumented files can also be mapped into an
+/// in-process compilation that emits an object file.
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef CLANG_CRV_REWRITE_H
+#define CLANG_CRV_REWRITE_H
+
+#include "clang/CodeGen/CodeGenAction.h"
+#include "clang/Frontend/FrontendAction.h"
+#include "clang/Tooling/CompilationDatabase.h"
+#include "clang/Tooling/Refactoring.h"
+#include "llvm/ADT/StringRef.h"
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+/// Includes of the CRV runtime that every instrumented main file needs
+extern const char NseRuntimeIncludes[];
+
+/// Expands all macros of the main file into \p Output like
+/// clang -cc1 -rewrite-macros. Only preprocesses, so it is much cheaper
+/// than the parse that follows it.
+class NseRewriteMacrosAction : public clang::PreprocessorFrontendAction {
+public :
+  NseRewriteMacrosAction(std::string &Output)
+      : Output(Output) {}
+
+protected:
+  virtual void ExecuteAction() override;
+
+private:
+  std::string &Output;
+};
+
+/// Runs NseRewriteMacrosAction on \p File with its compile command.
+/// Returns false if \p File could not be preprocessed.
+bool rewriteMacros(
+  const clang::tooling::CompilationDatabase &Compilations,
+  llvm::StringRef File,
+  std::string &Output);
+
+/// Compiles the main file to the object file \p Object, which overrides
+/// any output file of the compile command
+class NseEmitObjAction : public clang::EmitObjAction {
+public :
+  NseEmitObjAction(llvm::StringRef Object)
+      : Object(Object) {}
+
+protected:
+  virtual bool BeginInvocation(clang::CompilerInstance &CI) override;
+
+private:
+  const std::string Object;
+};
+
+/// Compiles \p File with its compile command and \p ExtraArgs to \p Object.
+/// The compiler reads every file in \p Overlay, which maps absolute paths to
+/// contents, from memory instead of the disk. Returns false if compilation
+/// failed.
+bool emitObject(
+  const clang::tooling::CompilationDatabase &Compilations,
+  llvm::StringRef File,
+  const std::map<std::string, std::string> &Overlay,
+  const std::vector<std::string> &ExtraArgs,
+  llvm::StringRef Object);
+
+/// Applies those replacements in \p Replace that belong to \p File to
+/// \p Code. Returns false if one of them does not fit into \p Code.
+bool applyFileReplacements(
+  llvm::StringRef File,
+  llvm::StringRef Code,
+  const clang::tooling::Replacements &Replace,
+  std::string &Result);
+
+/// Reports overlapping replacements, which arise if translation units
+/// disagree about a shared header, and removes all replacements of the files
+/// they belong to, which are added to \p ConflictingFiles. Returns the
+/// number of conflicts.
+unsigned removeConflicts(
+  clang::tooling::Replacements &Replace,
+  std::set<std::string> &ConflictingFiles);
+
+/// Mirrors the absolute path \p File under \p Directory. Files in
+/// \p WorkingDirectory, or the current working directory if it is empty,
+/// keep their path relative to it.
+std::string getOutputPath(
+  llvm::StringRef Directory,
+  llvm::StringRef File,
+  llvm::StringRef WorkingDirectory = llvm::StringRef());
+
+/// Replaces \p Path by \p Contents through a temporary file, so that an
+/// interrupted run never leaves a partially written file behind. Creates
+/// missing parent directories. Returns false on failure.
+bool writeFileAtomically(llvm::StringRef Path, llvm::StringRef Contents);
+
+#endif
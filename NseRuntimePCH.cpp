@@ -0,0 +1,219 @@
+//===-- NseRuntimePCH.cpp - Precompiled CRV runtime headers ---------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#define DEBUG_TYPE "NseRuntimePCH"
+
+#include "clang/Basic/Version.h"
+#include "clang/Frontend/CompilerInstance.h"
+#include "clang/Frontend/FrontendActions.h"
+#include "clang/Tooling/Tooling.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "NseRewrite.h"
+#include "NseRuntimePCH.h"
+
+#include <vector>
+
+using namespace clang;
+
+static const char *RuntimeHeaderName = "nse_runtime.h";
+
+std::string getRuntimeHeader() {
+  return std::string("#pragma once\n") + NseRuntimeIncludes +
+    "#include <chrono>\n"
+    "#include <iostream>\n";
+}
+
+namespace {
+
+/// Writes the PCH to a given file, which overrides any output file of the
+/// compile command, and collects the absolute paths of the files it was
+/// built from
+class RuntimePCHAction : public GeneratePCHAction {
+public :
+  RuntimePCHAction(StringRef PCH, std::vector<std::string> &Inputs)
+      : PCH(PCH),
+        Inputs(Inputs) {}
+
+protected:
+  virtual bool BeginInvocation(CompilerInstance &CI) override {
+    CI.getFrontendOpts().OutputFile = PCH;
+    return GeneratePCHAction::BeginInvocation(CI);
+  }
+
+  virtual void EndSourceFileAction() override {
+    const SourceManager &SM = getCompilerInstance().getSourceManager();
+    for (SourceManager::fileinfo_iterator I = SM.fileinfo_begin(),
+         E = SM.fileinfo_end(); I != E; ++I)
+      Inputs.push_back(tooling::getAbsolutePath(I->first->getName()));
+    GeneratePCHAction::EndSourceFileAction();
+  }
+
+private:
+  const std::string PCH;
+  std::vector<std::string> &Inputs;
+};
+
+class RuntimePCHActionFactory : public tooling::FrontendActionFactory {
+public :
+  RuntimePCHActionFactory(StringRef PCH, std::vector<std::string> &Inputs)
+      : PCH(PCH),
+        Inputs(Inputs) {}
+
+  virtual FrontendAction *create() override {
+    return new RuntimePCHAction(PCH, Inputs);
+  }
+
+private:
+  const std::string PCH;
+  std::vector<std::string> &Inputs;
+};
+
+} // end anonymous namespace
+
+/// Returns the flags of \p Command without the compiler, the source file
+/// \p File and the options that name outputs, so that they can compile
+/// the runtime header instead
+static std::vector<std::string> getHeaderFlags(
+  const tooling::CompileCommand &Command,
+  StringRef File) {
+
+  const std::string MainFile = tooling::getAbsolutePath(File);
+  std::vector<std::string> Flags;
+  for (size_t I = 1; I < Command.CommandLine.size(); ++I) {
+    const std::string &Arg = Command.CommandLine[I];
+    if (Arg == "-o" || Arg == "-MF" || Arg == "-MT" || Arg == "-MQ") {
+      ++I;
+      continue;
+    }
+    if (Arg == "-c" || Arg == "-MD" || Arg == "-MMD")
+      continue;
+
+    SmallString<128> Path(Arg);
+    if (!llvm::sys::path::is_absolute(Path)) {
+      Path = Command.Directory;
+      llvm::sys::path::append(Path, Arg);
+    }
+    if (Path.str() == MainFile || Arg == File)
+      continue;
+
+    Flags.push_back(Arg);
+  }
+
+  // the header comes last, so this overrides any -x of the command
+  Flags.push_back("-x");
+  Flags.push_back("c++-header");
+  return Flags;
+}
+
+/// Lists the inputs of \p PCH, one per line
+static std::string getInputsPath(StringRef PCH) {
+  return PCH.str() + ".inputs";
+}
+
+/// Whether \p PCH exists and none of the inputs recorded next to it is
+/// missing or newer, since clang rejects a PCH whose headers changed
+static bool isUpToDate(StringRef PCH) {
+  llvm::sys::fs::file_status PCHStatus;
+  if (llvm::sys::fs::status(PCH, PCHStatus))
+    return false;
+
+  llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> Buffer =
+    llvm::MemoryBuffer::getFile(getInputsPath(PCH));
+  if (!Buffer)
+    return false;
+
+  SmallVector<StringRef, 64> Inputs;
+  (*Buffer)->getBuffer().split(Inputs, "\n", -1, false);
+  for (StringRef Input : Inputs) {
+    llvm::sys::fs::file_status InputStatus;
+    if (llvm::sys::fs::status(Input, InputStatus) ||
+        InputStatus.getLastModificationTime() >
+          PCHStatus.getLastModificationTime()) {
+      DEBUG(llvm::dbgs() << PCH << " is older than " << Input << '\n');
+      return false;
+    }
+  }
+
+  return true;
+}
+
+std::string NseRuntimePCH::getHeader(
+  const tooling::CompilationDatabase &Compilations,
+  StringRef File) {
+
+  std::vector<tooling::CompileCommand> Commands =
+    Compilations.getCompileCommands(File);
+  if (Commands.empty())
+    return std::string();
+
+  const tooling::CompileCommand &Command = Commands.front();
+  const std::vector<std::string> Flags = getHeaderFlags(Command, File);
+
+  // relative include paths depend on the directory of the command
+  llvm::MD5 Hash;
+  Hash.update(getClangFullVersion());
+  Hash.update(StringRef("\0", 1));
+  Hash.update(getRuntimeHeader());
+  Hash.update(StringRef("\0", 1));
+  Hash.update(Command.Directory);
+  for (const std::string &Flag : Flags) {
+    Hash.update(StringRef("\0", 1));
+    Hash.update(Flag);
+  }
+
+  llvm::MD5::MD5Result Result;
+  Hash.final(Result);
+  SmallString<32> Key;
+  llvm::MD5::stringifyResult(Result, Key);
+
+  std::map<std::string, std::string>::iterator Known = Headers.find(Key.str());
+  if (Known != Headers.end())
+    return Known->second;
+
+  std::string &Header = Headers[Key.str()];
+  SmallString<128> HeaderPath(Directory);
+  llvm::sys::path::append(HeaderPath, Key.str(), RuntimeHeaderName);
+  const std::string PCH = getPCHPath(HeaderPath);
+
+  if (isUpToDate(PCH)) {
+    DEBUG(llvm::dbgs() << "Reusing " << PCH << '\n');
+    ++Reused;
+    Header = HeaderPath.str();
+    return Header;
+  }
+
+  // a PCH is invalidated by a newer header, so it is never rewritten
+  if (!llvm::sys::fs::exists(HeaderPath.str()) &&
+      !writeFileAtomically(HeaderPath, getRuntimeHeader()))
+    return std::string();
+
+  DEBUG(llvm::dbgs() << "Generating " << PCH << '\n');
+  tooling::FixedCompilationDatabase HeaderCompilations(Command.Directory,
+    Flags);
+  tooling::ClangTool Tool(HeaderCompilations, HeaderPath.str());
+  std::vector<std::string> Inputs;
+  RuntimePCHActionFactory Factory(PCH, Inputs);
+  if (Tool.run(&Factory))
+    return std::string();
+
+  // without its inputs, the PCH is generated again by the next run
+  std::string InputList;
+  for (const std::string &Input : Inputs)
+    InputList += Input + '\n';
+  writeFileAtomically(getInputsPath(PCH), InputList);
+
+  ++Generated;
+  Header = HeaderPath.str();
+  return Header;
+}
@@ -0,0 +1,74 @@
+//===-- NseRuntimePCH.h - Precompiled CRV runtime headers -------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief Precompiles the headers every instrumented file includes
+///
+/// Instrumented code includes crv.h, nse_sequential.h and nse_report.h, and
+/// the harness of MainFunctionReplacer uses <chrono> and <iostream>. These
+/// are heavily templated, so compiling instrumented code is dominated by
+/// parsing them again for every translation unit. A generated header,
+/// nse_runtime.h, includes all of them and is precompiled once per set of
+/// compile flags, because a PCH is only valid for the flags it was built
+/// with. Instrumented main files include the generated header, and a
+/// compile that passes -include-pch with its PCH skips the runtime entirely.
+/// The files that a PCH was built from are listed next to it, and the PCH
+/// is generated again once one of them is newer, such as an updated crv.h.
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef CLANG_CRV_RUNTIME_PCH_H
+#define CLANG_CRV_RUNTIME_PCH_H
+
+#include "clang/Tooling/CompilationDatabase.h"
+#include "llvm/ADT/StringRef.h"
+
+#include <map>
+#include <string>
+
+/// Contents of nse_runtime.h
+std::string getRuntimeHeader();
+
+/// Generated runtime headers and their PCHs under a directory, one
+/// subdirectory per set of compile flags. Not thread-safe.
+class NseRuntimePCH {
+public :
+  NseRuntimePCH(llvm::StringRef Directory)
+      : Directory(Directory),
+        Generated(0),
+        Reused(0) {}
+
+  /// Returns the path of the runtime header for the compile command of
+  /// \p File. The PCH of the header, at getPCHPath(), is generated with the
+  /// flags of that command on first use, and reused by all files and later
+  /// runs with the same flags until one of its inputs changes. Returns an
+  /// empty string if the PCH could not be generated.
+  std::string getHeader(
+    const clang::tooling::CompilationDatabase &Compilations,
+    llvm::StringRef File);
+
+  static std::string getPCHPath(llvm::StringRef Header) {
+    return Header.str() + ".pch";
+  }
+
+  unsigned getGenerated() const { return Generated; }
+  unsigned getReused() const { return Reused; }
+
+private:
+  const std::string Directory;
+
+  /// Maps a hash of the compile flags to the runtime header, or to an
+  /// empty string if its PCH could not be generated
+  std::map<std::string, std::string> Headers;
+
+  unsigned Generated;
+  unsigned Reused;
+};
+
+#endif
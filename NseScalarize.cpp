@@ -0,0 +1,169 @@
+//===-- NseScalarize.cpp - Array scalarization ----------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#define DEBUG_TYPE "NseScalarize"
+
+#include "clang/AST/RecursiveASTVisitor.h"
+#include "llvm/Support/Debug.h"
+#include "NseScalarize.h"
+
+using namespace clang;
+
+/// True if \p S refers to a variable anywhere, whose replacement could
+/// overlap with that of the subscript
+static bool readsVariable(const Stmt *S) {
+  if (!S)
+    return false;
+
+  if (const DeclRefExpr *Ref = dyn_cast<DeclRefExpr>(S))
+    return isa<VarDecl>(Ref->getDecl());
+
+  for (Stmt::const_child_iterator I = S->child_begin(), End = S->child_end();
+       I != End; ++I)
+    if (readsVariable(*I))
+      return true;
+  return false;
+}
+
+/// True if every element of the initializer \p Init is written in the file,
+/// so that the declarations of the scalars can be spliced around them
+static bool isSplittable(const Expr *Init) {
+  if (!Init)
+    return true;
+
+  const InitListExpr *List = dyn_cast<InitListExpr>(Init);
+  if (!List || List->getLBraceLoc().isInvalid() ||
+      List->getLBraceLoc().isMacroID() || List->getRBraceLoc().isMacroID())
+    return false;
+
+  for (unsigned I = 0; I < List->getNumInits(); ++I) {
+    const Expr *Element = List->getInit(I);
+    if (isa<ImplicitValueInitExpr>(Element) ||
+        Element->getLocStart().isInvalid() ||
+        Element->getLocStart().isMacroID() || Element->getLocEnd().isMacroID())
+      return false;
+  }
+  return true;
+}
+
+/// Collects the candidate arrays, the constant index of their subscripts
+/// and the arrays that are used in any other way
+class SubscriptCollector : public RecursiveASTVisitor<SubscriptCollector> {
+public :
+  SubscriptCollector(ASTContext &Context)
+      : Context(Context) {}
+
+  bool shouldVisitTemplateInstantiations() const { return true; }
+
+  bool VisitDeclStmt(DeclStmt *S) {
+    if (!S->isSingleDecl() || S->getLocStart().isMacroID())
+      return true;
+
+    const VarDecl *V = dyn_cast<VarDecl>(S->getSingleDecl());
+    if (!V || isa<ParmVarDecl>(V) || !V->hasLocalStorage() ||
+        V->getDeclContext()->isDependentContext() || !isSplittable(V->getInit()))
+      return true;
+
+    // instantiations share the source of their template
+    const FunctionDecl *F = dyn_cast_or_null<FunctionDecl>(
+      V->getParentFunctionOrMethod());
+    if (F && F->isTemplateInstantiation())
+      return true;
+
+    const ConstantArrayType *Array =
+      Context.getAsConstantArrayType(V->getType());
+    if (Array && Array->getElementType()->isFundamentalType() &&
+        !Array->getElementType()->isVoidType() &&
+        Array->getSize().ule(ArrayScalarization::MaxElements))
+      Candidates.insert(V->getCanonicalDecl());
+    return true;
+  }
+
+  // parents are visited before their children
+  bool VisitArraySubscriptExpr(ArraySubscriptExpr *E) {
+    const DeclRefExpr *Ref =
+      dyn_cast<DeclRefExpr>(E->getBase()->IgnoreParenImpCasts());
+    const VarDecl *V = Ref ? dyn_cast<VarDecl>(Ref->getDecl()) : nullptr;
+    if (!V || !Candidates.count(V->getCanonicalDecl()))
+      return true;
+
+    const ConstantArrayType *Array =
+      Context.getAsConstantArrayType(V->getType());
+    llvm::APSInt Index;
+    if (E->getLocStart().isMacroID() || E->getLocEnd().isMacroID() ||
+        E->getIdx()->isValueDependent() || readsVariable(E->getIdx()) ||
+        !E->getIdx()->EvaluateAsInt(Index, Context) || Index.isNegative() ||
+        Index.uge(Array->getSize().getZExtValue()))
+      return true;
+
+    Subscripts.insert(Ref);
+    Indices[E] = Index.getZExtValue();
+    return true;
+  }
+
+  bool VisitDeclRefExpr(DeclRefExpr *E) {
+    if (const VarDecl *V = dyn_cast<VarDecl>(E->getDecl()))
+      if (!Subscripts.count(E))
+        Escaped.insert(V->getCanonicalDecl());
+    return true;
+  }
+
+  /// Hands the arrays that are only subscripted to \p Scalarization
+  void finish(ArrayScalarization &Scalarization) {
+    for (const VarDecl *V : Candidates)
+      if (!Escaped.count(V))
+        Scalarization.Scalarized.insert(V);
+
+    for (const auto &Entry : Indices) {
+      const DeclRefExpr *Ref = cast<DeclRefExpr>(
+        Entry.first->getBase()->IgnoreParenImpCasts());
+      if (Scalarization.Scalarized.count(
+            cast<VarDecl>(Ref->getDecl())->getCanonicalDecl()))
+        Scalarization.Indices.insert(Entry);
+    }
+  }
+
+private:
+  ASTContext &Context;
+  llvm::DenseSet<const VarDecl *> Candidates;
+  llvm::DenseSet<const VarDecl *> Escaped;
+  llvm::DenseSet<const DeclRefExpr *> Subscripts;
+  llvm::DenseMap<const ArraySubscriptExpr *, uint64_t> Indices;
+};
+
+void ArrayScalarization::analyze(ASTContext &Context) {
+  Scalarized.clear();
+  Indices.clear();
+
+  SubscriptCollector Collector(Context);
+  Collector.TraverseDecl(Context.getTranslationUnitDecl());
+  Collector.finish(*this);
+
+  DEBUG(llvm::dbgs() << "ArrayScalarization: " << Scalarized.size()
+                     << " arrays\n");
+}
+
+const VarDecl *ArrayScalarization::getElement(const ArraySubscriptExpr *E,
+  uint64_t &Index) const {
+
+  llvm::DenseMap<const ArraySubscriptExpr *, uint64_t>::const_iterator Known =
+    Indices.find(E);
+  if (Known == Indices.end())
+    return nullptr;
+
+  Index = Known->second;
+  const DeclRefExpr *Ref = cast<DeclRefExpr>(E->getBase()->IgnoreParenImpCasts());
+  return cast<VarDecl>(Ref->getDecl());
+}
+
+std::string ArrayScalarization::getElementName(const VarDecl *V,
+  uint64_t Index) {
+
+  return V->getName().str() + "_nse" + std::to_string(Index);
+}
@@ -0,0 +1,69 @@
+//===-- NseScalarize.h - Array scalarization --------------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief Finds local arrays that can be split into independent scalars
+///
+/// An instrumented array becomes a crv::Internal<T[N]>, which the solver can
+/// only reason about in the theory of arrays, even if every index is known
+/// at compile time. Such a local array is declared as N crv::Internal<T>
+/// variables instead, and every subscript names one of them.
+///
+/// An array qualifies if it is a local variable of at most MaxElements
+/// fundamental elements whose every use is a subscript with a constant
+/// index within bounds. An index that reads a variable is never constant,
+/// not even the counter of a loop with constant bounds, since loops are not
+/// unrolled. An array that decays to a pointer, for example to be passed to
+/// a function, keeps its array type.
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef CLANG_CRV_SCALARIZE_H
+#define CLANG_CRV_SCALARIZE_H
+
+#include "clang/AST/ASTContext.h"
+#include "clang/AST/Decl.h"
+#include "clang/AST/Expr.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+
+#include <cstdint>
+#include <string>
+
+class ArrayScalarization {
+public :
+  /// Larger arrays would turn into unwieldy declarations
+  static const uint64_t MaxElements = 64;
+
+  /// Discards the arrays of the previous translation unit and finds those
+  /// of \p Context
+  void analyze(clang::ASTContext &Context);
+
+  bool isScalarized(const clang::VarDecl *V) const {
+    return Scalarized.count(V->getCanonicalDecl());
+  }
+
+  /// Returns the scalarized array that \p E subscripts and sets \p Index,
+  /// or returns null if there is none
+  const clang::VarDecl *getElement(const clang::ArraySubscriptExpr *E,
+    uint64_t &Index) const;
+
+  /// Name of the variable that replaces element \p Index of \p V
+  static std::string getElementName(const clang::VarDecl *V, uint64_t Index);
+
+private:
+  friend class SubscriptCollector;
+
+  llvm::DenseSet<const clang::VarDecl *> Scalarized;
+
+  /// Constant index of every subscript of a scalarized array
+  llvm::DenseMap<const clang::ArraySubscriptExpr *, uint64_t> Indices;
+};
+
+#endif
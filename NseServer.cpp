@@ -0,0 +1,184 @@
+//===-- NseServer.cpp - Resident instrumentation server -------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#define DEBUG_TYPE "NseServer"
+
+#include "clang/Frontend/CompilerInstance.h"
+#include "clang/Frontend/CompilerInvocation.h"
+#include "clang/Tooling/Tooling.h"
+#include "llvm/Support/Debug.h"
+#include "NseServer.h"
+
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace clang;
+
+namespace {
+
+/// Like the action behind ClangTool::buildASTs() except that the preamble
+/// is precompiled, so that reparsing skips the headers at the top
+class PreambleASTBuilderAction : public tooling::ToolAction {
+public :
+  PreambleASTBuilderAction(std::unique_ptr<ASTUnit> &Unit)
+      : Unit(Unit) {}
+
+  virtual bool runInvocation(CompilerInvocation *Invocation,
+      FileManager *Files, DiagnosticConsumer *DiagConsumer) override {
+
+    // the unit outlives the tool, so its diagnostics get their own printer
+    Unit.reset(ASTUnit::LoadFromCompilerInvocation(Invocation,
+      CompilerInstance::createDiagnostics(&Invocation->getDiagnosticOpts()),
+      /*OnlyLocalDecls=*/false, /*CaptureDiagnostics=*/false,
+      /*PrecompilePreamble=*/true));
+    return Unit && !Unit->getDiagnostics().hasErrorOccurred();
+  }
+
+private:
+  std::unique_ptr<ASTUnit> &Unit;
+};
+
+} // end anonymous namespace
+
+ASTUnit *NseUnitCache::getUnit(StringRef File) {
+  const std::string MainFile = tooling::getAbsolutePath(File);
+  std::unique_ptr<ASTUnit> &Unit = Units[MainFile];
+
+  if (Unit) {
+    DEBUG(llvm::dbgs() << "Reparsing " << MainFile << '\n');
+    if (Unit->Reparse()) {
+      Unit.reset();
+      return nullptr;
+    }
+    return Unit->getDiagnostics().hasErrorOccurred() ? nullptr : Unit.get();
+  }
+
+  DEBUG(llvm::dbgs() << "Parsing " << MainFile << '\n');
+  tooling::ClangTool Tool(Compilations, MainFile);
+  PreambleASTBuilderAction Action(Unit);
+  if (Tool.run(&Action)) {
+    // keep a unit with errors, its preamble is still good for the next try
+    if (!Unit)
+      Units.erase(MainFile);
+    return nullptr;
+  }
+
+  return Unit.get();
+}
+
+/// Reads until an empty line or the end of the input
+static bool readRequest(int Connection, NseRequest &Request) {
+  std::string Buffer;
+  char Chunk[4096];
+  while (Buffer.find("\n\n") == std::string::npos) {
+    const ssize_t Size = read(Connection, Chunk, sizeof(Chunk));
+    if (Size < 0 && errno == EINTR)
+      continue;
+    if (Size < 0)
+      return false;
+    if (Size == 0)
+      break;
+    Buffer.append(Chunk, Size);
+  }
+
+  SmallVector<StringRef, 16> Lines;
+  StringRef(Buffer).split(Lines, "\n", -1, false);
+  for (StringRef Line : Lines) {
+    Line = Line.trim();
+    if (Line.empty())
+      continue;
+    if (Request.Command.empty())
+      Request.Command = Line.str();
+    else
+      Request.Files.push_back(Line.str());
+  }
+
+  return !Request.Command.empty();
+}
+
+static void writeResponse(int Connection, StringRef Response) {
+  while (!Response.empty()) {
+    const ssize_t Size = write(Connection, Response.data(), Response.size());
+    if (Size < 0 && errno == EINTR)
+      continue;
+    if (Size <= 0)
+      return;
+    Response = Response.substr(Size);
+  }
+}
+
+int serveRequests(StringRef SocketPath, const NseRequestHandler &Handle) {
+  sockaddr_un Address;
+  std::memset(&Address, 0, sizeof(Address));
+  Address.sun_family = AF_UNIX;
+  if (SocketPath.size() >= sizeof(Address.sun_path)) {
+    llvm::errs() << SocketPath << ": socket path too long\n";
+    return 1;
+  }
+  std::memcpy(Address.sun_path, SocketPath.data(), SocketPath.size());
+
+  const int Socket = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (Socket < 0) {
+    llvm::errs() << SocketPath << ": " << std::strerror(errno) << '\n';
+    return 1;
+  }
+
+  // a client that hangs up early must not take the server down with it
+  std::signal(SIGPIPE, SIG_IGN);
+
+  // only a stale socket is replaced, never a file that happens to be there
+  struct stat Status;
+  if (lstat(Address.sun_path, &Status) == 0) {
+    if (!S_ISSOCK(Status.st_mode)) {
+      llvm::errs() << SocketPath << ": exists and is not a socket\n";
+      close(Socket);
+      return 1;
+    }
+    unlink(Address.sun_path);
+  }
+
+  if (bind(Socket, reinterpret_cast<sockaddr *>(&Address),
+        sizeof(Address)) || listen(Socket, 16)) {
+    llvm::errs() << SocketPath << ": " << std::strerror(errno) << '\n';
+    close(Socket);
+    return 1;
+  }
+
+  bool Serving = true;
+  while (Serving) {
+    const int Connection = accept(Socket, nullptr, nullptr);
+    if (Connection < 0 && errno == EINTR)
+      continue;
+    if (Connection < 0) {
+      llvm::errs() << SocketPath << ": " << std::strerror(errno) << '\n';
+      break;
+    }
+
+    NseRequest Request;
+    std::string Response;
+    llvm::raw_string_ostream ResponseStream(Response);
+    if (readRequest(Connection, Request))
+      Serving = Handle(Request, ResponseStream);
+    else
+      ResponseStream << "error empty request\n";
+    ResponseStream.flush();
+
+    writeResponse(Connection, Response);
+    close(Connection);
+  }
+
+  close(Socket);
+  unlink(Address.sun_path);
+  return 0;
+}
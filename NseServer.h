@@ -0,0 +1,76 @@
+//===-- NseServer.h - Resident instrumentation server -----------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief Serves instrumentation requests on a Unix domain socket
+///
+/// A single clang-nse run spends most of its time on startup, loading the
+/// compilation database and parsing the same system and CRV headers again.
+/// The server keeps all of that warm: the compilation database is loaded
+/// once, and every translation unit stays parsed as an ASTUnit whose
+/// preamble, the headers included at its top, is precompiled. A request
+/// therefore only reparses the rest of the main file unless an included
+/// header changed.
+///
+/// A request is a command line followed by one source path per line and
+/// terminated by an empty line or the end of the input. The response starts
+/// with "ok" or with "error" and a message on the same line; its remainder
+/// depends on the command.
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef CLANG_CRV_SERVER_H
+#define CLANG_CRV_SERVER_H
+
+#include "clang/Frontend/ASTUnit.h"
+#include "clang/Tooling/CompilationDatabase.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+struct NseRequest {
+  std::string Command;
+  std::vector<std::string> Files;
+};
+
+/// Writes the response to \p Request into \p Response. Returns false to
+/// stop the server after the response was sent.
+typedef std::function<bool(const NseRequest &Request,
+                           llvm::raw_ostream &Response)> NseRequestHandler;
+
+/// Parsed translation units, keyed by the absolute path of their main file
+class NseUnitCache {
+public :
+  NseUnitCache(const clang::tooling::CompilationDatabase &Compilations)
+      : Compilations(Compilations) {}
+
+  /// Parses \p File with its compile command on first use and reparses it
+  /// afterwards, which reuses the precompiled preamble unless one of its
+  /// headers changed. Returns null if \p File has errors.
+  clang::ASTUnit *getUnit(llvm::StringRef File);
+
+  unsigned size() const { return Units.size(); }
+
+private:
+  const clang::tooling::CompilationDatabase &Compilations;
+  std::map<std::string, std::unique_ptr<clang::ASTUnit>> Units;
+};
+
+/// Accepts connections on the Unix domain socket \p SocketPath, one after
+/// another, and passes the request of each to \p Handle until it returns
+/// false. Replaces a stale socket, but no other kind of file, and removes
+/// it when done. Returns nonzero if the socket could not be set up.
+int serveRequests(llvm::StringRef SocketPath, const NseRequestHandler &Handle);
+
+#endif
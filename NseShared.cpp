@@ -0,0 +1,298 @@
+//===-- NseShared.cpp - Shared access analysis ----------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#define DEBUG_TYPE "NseShared"
+
+#include "clang/AST/DeclCXX.h"
+#include "clang/AST/DeclTemplate.h"
+#include "clang/AST/ExprCXX.h"
+#include "clang/AST/RecursiveASTVisitor.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/Support/Debug.h"
+#include "NseShared.h"
+
+#include <vector>
+
+using namespace clang;
+
+bool isStdClass(QualType T, StringRef Name) {
+  const CXXRecordDecl *R = T.isNull() ? nullptr : T->getAsCXXRecordDecl();
+  if (!R)
+    return false;
+
+  if (const ClassTemplateSpecializationDecl *S =
+        dyn_cast<ClassTemplateSpecializationDecl>(R))
+    R = S->getSpecializedTemplate()->getTemplatedDecl();
+  return R->getIdentifier() && R->getName() == Name && R->isInStdNamespace();
+}
+
+/// Whether \p S may run more than once because it is part of a loop
+static bool isInLoop(const Stmt *S, ASTContext &Context) {
+  ASTContext::ParentVector Parents = Context.getParents(*S);
+  while (!Parents.empty()) {
+    const Stmt *Parent = Parents[0].get<Stmt>();
+    if (!Parent)
+      return false;
+    if (isa<ForStmt>(Parent) || isa<WhileStmt>(Parent) ||
+        isa<DoStmt>(Parent) || isa<CXXForRangeStmt>(Parent))
+      return true;
+    Parents = Context.getParents(*Parent);
+  }
+  return false;
+}
+
+/// The variable that \p E names, if it is nothing else
+static const VarDecl *getVar(const Expr *E) {
+  const DeclRefExpr *Ref = dyn_cast<DeclRefExpr>(E->IgnoreParenImpCasts());
+  return Ref ? dyn_cast<VarDecl>(Ref->getDecl()) : nullptr;
+}
+
+/// \p E without the temporaries and conversions of passing it by reference
+static const Expr *ignoreBinding(const Expr *E) {
+  return cast<Expr>(E->IgnoreImplicit())->IgnoreParenImpCasts();
+}
+
+/// The argument of \p E if it is a call of std::ref() or std::cref(),
+/// otherwise \p E itself
+static const Expr *ignoreStdRef(const Expr *E) {
+  const CallExpr *Call = dyn_cast<CallExpr>(E);
+  const FunctionDecl *F = Call ? Call->getDirectCallee() : nullptr;
+  if (F && F->getIdentifier() && F->isInStdNamespace() &&
+      (F->getName() == "ref" || F->getName() == "cref") &&
+      Call->getNumArgs() == 1)
+    return ignoreBinding(Call->getArg(0));
+  return E;
+}
+
+/// Records, for every function, the functions it refers to and the global
+/// variables it accesses, together with the threads and the local
+/// variables that escape to them
+class SharedAccessCollector
+    : public RecursiveASTVisitor<SharedAccessCollector> {
+public :
+  SharedAccessCollector(ASTContext &Context)
+      : Context(Context),
+        Current(nullptr),
+        Main(nullptr),
+        Unknown(false) {}
+
+  bool TraverseDecl(Decl *D) {
+    const FunctionDecl *Saved = Current;
+    if (const FunctionDecl *F = dyn_cast_or_null<FunctionDecl>(D)) {
+      Current = F->getCanonicalDecl();
+      if (F->isMain())
+        Main = Current;
+    }
+
+    const bool Result =
+      RecursiveASTVisitor<SharedAccessCollector>::TraverseDecl(D);
+    Current = Saved;
+    return Result;
+  }
+
+  // parents are visited before their children
+  bool VisitCXXConstructExpr(CXXConstructExpr *E) {
+    if (Current && E->getConstructor())
+      Calls[Current].insert(E->getConstructor()->getCanonicalDecl());
+
+    if (!isStdClass(E->getType(), "thread") || E->getNumArgs() == 0)
+      return true;
+
+    const Expr *Function = ignoreBinding(E->getArg(0));
+    if (const UnaryOperator *U = dyn_cast<UnaryOperator>(Function))
+      if (U->getOpcode() == UO_AddrOf)
+        Function = ignoreBinding(U->getSubExpr());
+
+    const DeclRefExpr *Ref = dyn_cast<DeclRefExpr>(Function);
+    const FunctionDecl *Entry =
+      Ref ? dyn_cast<FunctionDecl>(Ref->getDecl()) : nullptr;
+    if (Entry) {
+      Threads.push_back(std::make_pair(Entry->getCanonicalDecl(),
+        isInLoop(E, Context) ? 2u : 1u));
+      EntryRefs.insert(Ref);
+    } else {
+      Unknown = true;
+      if (const LambdaExpr *Lambda = dyn_cast<LambdaExpr>(Function))
+        for (LambdaExpr::capture_iterator I = Lambda->capture_begin(),
+             End = Lambda->capture_end(); I != End; ++I)
+          if (I->capturesVariable() && I->getCaptureKind() == LCK_ByRef)
+            Escaped.insert(I->getCapturedVar()->getCanonicalDecl());
+    }
+
+    // arguments are copied unless they are passed by std::ref() or by address
+    for (unsigned I = 1; I < E->getNumArgs(); ++I) {
+      const Expr *Arg = ignoreStdRef(ignoreBinding(E->getArg(I)));
+      if (const UnaryOperator *U = dyn_cast<UnaryOperator>(Arg))
+        if (U->getOpcode() == UO_AddrOf)
+          Arg = U->getSubExpr();
+
+      if (const VarDecl *V = getVar(Arg))
+        Escaped.insert(V->getCanonicalDecl());
+    }
+    return true;
+  }
+
+  bool VisitUnaryOperator(UnaryOperator *E) {
+    if (E->getOpcode() == UO_AddrOf)
+      if (const VarDecl *V = getVar(E->getSubExpr()))
+        AddressTaken.insert(V->getCanonicalDecl());
+    return true;
+  }
+
+  bool VisitCXXMemberCallExpr(CXXMemberCallExpr *E) {
+    const CXXMethodDecl *Method = E->getMethodDecl();
+    const Expr *Object = E->getImplicitObjectArgument();
+    const VarDecl *V = Object ? getVar(Object) : nullptr;
+    if (!Method || !V || !isStdClass(V->getType(), "atomic"))
+      return true;
+
+    if (isa<CXXConversionDecl>(Method) || Method->isOverloadedOperator() ||
+        (Method->getIdentifier() &&
+         (Method->getName() == "load" || Method->getName() == "store")))
+      AtomicRefs.insert(cast<DeclRefExpr>(Object->IgnoreParenImpCasts()));
+    return true;
+  }
+
+  bool VisitCXXOperatorCallExpr(CXXOperatorCallExpr *E) {
+    if (E->getNumArgs() == 0)
+      return true;
+
+    const Expr *Object = E->getArg(0)->IgnoreParenImpCasts();
+    const VarDecl *V = getVar(Object);
+    if (V && isStdClass(V->getType(), "atomic"))
+      AtomicRefs.insert(cast<DeclRefExpr>(Object));
+    return true;
+  }
+
+  bool VisitMemberExpr(MemberExpr *E) {
+    const CXXMethodDecl *M = dyn_cast<CXXMethodDecl>(E->getMemberDecl());
+    if (Current && M)
+      Calls[Current].insert(M->getCanonicalDecl());
+    return true;
+  }
+
+  bool VisitVarDecl(VarDecl *V) {
+    if (isStdClass(V->getType(), "atomic") && !isa<ParmVarDecl>(V))
+      Atomics.insert(V->getCanonicalDecl());
+    return true;
+  }
+
+  bool VisitDeclRefExpr(DeclRefExpr *E) {
+    if (const VarDecl *V = dyn_cast<VarDecl>(E->getDecl())) {
+      if (!AtomicRefs.count(E))
+        EscapedAtomics.insert(V->getCanonicalDecl());
+      if (Current && V->hasGlobalStorage())
+        Accesses[Current].insert(V->getCanonicalDecl());
+    } else if (const FunctionDecl *F = dyn_cast<FunctionDecl>(E->getDecl())) {
+      if (Current && !EntryRefs.count(E))
+        Calls[Current].insert(F->getCanonicalDecl());
+    }
+    return true;
+  }
+
+  /// Hands the shared variables and the rewritable atomics to \p Analysis
+  void finish(SharedAccessAnalysis &Analysis);
+
+private:
+  /// Every global variable that the code reachable from \p Entry accesses
+  void addReachableAccesses(const FunctionDecl *Entry, unsigned Count,
+    llvm::DenseMap<const VarDecl *, unsigned> &Counts);
+
+  ASTContext &Context;
+  const FunctionDecl *Current;
+  const FunctionDecl *Main;
+
+  /// Whether a thread runs something other than a function
+  bool Unknown;
+
+  /// The function of every thread and whether it may run more than once
+  std::vector<std::pair<const FunctionDecl *, unsigned>> Threads;
+  llvm::DenseSet<const DeclRefExpr *> EntryRefs;
+
+  llvm::DenseMap<const FunctionDecl *, llvm::DenseSet<const FunctionDecl *>>
+    Calls;
+  llvm::DenseMap<const FunctionDecl *, llvm::DenseSet<const VarDecl *>>
+    Accesses;
+
+  llvm::DenseSet<const VarDecl *> Escaped;
+  llvm::DenseSet<const VarDecl *> AddressTaken;
+
+  llvm::DenseSet<const VarDecl *> Atomics;
+  llvm::DenseSet<const DeclRefExpr *> AtomicRefs;
+  llvm::DenseSet<const VarDecl *> EscapedAtomics;
+};
+
+void SharedAccessCollector::addReachableAccesses(const FunctionDecl *Entry,
+  unsigned Count, llvm::DenseMap<const VarDecl *, unsigned> &Counts) {
+
+  llvm::DenseSet<const FunctionDecl *> Reached;
+  llvm::DenseSet<const VarDecl *> Accessed;
+  std::vector<const FunctionDecl *> Worklist(1, Entry);
+  Reached.insert(Entry);
+  while (!Worklist.empty()) {
+    const FunctionDecl *F = Worklist.back();
+    Worklist.pop_back();
+
+    for (const VarDecl *V : Accesses[F])
+      Accessed.insert(V);
+    for (const FunctionDecl *Callee : Calls[F])
+      if (Reached.insert(Callee).second)
+        Worklist.push_back(Callee);
+  }
+
+  for (const VarDecl *V : Accessed)
+    Counts[V] += Count;
+}
+
+void SharedAccessCollector::finish(SharedAccessAnalysis &Analysis) {
+  for (const VarDecl *V : Atomics)
+    if (!EscapedAtomics.count(V))
+      Analysis.Atomics.insert(V);
+
+  Analysis.Threads = Unknown || !Threads.empty();
+  if (!Analysis.Threads)
+    return;
+
+  for (const VarDecl *V : Escaped)
+    Analysis.Shared.insert(V);
+  for (const VarDecl *V : AddressTaken)
+    Analysis.Shared.insert(V);
+
+  if (Unknown) {
+    for (const auto &Entry : Accesses)
+      for (const VarDecl *V : Entry.second)
+        Analysis.Shared.insert(V);
+    return;
+  }
+
+  // number of threads that access each global variable
+  llvm::DenseMap<const VarDecl *, unsigned> Counts;
+  if (Main)
+    addReachableAccesses(Main, 1, Counts);
+  for (const auto &Thread : Threads)
+    addReachableAccesses(Thread.first, Thread.second, Counts);
+
+  for (const auto &Count : Counts)
+    if (Count.second > 1)
+      Analysis.Shared.insert(Count.first);
+}
+
+void SharedAccessAnalysis::analyze(ASTContext &Context) {
+  Threads = false;
+  Shared.clear();
+  Atomics.clear();
+
+  SharedAccessCollector Collector(Context);
+  Collector.TraverseDecl(Context.getTranslationUnitDecl());
+  Collector.finish(*this);
+
+  DEBUG(llvm::dbgs() << "SharedAccessAnalysis: " << Shared.size()
+                     << " shared variables, " << Atomics.size()
+                     << " rewritable atomics\n");
+}
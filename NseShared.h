@@ -0,0 +1,74 @@
+//===-- NseShared.h - Shared access analysis --------------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief Finds the variables that more than one thread may access
+///
+/// The runtime explores the interleavings of the accesses to its External
+/// variables, whereas accesses to Internal ones are never scheduling points.
+/// Only a variable that two threads can access needs to be External.
+///
+/// Every std::thread that the translation unit constructs is a thread whose
+/// code is everything reachable from its function, and main() is another.
+/// A thread that is constructed inside a loop counts twice. A global or
+/// static variable is shared if it is accessed from at least two threads.
+/// A local variable is shared if it is passed to a thread by std::ref() or
+/// by its address, captured by reference by a lambda that a thread runs, or
+/// if its address is taken at all while the program has threads. If a thread
+/// runs anything other than a function, such as a lambda or a function
+/// object, every global variable that is accessed anywhere is shared.
+///
+/// A std::atomic variable can be rewritten to an External one if it is
+/// only read, assigned, updated by operators or accessed by load() and
+/// store(). Accesses through pointers are not tracked.
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef CLANG_CRV_SHARED_H
+#define CLANG_CRV_SHARED_H
+
+#include "clang/AST/ASTContext.h"
+#include "clang/AST/Decl.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/StringRef.h"
+
+/// Whether \p T is, or is a specialization of, the class \p Name of the
+/// standard library, such as "thread" or "atomic"
+bool isStdClass(clang::QualType T, llvm::StringRef Name);
+
+class SharedAccessAnalysis {
+public :
+  SharedAccessAnalysis()
+      : Threads(false) {}
+
+  /// Discards the results for the previous translation unit and computes
+  /// them for \p Context
+  void analyze(clang::ASTContext &Context);
+
+  /// Whether the translation unit constructs a std::thread
+  bool hasThreads() const { return Threads; }
+
+  bool isShared(const clang::VarDecl *V) const {
+    return Shared.count(V->getCanonicalDecl());
+  }
+
+  /// Whether \p V is a std::atomic whose accesses can all be rewritten
+  bool isRewritableAtomic(const clang::VarDecl *V) const {
+    return Atomics.count(V->getCanonicalDecl());
+  }
+
+private:
+  friend class SharedAccessCollector;
+
+  bool Threads;
+  llvm::DenseSet<const clang::VarDecl *> Shared;
+  llvm::DenseSet<const clang::VarDecl *> Atomics;
+};
+
+#endif
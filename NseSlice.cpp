@@ -0,0 +1,427 @@
+//===-- NseSlice.cpp - Assertion-driven program slicing -------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#define DEBUG_TYPE "NseSlice"
+
+#include "clang/AST/ExprCXX.h"
+#include "clang/AST/RecursiveASTVisitor.h"
+#include "clang/Basic/SourceManager.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/Support/Debug.h"
+#include "NseSlice.h"
+#include "NseTaint.h"
+#include "NseTransform.h"
+
+#include <vector>
+
+/// Pointers, arrays and references alias the storage of other nodes
+static bool isAliasing(const Decl *D) {
+  QualType QT;
+  if (const FunctionDecl *F = dyn_cast<FunctionDecl>(D))
+    QT = F->getReturnType();
+  else if (const ValueDecl *V = dyn_cast<ValueDecl>(D))
+    QT = V->getType();
+  else
+    return false;
+
+  return QT->isPointerType() || QT->isArrayType() || QT->isReferenceType();
+}
+
+/// What the code of a branch or a function does that the slice cares about
+struct SliceEffects {
+  SliceEffects()
+      : Asserts(false), Jumps(false), Exits(false) {}
+
+  /// Flow nodes that it writes
+  SymbolicTaintAnalysis::DeclList Writes;
+
+  /// Canonical declarations of the functions it calls
+  llvm::SmallVector<const FunctionDecl *, 4> Calls;
+
+  /// Whether it contains an assertion, an assumption or a call that may
+  /// contain one
+  bool Asserts;
+
+  /// Whether it may leave its function or loop early
+  bool Jumps;
+
+  /// Whether it may leave its callers, too, by a throw or a call of a
+  /// function that does not return
+  bool Exits;
+};
+
+struct SliceBranch {
+  const Stmt *Branch;
+  const Expr *Cond;
+  const FunctionDecl *Function;
+  SliceEffects Effects;
+};
+
+/// Records the dependencies of a translation unit together with the effects
+/// of every branch and function, and computes the slice from them
+class SliceCollector : public RecursiveASTVisitor<SliceCollector> {
+public :
+  SliceCollector(ASTContext &Context)
+      : Context(Context),
+        CurrentFunction(nullptr) {}
+
+  bool TraverseDecl(Decl *D) {
+    const FunctionDecl *PrevFunction = CurrentFunction;
+    if (const FunctionDecl *F = dyn_cast_or_null<FunctionDecl>(D))
+      CurrentFunction = F->getCanonicalDecl();
+
+    // branches never span functions, not even those of local classes
+    std::vector<unsigned> PrevOpen;
+    PrevOpen.swap(Open);
+    const bool Result = RecursiveASTVisitor<SliceCollector>::TraverseDecl(D);
+    Open.swap(PrevOpen);
+    CurrentFunction = PrevFunction;
+    return Result;
+  }
+
+  bool TraverseStmt(Stmt *S) {
+    const Expr *Cond = S ? getCondition(S) : nullptr;
+    if (!Cond)
+      return RecursiveASTVisitor<SliceCollector>::TraverseStmt(S);
+
+    SliceBranch Branch = { S, Cond, CurrentFunction, SliceEffects() };
+    Branches.push_back(Branch);
+    Open.push_back(Branches.size() - 1);
+    const bool Result = RecursiveASTVisitor<SliceCollector>::TraverseStmt(S);
+    Open.pop_back();
+    return Result;
+  }
+
+  bool VisitVarDecl(VarDecl *V) {
+    if (!V->hasInit())
+      return true;
+
+    SymbolicTaintAnalysis::FlowSources Sources;
+    SymbolicTaintAnalysis::collectSources(V->getInit(), Sources);
+    addWrite(Sources, SymbolicTaintAnalysis::getFlowNode(V));
+    return true;
+  }
+
+  bool VisitBinaryOperator(BinaryOperator *E) {
+    if (!E->isAssignmentOp())
+      return true;
+
+    SymbolicTaintAnalysis::FlowSources Sources;
+    SymbolicTaintAnalysis::collectSources(E->getRHS(), Sources);
+    SymbolicTaintAnalysis::DeclList Targets;
+    SymbolicTaintAnalysis::collectTargets(E->getLHS(), Targets);
+    for (const Decl *Target : Targets)
+      addWrite(Sources, Target);
+    return true;
+  }
+
+  bool VisitUnaryOperator(UnaryOperator *E) {
+    if (!E->isIncrementDecrementOp())
+      return true;
+
+    SymbolicTaintAnalysis::FlowSources Sources;
+    SymbolicTaintAnalysis::DeclList Targets;
+    SymbolicTaintAnalysis::collectTargets(E->getSubExpr(), Targets);
+    for (const Decl *Target : Targets)
+      addWrite(Sources, Target);
+    return true;
+  }
+
+  bool VisitReturnStmt(ReturnStmt *S) {
+    addJump();
+    if (!CurrentFunction || !S->getRetValue())
+      return true;
+
+    SymbolicTaintAnalysis::FlowSources Sources;
+    SymbolicTaintAnalysis::collectSources(S->getRetValue(), Sources);
+    addWrite(Sources, SymbolicTaintAnalysis::getFlowNode(CurrentFunction));
+    return true;
+  }
+
+  bool VisitBreakStmt(BreakStmt *) { addJump(); return true; }
+  bool VisitContinueStmt(ContinueStmt *) { addJump(); return true; }
+  bool VisitGotoStmt(GotoStmt *) { addJump(); return true; }
+  bool VisitIndirectGotoStmt(IndirectGotoStmt *) { addJump(); return true; }
+  bool VisitCXXThrowExpr(CXXThrowExpr *) { addExit(); return true; }
+
+  bool VisitCallExpr(CallExpr *E) {
+    const FunctionDecl *Callee = E->getDirectCallee();
+    if (Callee && Callee->isNoReturn())
+      addExit();
+
+    if (Callee && Callee->getIdentifier() &&
+        (Callee->getName() == NseAssertFunctionName ||
+         Callee->getName() == NseAssumeFunctionName)) {
+      addAssertion(E->getArgs(), E->getNumArgs());
+      return true;
+    }
+
+    // nse_make_symbolic() writes its arguments, and the other functions of
+    // the runtime only create values
+    if (Callee && Callee->getIdentifier() &&
+        Callee->getName().startswith("nse_")) {
+      if (Callee->getName() == NseMakeSymbolicFunctionName)
+        for (unsigned I = 0; I < E->getNumArgs(); ++I) {
+          SymbolicTaintAnalysis::FlowSources Sources;
+          SymbolicTaintAnalysis::DeclList Targets;
+          SymbolicTaintAnalysis::collectTargets(E->getArg(I), Targets);
+          for (const Decl *Target : Targets)
+            addWrite(Sources, Target);
+        }
+      return true;
+    }
+
+    // an unknown callee may assert anything about its arguments
+    const SourceManager &SM = Context.getSourceManager();
+    if (!Callee || (!Callee->hasBody() &&
+        !SM.isInSystemHeader(SM.getExpansionLoc(Callee->getLocation())))) {
+      addAssertion(E->getArgs(), E->getNumArgs());
+      return true;
+    }
+
+    // the object argument of a member operator call is not a parameter
+    const unsigned ArgOffset =
+      isa<CXXOperatorCallExpr>(E) && isa<CXXMethodDecl>(Callee) ? 1 : 0;
+    addCall(Callee, E->getArgs() + ArgOffset, E->getNumArgs() - ArgOffset);
+    return true;
+  }
+
+  bool VisitCXXConstructExpr(CXXConstructExpr *E) {
+    if (E->getConstructor())
+      addCall(E->getConstructor(), E->getArgs(), E->getNumArgs());
+    return true;
+  }
+
+  /// Computes the slice and hands it to \p Slice
+  void finish(AssertionSlice &Slice);
+
+private:
+  /// The condition of \p S if it is a statement or expression that chooses
+  /// which of its parts run
+  static const Expr *getCondition(const Stmt *S) {
+    if (const IfStmt *If = dyn_cast<IfStmt>(S))
+      return If->getCond();
+    if (const ForStmt *For = dyn_cast<ForStmt>(S))
+      return For->getCond();
+    if (const WhileStmt *While = dyn_cast<WhileStmt>(S))
+      return While->getCond();
+    if (const DoStmt *Do = dyn_cast<DoStmt>(S))
+      return Do->getCond();
+    if (const SwitchStmt *Switch = dyn_cast<SwitchStmt>(S))
+      return Switch->getCond();
+    if (const CXXForRangeStmt *Range = dyn_cast<CXXForRangeStmt>(S))
+      return Range->getCond();
+    if (const AbstractConditionalOperator *E =
+          dyn_cast<AbstractConditionalOperator>(S))
+      return E->getCond();
+    if (const BinaryOperator *E = dyn_cast<BinaryOperator>(S))
+      if (E->isLogicalOp())
+        return E->getLHS();
+    return nullptr;
+  }
+
+  /// Applies \p Update to the effects of the current function and of every
+  /// branch it is nested in
+  template <typename UpdateT>
+  void addEffect(UpdateT Update) {
+    if (CurrentFunction)
+      Update(Functions[CurrentFunction]);
+    for (unsigned I : Open)
+      Update(Branches[I].Effects);
+  }
+
+  void addWrite(const SymbolicTaintAnalysis::FlowSources &Sources,
+    const Decl *Target) {
+
+    for (const Decl *From : Sources.Decls)
+      addDependency(Target, From, false);
+    for (const Decl *From : Sources.AddressTaken)
+      addDependency(Target, From, true);
+
+    addEffect([Target](SliceEffects &Effects) {
+      Effects.Writes.push_back(Target);
+    });
+  }
+
+  /// \p To depends on \p From, and the other way round if they alias
+  void addDependency(const Decl *To, const Decl *From, bool Bidirectional) {
+    if (To == From)
+      return;
+
+    Dependencies[To].push_back(From);
+    if (Bidirectional || isAliasing(From) || isAliasing(To))
+      Dependencies[From].push_back(To);
+  }
+
+  void addJump() {
+    addEffect([](SliceEffects &Effects) {
+      Effects.Jumps = true;
+    });
+  }
+
+  void addExit() {
+    addEffect([](SliceEffects &Effects) {
+      Effects.Exits = true;
+    });
+  }
+
+  void addAssertion(const Expr *const *Args, unsigned NumArgs) {
+    for (unsigned I = 0; I < NumArgs; ++I)
+      SymbolicTaintAnalysis::collectSources(Args[I], Seeds);
+
+    addEffect([](SliceEffects &Effects) {
+      Effects.Asserts = true;
+    });
+  }
+
+  void addCall(const FunctionDecl *Callee, const Expr *const *Args,
+      unsigned NumArgs) {
+
+    const FunctionDecl *Canonical =
+      cast<FunctionDecl>(SymbolicTaintAnalysis::getFlowNode(Callee));
+    for (unsigned I = 0; I < NumArgs && I < Canonical->getNumParams(); ++I) {
+      SymbolicTaintAnalysis::FlowSources Sources;
+      SymbolicTaintAnalysis::collectSources(Args[I], Sources);
+      addWrite(Sources, Canonical->getParamDecl(I));
+    }
+
+    addEffect([Canonical](SliceEffects &Effects) {
+      Effects.Calls.push_back(Canonical);
+    });
+  }
+
+  /// Whether \p Effects put their branch or function into the slice
+  bool isRelevant(const SliceEffects &Effects,
+    const llvm::DenseSet<const Decl *> &Relevant,
+    const llvm::DenseSet<const FunctionDecl *> &RelevantFunctions) const {
+
+    if (Effects.Asserts)
+      return true;
+    for (const Decl *D : Effects.Writes)
+      if (Relevant.count(D))
+        return true;
+    for (const FunctionDecl *F : Effects.Calls)
+      if (RelevantFunctions.count(F))
+        return true;
+    return false;
+  }
+
+  /// Whether \p Effects may leave the callers of their function
+  static bool exits(const SliceEffects &Effects,
+    const llvm::DenseSet<const FunctionDecl *> &ExitingFunctions) {
+
+    if (Effects.Exits)
+      return true;
+    for (const FunctionDecl *F : Effects.Calls)
+      if (ExitingFunctions.count(F))
+        return true;
+    return false;
+  }
+
+  ASTContext &Context;
+  const FunctionDecl *CurrentFunction;
+
+  /// Indices of the branches that enclose the current node
+  std::vector<unsigned> Open;
+
+  std::vector<SliceBranch> Branches;
+  llvm::DenseMap<const FunctionDecl *, SliceEffects> Functions;
+  llvm::DenseMap<const Decl *, SymbolicTaintAnalysis::DeclList> Dependencies;
+  SymbolicTaintAnalysis::FlowSources Seeds;
+};
+
+void SliceCollector::finish(AssertionSlice &Slice) {
+  llvm::DenseSet<const Decl *> &Relevant = Slice.Relevant;
+  llvm::DenseSet<const FunctionDecl *> RelevantFunctions;
+  std::vector<bool> RelevantBranches(Branches.size(), false);
+
+  // a function that calls one which may not return may not return either
+  llvm::DenseSet<const FunctionDecl *> ExitingFunctions;
+  for (bool Changed = true; Changed;) {
+    Changed = false;
+    for (const auto &Function : Functions)
+      if (!ExitingFunctions.count(Function.first) &&
+          exits(Function.second, ExitingFunctions)) {
+        ExitingFunctions.insert(Function.first);
+        Changed = true;
+      }
+  }
+
+  std::vector<const Decl *> Worklist(Seeds.Decls.begin(), Seeds.Decls.end());
+  for (const Decl *D : Worklist)
+    Relevant.insert(D);
+
+  // relevant branches read their conditions, which may make further
+  // writes and therefore branches relevant
+  bool Changed = true;
+  while (Changed) {
+    Changed = false;
+    while (!Worklist.empty()) {
+      const Decl *To = Worklist.back();
+      Worklist.pop_back();
+
+      llvm::DenseMap<const Decl *, SymbolicTaintAnalysis::DeclList>::
+        const_iterator I = Dependencies.find(To);
+      if (I == Dependencies.end())
+        continue;
+
+      for (const Decl *From : I->second)
+        if (Relevant.insert(From).second)
+          Worklist.push_back(From);
+    }
+
+    for (const auto &Function : Functions)
+      if (!RelevantFunctions.count(Function.first) &&
+          isRelevant(Function.second, Relevant, RelevantFunctions)) {
+        RelevantFunctions.insert(Function.first);
+        Changed = true;
+      }
+
+    for (unsigned I = 0; I < Branches.size(); ++I) {
+      const SliceBranch &Branch = Branches[I];
+      if (RelevantBranches[I] ||
+          (!isRelevant(Branch.Effects, Relevant, RelevantFunctions) &&
+           !(Branch.Effects.Jumps && (!Branch.Function ||
+             RelevantFunctions.count(Branch.Function))) &&
+           !exits(Branch.Effects, ExitingFunctions)))
+        continue;
+
+      RelevantBranches[I] = true;
+      Changed = true;
+
+      SymbolicTaintAnalysis::FlowSources Sources;
+      SymbolicTaintAnalysis::collectSources(Branch.Cond, Sources);
+      for (const Decl *D : Sources.Decls)
+        if (Relevant.insert(D).second)
+          Worklist.push_back(D);
+    }
+  }
+
+  for (unsigned I = 0; I < Branches.size(); ++I) {
+    const Stmt *S = Branches[I].Branch;
+    if (!RelevantBranches[I] &&
+        (isa<IfStmt>(S) || isa<ForStmt>(S) || isa<WhileStmt>(S)))
+      Slice.SlicedConditions.insert(Branches[I].Cond);
+  }
+
+  DEBUG(llvm::dbgs() << "AssertionSlice: " << Relevant.size()
+                     << " relevant nodes, " << RelevantFunctions.size()
+                     << " relevant functions, "
+                     << Slice.SlicedConditions.size()
+                     << " sliced branches\n");
+}
+
+void AssertionSlice::analyze(ASTContext &Context) {
+  SlicedConditions.clear();
+  Relevant.clear();
+
+  SliceCollector Collector(Context);
+  Collector.TraverseDecl(Context.getTranslationUnitDecl());
+  Collector.finish(*this);
+}
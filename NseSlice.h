@@ -0,0 +1,76 @@
+//===-- NseSlice.h - Assertion-driven program slicing -----------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief Finds the branches that no assertion or assumption depends on
+///
+/// A symbolic branch doubles the paths that the runtime explores even if
+/// neither of its directions can change whether an nse_assert() holds. The
+/// slice is computed backwards from every nse_assert() and nse_assume():
+///
+///   - the variables, parameters, fields and return values that their
+///     arguments read are in the slice, and so is everything that flows into
+///     something in the slice, along the same edges as SymbolicTaintAnalysis;
+///
+///   - a branch is in the slice if it contains an assertion or assumption, a
+///     write to something in the slice, or a call of a function in the slice,
+///     and then the condition of the branch is read by the slice as well;
+///
+///   - a function is in the slice if its body contains anything that would
+///     put a branch into the slice.
+///
+/// A branch that contains a return, break, continue or goto is in the slice
+/// if its function is, since it decides whether the rest of the function
+/// runs. A branch that contains a throw, a call of a function that does not
+/// return, or a call of a function that may do either, is always in the
+/// slice, since it decides whether its callers run on. Calls of
+/// functions that are declared outside of system headers but defined in
+/// another translation unit, and calls through pointers, may assert
+/// anything, so they count as assertions whose arguments are in the slice.
+/// Otherwise, the translation unit is assumed to be the whole program.
+///
+/// The runtime need not record the direction of a branch outside the slice,
+/// see nse_sliced_branch() in NseHarness.h.
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef CLANG_CRV_SLICE_H
+#define CLANG_CRV_SLICE_H
+
+#include "clang/AST/ASTContext.h"
+#include "clang/AST/Decl.h"
+#include "clang/AST/Expr.h"
+#include "llvm/ADT/DenseSet.h"
+
+class AssertionSlice {
+public :
+  /// Discards the slice of the previous translation unit and computes the
+  /// one of \p Context
+  void analyze(clang::ASTContext &Context);
+
+  /// Whether \p E is the condition of an if, for or while statement outside
+  /// of the slice
+  bool isSlicedCondition(const clang::Expr *E) const {
+    return SlicedConditions.count(E);
+  }
+
+  /// Whether an assertion or assumption may depend on the flow node \p D,
+  /// see SymbolicTaintAnalysis::getFlowNode()
+  bool isRelevant(const clang::Decl *D) const {
+    return Relevant.count(D);
+  }
+
+private:
+  friend class SliceCollector;
+
+  llvm::DenseSet<const clang::Expr *> SlicedConditions;
+  llvm::DenseSet<const clang::Decl *> Relevant;
+};
+
+#endif
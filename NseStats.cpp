@@ -0,0 +1,173 @@
+//===-- NseStats.cpp - Instrumentation statistics -------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/Support/Format.h"
+#include "NseStats.h"
+
+ReplacerStats &ReplacerStats::operator+=(const ReplacerStats &Other) {
+  Matched += Other.Matched;
+  NotInMainFile += Other.NotInMainFile;
+  UnsupportedType += Other.UnsupportedType;
+  NotSymbolic += Other.NotSymbolic;
+  Replacements += Other.Replacements;
+  Seconds += Other.Seconds;
+  return *this;
+}
+
+NseFileStats &NseFileStats::operator+=(const NseFileStats &Other) {
+  ParseSeconds += Other.ParseSeconds;
+  MatchSeconds += Other.MatchSeconds;
+  Replacements += Other.Replacements;
+
+  // all instrumenters register the same matchers in the same order
+  if (Matchers.empty())
+    Matchers = Other.Matchers;
+  else
+    for (size_t I = 0; I < Matchers.size() && I < Other.Matchers.size(); ++I) {
+      Matchers[I].Replacer += Other.Matchers[I].Replacer;
+      if (Matchers[I].MatchSeconds >= 0 && Other.Matchers[I].MatchSeconds >= 0)
+        Matchers[I].MatchSeconds += Other.Matchers[I].MatchSeconds;
+      else
+        Matchers[I].MatchSeconds = -1;
+    }
+
+  return *this;
+}
+
+static NseFileStats getTotal(const std::vector<NseFileStats> &Files) {
+  NseFileStats Total;
+  Total.File = "total";
+  for (const NseFileStats &File : Files)
+    Total += File;
+  return Total;
+}
+
+void writeJSONString(llvm::raw_ostream &OS, llvm::StringRef S) {
+  OS << '"';
+  for (char C : S) {
+    switch (C) {
+    case '"':  OS << "\\\""; break;
+    case '\\': OS << "\\\\"; break;
+    case '\n': OS << "\\n"; break;
+    case '\t': OS << "\\t"; break;
+    default:
+      if (static_cast<unsigned char>(C) < 0x20)
+        OS << llvm::format("\\u%04x", C);
+      else
+        OS << C;
+    }
+  }
+  OS << '"';
+}
+
+/// Prints \p S left-aligned in a column of \p Width characters
+static void printColumn(llvm::raw_ostream &OS, llvm::StringRef S,
+  unsigned Width) {
+
+  OS << S;
+  if (S.size() < Width)
+    OS.indent(Width - S.size());
+}
+
+static void printFileStats(const NseFileStats &File, llvm::raw_ostream &OS) {
+  OS << File.File << ": parse "
+     << llvm::format("%.3f", File.ParseSeconds) << "s, match "
+     << llvm::format("%.3f", File.MatchSeconds) << "s, "
+     << File.Replacements << " replacements\n";
+
+  OS << "  ";
+  printColumn(OS, "replacer", 28);
+  OS << "  matched not-main   unsupp concrete replaced callback-ms"
+        "   match-ms\n";
+
+  for (const MatcherStats &M : File.Matchers) {
+    const ReplacerStats &R = M.Replacer;
+    OS << "  ";
+    printColumn(OS, M.Name, 28);
+    OS << llvm::format(" %8u", R.Matched)
+       << llvm::format(" %8u", R.NotInMainFile)
+       << llvm::format(" %8u", R.UnsupportedType)
+       << llvm::format(" %8u", R.NotSymbolic)
+       << llvm::format(" %8u", R.Replacements)
+       << llvm::format(" %11.2f", R.Seconds * 1000);
+
+    if (M.MatchSeconds < 0)
+      OS << "          -\n";
+    else
+      OS << llvm::format(" %10.2f\n", M.MatchSeconds * 1000);
+  }
+}
+
+void printStats(
+  const std::vector<NseFileStats> &Files,
+  double SaveSeconds,
+  llvm::raw_ostream &OS) {
+
+  for (const NseFileStats &File : Files)
+    printFileStats(File, OS);
+
+  if (Files.size() > 1)
+    printFileStats(getTotal(Files), OS);
+
+  if (SaveSeconds >= 0)
+    OS << "save: " << llvm::format("%.3f", SaveSeconds) << "s\n";
+}
+
+static void writeFileStatsJSON(const NseFileStats &File,
+  llvm::raw_ostream &OS) {
+
+  OS << "{\"file\": ";
+  writeJSONString(OS, File.File);
+  OS << ", \"parse_seconds\": " << File.ParseSeconds
+     << ", \"match_seconds\": " << File.MatchSeconds
+     << ", \"replacements\": " << File.Replacements
+     << ", \"replacers\": [";
+
+  for (size_t I = 0; I < File.Matchers.size(); ++I) {
+    const MatcherStats &M = File.Matchers[I];
+    const ReplacerStats &R = M.Replacer;
+    OS << (I ? ", " : "") << "{\"name\": ";
+    writeJSONString(OS, M.Name);
+    OS << ", \"matched\": " << R.Matched
+       << ", \"not_in_main_file\": " << R.NotInMainFile
+       << ", \"unsupported_type\": " << R.UnsupportedType
+       << ", \"not_symbolic\": " << R.NotSymbolic
+       << ", \"replacements\": " << R.Replacements
+       << ", \"callback_seconds\": " << R.Seconds
+       << ", \"match_seconds\": ";
+    if (M.MatchSeconds < 0)
+      OS << "null";
+    else
+      OS << M.MatchSeconds;
+    OS << "}";
+  }
+
+  OS << "]}";
+}
+
+void writeStatsJSON(
+  const std::vector<NseFileStats> &Files,
+  double SaveSeconds,
+  llvm::raw_ostream &OS) {
+
+  OS << "{\n  \"files\": [";
+  for (size_t I = 0; I < Files.size(); ++I) {
+    OS << (I ? ",\n    " : "\n    ");
+    writeFileStatsJSON(Files[I], OS);
+  }
+
+  OS << "\n  ],\n  \"total\": ";
+  writeFileStatsJSON(getTotal(Files), OS);
+  OS << ",\n  \"save_seconds\": ";
+  if (SaveSeconds < 0)
+    OS << "null";
+  else
+    OS << SaveSeconds;
+  OS << "\n}\n";
+}
@@ -0,0 +1,120 @@
+//===-- NseStats.h - Instrumentation statistics -----------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief Where clang-nse spends its time and how much it rewrites
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef CLANG_CRV_STATS_H
+#define CLANG_CRV_STATS_H
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+/// Measures the wall-clock time since its construction
+class NseStopwatch {
+public :
+  NseStopwatch()
+      : Start(std::chrono::steady_clock::now()) {}
+
+  double getSeconds() const {
+    return std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - Start).count();
+  }
+
+private:
+  std::chrono::steady_clock::time_point Start;
+};
+
+/// Counters of one replacer. Every matched node is either rejected by one
+/// of the filters or instrumented.
+struct ReplacerStats {
+  ReplacerStats()
+      : Matched(0),
+        NotInMainFile(0),
+        UnsupportedType(0),
+        NotSymbolic(0),
+        Replacements(0),
+        Seconds(0) {}
+
+  ReplacerStats &operator+=(const ReplacerStats &Other);
+
+  unsigned Matched;
+
+  /// Rejected because the file is not instrumented by this translation
+  /// unit, see NseFileFilter
+  unsigned NotInMainFile;
+  unsigned UnsupportedType;
+
+  /// Rejected by the taint analysis, including concrete branch conditions
+  unsigned NotSymbolic;
+
+  unsigned Replacements;
+
+  /// Time spent in the replacer's callback
+  double Seconds;
+};
+
+/// A replacer together with the time spent matching its matcher, which is
+/// only known for the traversal engine
+struct MatcherStats {
+  MatcherStats()
+      : MatchSeconds(-1) {}
+
+  std::string Name;
+  ReplacerStats Replacer;
+
+  /// Time spent in the matcher excluding the callback, or negative if
+  /// unknown
+  double MatchSeconds;
+};
+
+/// Statistics of one instrumented translation unit
+struct NseFileStats {
+  NseFileStats()
+      : ParseSeconds(0),
+        MatchSeconds(0),
+        Replacements(0) {}
+
+  NseFileStats &operator+=(const NseFileStats &Other);
+
+  std::string File;
+
+  /// Time from the start of preprocessing to a complete AST
+  double ParseSeconds;
+
+  /// Time spent analyzing and matching, including all callbacks
+  double MatchSeconds;
+
+  unsigned Replacements;
+  std::vector<MatcherStats> Matchers;
+};
+
+/// Writes \p S as a quoted JSON string
+void writeJSONString(llvm::raw_ostream &OS, llvm::StringRef S);
+
+/// Prints \p Files and their sum as tables. \p SaveSeconds is the time
+/// spent rewriting files, or negative if nothing was written.
+void printStats(
+  const std::vector<NseFileStats> &Files,
+  double SaveSeconds,
+  llvm::raw_ostream &OS);
+
+/// Writes the same as printStats() as a JSON object
+void writeStatsJSON(
+  const std::vector<NseFileStats> &Files,
+  double SaveSeconds,
+  llvm::raw_ostream &OS);
+
+#endif
@@ -0,0 +1,414 @@
+//===-- NseTaint.cpp - Symbolic taint analysis ----------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#define DEBUG_TYPE "NseTaint"
+
+#include "clang/AST/ExprCXX.h"
+#include "clang/AST/RecursiveASTVisitor.h"
+#include "clang/Basic/SourceManager.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/Regex.h"
+#include "NseTaint.h"
+#include "NseTransform.h"
+
+static bool isSymbolicFunction(const FunctionDecl *D) {
+  static llvm::Regex SymbolicRegex(NseSymbolicFunctionRegex);
+  return SymbolicRegex.match(D->getName());
+}
+
+static bool isMakeSymbolicFunction(const FunctionDecl *D) {
+  return D->getName() == NseMakeSymbolicFunctionName;
+}
+
+/// Pointers, arrays and references alias the storage of other nodes
+static bool isAliasing(const Decl *D) {
+  QualType QT;
+  if (const FunctionDecl *F = dyn_cast<FunctionDecl>(D))
+    QT = F->getReturnType();
+  else if (const ValueDecl *V = dyn_cast<ValueDecl>(D))
+    QT = V->getType();
+  else
+    return false;
+
+  return QT->isPointerType() || QT->isArrayType() || QT->isReferenceType();
+}
+
+const Decl *SymbolicTaintAnalysis::getFlowNode(const Decl *D) {
+  if (const ParmVarDecl *P = dyn_cast<ParmVarDecl>(D)) {
+    const FunctionDecl *F = dyn_cast<FunctionDecl>(P->getDeclContext());
+    if (F && P->getFunctionScopeIndex() < F->getNumParams())
+      return F->getCanonicalDecl()->getParamDecl(P->getFunctionScopeIndex());
+  }
+
+  return D->getCanonicalDecl();
+}
+
+static void collectSourcesImpl(
+  const Stmt *S,
+  SymbolicTaintAnalysis::FlowSources &Sources,
+  bool AddressTaken) {
+
+  if (!S)
+    return;
+
+  // the operands of sizeof and alignof are never evaluated
+  if (isa<UnaryExprOrTypeTraitExpr>(S))
+    return;
+
+  if (const DeclRefExpr *E = dyn_cast<DeclRefExpr>(S)) {
+    if (isa<VarDecl>(E->getDecl())) {
+      const Decl *Node = SymbolicTaintAnalysis::getFlowNode(E->getDecl());
+      Sources.Decls.push_back(Node);
+      if (AddressTaken)
+        Sources.AddressTaken.push_back(Node);
+    }
+    return;
+  }
+
+  if (const MemberExpr *E = dyn_cast<MemberExpr>(S)) {
+    if (isa<FieldDecl>(E->getMemberDecl())) {
+      const Decl *Node = SymbolicTaintAnalysis::getFlowNode(E->getMemberDecl());
+      Sources.Decls.push_back(Node);
+      if (AddressTaken)
+        Sources.AddressTaken.push_back(Node);
+    }
+  }
+
+  if (const UnaryOperator *E = dyn_cast<UnaryOperator>(S)) {
+    if (E->getOpcode() == UO_AddrOf) {
+      collectSourcesImpl(E->getSubExpr(), Sources, true);
+      return;
+    }
+  }
+
+  if (const CallExpr *E = dyn_cast<CallExpr>(S)) {
+    const FunctionDecl *Callee = E->getDirectCallee();
+    if (Callee && isSymbolicFunction(Callee)) {
+      Sources.Seed = true;
+      return;
+    }
+
+    // arguments flow into the callee through its parameters
+    if (Callee)
+      Sources.Decls.push_back(SymbolicTaintAnalysis::getFlowNode(Callee));
+
+    if (Callee && Callee->hasBody())
+      return;
+
+    // without a body, the result may depend on any of the arguments
+  }
+
+  for (Stmt::const_child_iterator I = S->child_begin(), E = S->child_end();
+       I != E; ++I)
+    collectSourcesImpl(*I, Sources, AddressTaken);
+}
+
+void SymbolicTaintAnalysis::collectSources(
+  const Stmt *S,
+  FlowSources &Sources) {
+
+  collectSourcesImpl(S, Sources, false);
+}
+
+void SymbolicTaintAnalysis::collectTargets(
+  const Expr *E,
+  DeclList &Targets) {
+
+  if (!E)
+    return;
+
+  E = E->IgnoreParenImpCasts();
+  if (const DeclRefExpr *DRE = dyn_cast<DeclRefExpr>(E)) {
+    if (isa<VarDecl>(DRE->getDecl()))
+      Targets.push_back(getFlowNode(DRE->getDecl()));
+  } else if (const MemberExpr *ME = dyn_cast<MemberExpr>(E)) {
+    if (isa<FieldDecl>(ME->getMemberDecl()))
+      Targets.push_back(getFlowNode(ME->getMemberDecl()));
+  } else if (const ArraySubscriptExpr *ASE = dyn_cast<ArraySubscriptExpr>(E)) {
+    collectTargets(ASE->getBase(), Targets);
+  } else if (const UnaryOperator *UO = dyn_cast<UnaryOperator>(E)) {
+    if (UO->getOpcode() == UO_Deref || UO->getOpcode() == UO_AddrOf)
+      collectTargets(UO->getSubExpr(), Targets);
+  } else if (const BinaryOperator *BO = dyn_cast<BinaryOperator>(E)) {
+    // pointer arithmetic such as *(p + 1)
+    if (BO->isAdditiveOp()) {
+      if (BO->getLHS()->getType()->isPointerType())
+        collectTargets(BO->getLHS(), Targets);
+      if (BO->getRHS()->getType()->isPointerType())
+        collectTargets(BO->getRHS(), Targets);
+    } else if (BO->getOpcode() == BO_Comma) {
+      collectTargets(BO->getRHS(), Targets);
+    }
+  } else if (const ConditionalOperator *CO = dyn_cast<ConditionalOperator>(E)) {
+    collectTargets(CO->getTrueExpr(), Targets);
+    collectTargets(CO->getFalseExpr(), Targets);
+  }
+}
+
+void SymbolicTaintAnalysis::addFlow(
+  const Decl *From,
+  const Decl *To,
+  bool Bidirectional) {
+
+  if (From == To)
+    return;
+
+  Flows[From].push_back(To);
+  if (Bidirectional || isAliasing(From) || isAliasing(To))
+    Flows[To].push_back(From);
+}
+
+void SymbolicTaintAnalysis::addFlows(
+  const FlowSources &Sources,
+  const Decl *To) {
+
+  if (Sources.Seed)
+    Seeds.insert(To);
+
+  for (const Decl *From : Sources.Decls)
+    addFlow(From, To, false);
+
+  for (const Decl *From : Sources.AddressTaken)
+    addFlow(From, To, true);
+}
+
+/// Records the data flow of a translation unit in a SymbolicTaintAnalysis
+class FlowGraphBuilder : public RecursiveASTVisitor<FlowGraphBuilder> {
+public :
+  FlowGraphBuilder(
+    SymbolicTaintAnalysis &Taint,
+    ASTContext &Context)
+      : Taint(Taint),
+        Context(Context),
+        CurrentFunction(nullptr),
+        DirectCallees() {}
+
+  bool TraverseDecl(Decl *D) {
+    const FunctionDecl *PrevFunction = CurrentFunction;
+    if (const FunctionDecl *F = dyn_cast_or_null<FunctionDecl>(D))
+      CurrentFunction = F;
+
+    bool Result = RecursiveASTVisitor<FlowGraphBuilder>::TraverseDecl(D);
+    CurrentFunction = PrevFunction;
+    return Result;
+  }
+
+  bool VisitDeclaratorDecl(DeclaratorDecl *D) {
+    if (Taint.isInWrappedHeader(D))
+      Taint.Seeds.insert(SymbolicTaintAnalysis::getFlowNode(D));
+    return true;
+  }
+
+  bool VisitVarDecl(VarDecl *V) {
+    // another translation unit defines it or, in project mode, may use it
+    if (isExternal(V) && V->hasGlobalStorage() && !V->isStaticLocal() &&
+        (Taint.Project ||
+         (!V->getDefinition() && !V->getActingDefinition())))
+      Taint.Seeds.insert(SymbolicTaintAnalysis::getFlowNode(V));
+
+    if (!V->hasInit())
+      return true;
+
+    SymbolicTaintAnalysis::FlowSources Sources;
+    SymbolicTaintAnalysis::collectSources(V->getInit(), Sources);
+    Taint.addFlows(Sources, SymbolicTaintAnalysis::getFlowNode(V));
+    return true;
+  }
+
+  bool VisitBinaryOperator(BinaryOperator *E) {
+    if (!E->isAssignmentOp())
+      return true;
+
+    addAssignment(E->getLHS(), E->getRHS());
+    return true;
+  }
+
+  bool VisitReturnStmt(ReturnStmt *S) {
+    if (!CurrentFunction || !S->getRetValue())
+      return true;
+
+    SymbolicTaintAnalysis::FlowSources Sources;
+    SymbolicTaintAnalysis::collectSources(S->getRetValue(), Sources);
+    Taint.addFlows(Sources, SymbolicTaintAnalysis::getFlowNode(CurrentFunction));
+    return true;
+  }
+
+  bool VisitCallExpr(CallExpr *E) {
+    const FunctionDecl *Callee = E->getDirectCallee();
+    if (!Callee)
+      return true;
+
+    DirectCallees.insert(E->getCallee()->IgnoreParenImpCasts());
+
+    if (isMakeSymbolicFunction(Callee)) {
+      for (unsigned I = 0; I < E->getNumArgs(); ++I) {
+        SymbolicTaintAnalysis::DeclList Targets;
+        SymbolicTaintAnalysis::collectTargets(E->getArg(I), Targets);
+        Taint.Seeds.insert(Targets.begin(), Targets.end());
+      }
+      return true;
+    }
+
+    // the object argument of a member operator call is not a parameter
+    unsigned ArgOffset =
+      isa<CXXOperatorCallExpr>(E) && isa<CXXMethodDecl>(Callee) ? 1 : 0;
+    addArguments(Callee, E->getArgs() + ArgOffset,
+      E->getNumArgs() - ArgOffset);
+    return true;
+  }
+
+  bool VisitCXXConstructExpr(CXXConstructExpr *E) {
+    addArguments(E->getConstructor(), E->getArgs(), E->getNumArgs());
+    return true;
+  }
+
+  bool VisitDeclRefExpr(DeclRefExpr *E) {
+    const FunctionDecl *F = dyn_cast<FunctionDecl>(E->getDecl());
+    if (F && !DirectCallees.count(E))
+      makeFullySymbolic(F);
+
+    return true;
+  }
+
+  bool VisitFunctionDecl(FunctionDecl *F) {
+    if (!F->hasBody() && !isSymbolicFunction(F) &&
+        !isMakeSymbolicFunction(F) &&
+        Context.getSourceManager().isWrittenInMainFile(F->getLocation()))
+      makeFullySymbolic(F);
+
+    // in project mode, another translation unit that only declares it makes
+    // it fully symbolic, and both must agree on its signature. Inline
+    // functions and templates are defined wherever they are used.
+    if (Taint.Project && F->isThisDeclarationADefinition() &&
+        isExternal(F) && !F->isMain() &&
+        !F->isInlined() && !F->isImplicit() &&
+        F->getTemplatedKind() == FunctionDecl::TK_NonTemplate &&
+        !isSymbolicFunction(F) && !isMakeSymbolicFunction(F))
+      makeFullySymbolic(F);
+
+    return true;
+  }
+
+private:
+  /// Whether other translation units may refer to \p D, which is then
+  /// symbolic in all of them
+  bool isExternal(const NamedDecl *D) const {
+    return D->isExternallyVisible() &&
+      !Context.getSourceManager().isInSystemHeader(D->getLocation());
+  }
+
+  void addAssignment(const Expr *LHS, const Expr *RHS) {
+    SymbolicTaintAnalysis::FlowSources Sources;
+    SymbolicTaintAnalysis::collectSources(RHS, Sources);
+
+    SymbolicTaintAnalysis::DeclList Targets;
+    SymbolicTaintAnalysis::collectTargets(LHS, Targets);
+    for (const Decl *Target : Targets)
+      Taint.addFlows(Sources, Target);
+  }
+
+  void addArguments(const FunctionDecl *Callee, const Expr *const *Args,
+      unsigned NumArgs) {
+
+    const Decl *CalleeNode = SymbolicTaintAnalysis::getFlowNode(Callee);
+    const FunctionDecl *Canonical = cast<FunctionDecl>(CalleeNode);
+    for (unsigned I = 0; I < NumArgs && I < Canonical->getNumParams(); ++I) {
+      SymbolicTaintAnalysis::FlowSources Sources;
+      SymbolicTaintAnalysis::collectSources(Args[I], Sources);
+      Taint.addFlows(Sources, Canonical->getParamDecl(I));
+    }
+  }
+
+  /// Callers that cannot be seen may pass and receive symbolic values
+  void makeFullySymbolic(const FunctionDecl *F) {
+    const FunctionDecl *Canonical =
+      cast<FunctionDecl>(SymbolicTaintAnalysis::getFlowNode(F));
+
+    Taint.Seeds.insert(Canonical);
+    for (unsigned I = 0; I < Canonical->getNumParams(); ++I)
+      Taint.Seeds.insert(Canonical->getParamDecl(I));
+  }
+
+  SymbolicTaintAnalysis &Taint;
+  ASTContext &Context;
+  const FunctionDecl *CurrentFunction;
+  llvm::DenseSet<const Expr *> DirectCallees;
+};
+
+void SymbolicTaintAnalysis::analyze(ASTContext &Context) {
+  Flows.clear();
+  Seeds.clear();
+  Symbolic.clear();
+  this->Context = &Context;
+
+  if (WrapAll)
+    return;
+
+  FlowGraphBuilder Builder(*this, Context);
+  Builder.TraverseDecl(Context.getTranslationUnitDecl());
+
+  llvm::SmallVector<const Decl *, 32> Worklist(Seeds.begin(), Seeds.end());
+  Symbolic.insert(Seeds.begin(), Seeds.end());
+  while (!Worklist.empty()) {
+    const Decl *From = Worklist.pop_back_val();
+    llvm::DenseMap<const Decl *, DeclList>::const_iterator I = Flows.find(From);
+    if (I == Flows.end())
+      continue;
+
+    for (const Decl *To : I->second)
+      if (Symbolic.insert(To).second)
+        Worklist.push_back(To);
+  }
+
+  DEBUG(llvm::errs() << "SymbolicTaintAnalysis: " << Seeds.size()
+                     << " seeds, " << Symbolic.size() << " symbolic nodes\n");
+}
+
+bool SymbolicTaintAnalysis::isSymbolic(const Decl *D) const {
+  return WrapAll || Symbolic.count(getFlowNode(D));
+}
+
+/// Whether \p D is instrumented when every supported declaration is
+bool SymbolicTaintAnalysis::isInstrumented(const Decl *D) const {
+  if (!Context->getSourceManager().isWrittenInMainFile(D->getLocation()) &&
+      !isInWrappedHeader(D))
+    return false;
+
+  if (const FunctionDecl *F = dyn_cast<FunctionDecl>(D))
+    return !F->isMain() && isSupportedType(F->getReturnType());
+
+  if (const ValueDecl *V = dyn_cast<ValueDecl>(D))
+    return isSupportedType(V->getType());
+
+  return false;
+}
+
+bool SymbolicTaintAnalysis::isInWrappedHeader(const Decl *D) const {
+  if (!Project)
+    return false;
+
+  // like NseFileFilter::isUserFile(), but for the expansion of a macro, too
+  const SourceManager &SM = Context->getSourceManager();
+  const SourceLocation Loc = SM.getExpansionLoc(D->getLocation());
+  return Loc.isValid() && !SM.isWrittenInMainFile(Loc) &&
+    !SM.isInSystemHeader(Loc) && SM.getFileEntryForID(SM.getFileID(Loc));
+}
+
+bool SymbolicTaintAnalysis::isSymbolicExpr(const Expr *E) const {
+  FlowSources Sources;
+  collectSources(E, Sources);
+  if (Sources.Seed)
+    return true;
+
+  for (const Decl *D : Sources.Decls)
+    if (WrapAll ? isInstrumented(D) : Symbolic.count(D))
+      return true;
+
+  return false;
+}
@@ -0,0 +1,119 @@
+//===-- NseTaint.h - Symbolic taint analysis --------------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief Finds the declarations that symbolic values can flow into
+///
+/// The analysis builds a flow-insensitive data-flow graph over variables,
+/// parameters, fields and function return values of a translation unit.
+/// It is seeded at calls to nse_symbolic*() and nse_make_symbolic() and
+/// propagates along initializations, assignments, argument passing and
+/// return statements. Values flowing into or out of pointers, arrays and
+/// references propagate in both directions so that aliases agree on their
+/// instrumented type. Fields are tracked per declaration, not per object.
+///
+/// Functions that are declared in the main file but defined elsewhere,
+/// global variables with external linkage that are declared but not defined
+/// in the translation unit, and functions whose address is taken, are
+/// conservatively treated as fully symbolic. Otherwise, the translation unit
+/// is assumed to be the whole program.
+///
+/// In project mode, the translation unit is one of several, which must
+/// agree on the types of what they share. Since the others treat the
+/// functions and globals they only declare as symbolic, every definition
+/// with external linkage outside of system headers is fully symbolic, too,
+/// except for inline functions and templates, which every user defines
+/// itself. Every declaration in a user header is symbolic as well, like with
+/// WrapAll, so that whichever translation unit instruments a shared header
+/// computes the same replacements for it.
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef CLANG_CRV_TAINT_H
+#define CLANG_CRV_TAINT_H
+
+#include "clang/AST/ASTContext.h"
+#include "clang/AST/Decl.h"
+#include "clang/AST/Expr.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/SmallVector.h"
+
+class SymbolicTaintAnalysis {
+public :
+  typedef llvm::SmallVector<const clang::Decl *, 4> DeclList;
+
+  /// Values that an expression may evaluate to
+  struct FlowSources {
+    FlowSources()
+        : Decls(), AddressTaken(), Seed(false) {}
+
+    /// Nodes whose value is read
+    DeclList Decls;
+
+    /// Nodes whose address is taken
+    DeclList AddressTaken;
+
+    /// Whether the expression calls an nse_symbolic* function
+    bool Seed;
+  };
+
+  /// If \p WrapAll is true, every declaration is considered symbolic
+  /// and analyze() does not build the data-flow graph. If \p Project is true,
+  /// the translation unit is analyzed in project mode.
+  SymbolicTaintAnalysis(bool WrapAll, bool Project = false)
+      : WrapAll(WrapAll),
+        Project(Project),
+        Context(nullptr) {}
+
+  /// Discards the results for the previous translation unit and computes
+  /// them for \p Context
+  void analyze(clang::ASTContext &Context);
+
+  /// True if symbolic values may flow into the variable, parameter, field
+  /// or function return value \p D
+  bool isSymbolic(const clang::Decl *D) const;
+
+  /// True if evaluating \p E may yield a symbolic value. If every
+  /// declaration is considered symbolic, this is the case whenever \p E
+  /// reads an instrumented declaration of the main file.
+  bool isSymbolicExpr(const clang::Expr *E) const;
+
+  /// Returns the node that represents \p D in the data-flow graph. All
+  /// redeclarations of a function share the parameters of the canonical one.
+  static const clang::Decl *getFlowNode(const clang::Decl *D);
+
+  static void collectSources(const clang::Stmt *S, FlowSources &Sources);
+
+  /// Collects the nodes that are written by assigning to \p E
+  static void collectTargets(const clang::Expr *E, DeclList &Targets);
+
+private:
+  friend class FlowGraphBuilder;
+
+  /// Symbolic values may flow from \p From to \p To
+  void addFlow(const clang::Decl *From, const clang::Decl *To,
+    bool Bidirectional);
+
+  void addFlows(const FlowSources &Sources, const clang::Decl *To);
+
+  bool isInstrumented(const clang::Decl *D) const;
+
+  /// Whether \p D is wrapped because it is declared in a user header
+  bool isInWrappedHeader(const clang::Decl *D) const;
+
+  const bool WrapAll;
+  const bool Project;
+  const clang::ASTContext *Context;
+  llvm::DenseMap<const clang::Decl *, DeclList> Flows;
+  llvm::DenseSet<const clang::Decl *> Seeds;
+  llvm::DenseSet<const clang::Decl *> Symbolic;
+};
+
+#endif
@@ -1,11 +1,18 @@
 #include "clang/ASTMatchers/ASTMatchers.h"
 #include "clang/ASTMatchers/ASTMatchFinder.h"
+#include "clang/Basic/Diagnostic.h"
 #include "clang/Basic/SourceManager.h"
 #include "clang/Lex/Lexer.h"
 #include "clang/AST/ASTContext.h"
+#include "clang/AST/ASTConsumer.h"
+#include "clang/AST/DeclTemplate.h"
+#include "clang/Frontend/FrontendAction.h"
 #include "NseTransform.h"
 
+#include <algorithm>
+
 const char *NseInternalClassName = "crv::Internal<";
+const char *NseExternalClassName = "crv::External<";
 const char *NseAssumeFunctionName = "nse_assume";
 const char *NseAssertFunctionName = "nse_assert";
 const char *NseSymbolicFunctionRegex = "nse_symbolic.*";
@@ -26,6 +33,14 @@ const char *AssertBindId = "assert";
 const char *SymbolicBindId = "symbolic";
 const char *MakeSymbolicBindId = "make_symbolic";
 const char *CStyleCastBindId = "c_style_cast";
+const char *AssignmentBindId = "assignment";
+const char *CompoundBindId = "compound";
+const char *ArraySubscriptBindId = "array_subscript";
+const char *MemoizeBindId = "memoized_function";
+const char *LoopSummaryBindId = "summarized_loop";
+const char *ConcurrencyTypeBindId = "concurrency_type";
+const char *AtomicAccessBindId = "atomic_access";
+const char *BranchMergeBindId = "merged_branch";
 
 bool IncludesManager::handleBeginSource(CompilerInstance &CI,
   StringRef Filename) {
@@ -107,87 +122,200 @@ StatementMatcher makeCStyleCastMatcher() {
   return cStyleCastExpr().bind(CStyleCastBindId);
 }
 
+StatementMatcher makeAssignmentMatcher() {
+  return binaryOperator(anyOf(
+    hasOperatorName("="), hasOperatorName("*="), hasOperatorName("/="),
+    hasOperatorName("%="), hasOperatorName("+="), hasOperatorName("-="),
+    hasOperatorName("<<="), hasOperatorName(">>="), hasOperatorName("&="),
+    hasOperatorName("^="), hasOperatorName("|="))).bind(AssignmentBindId);
+}
+
+StatementMatcher makeCompoundMatcher() {
+  return compoundStmt().bind(CompoundBindId);
+}
+
+StatementMatcher makeArraySubscriptMatcher() {
+  return arraySubscriptExpr().bind(ArraySubscriptBindId);
+}
+
+DeclarationMatcher makeMemoizeMatcher() {
+  return functionDecl().bind(MemoizeBindId);
+}
+
+StatementMatcher makeForLoopMatcher() {
+  return forStmt().bind(LoopSummaryBindId);
+}
+
+StatementMatcher makeWhileLoopMatcher() {
+  return whileStmt().bind(LoopSummaryBindId);
+}
+
+DeclarationMatcher makeConcurrentVarMatcher() {
+  return varDecl().bind(ConcurrencyTypeBindId);
+}
+
+DeclarationMatcher makeConcurrentFieldMatcher() {
+  return fieldDecl().bind(ConcurrencyTypeBindId);
+}
+
+StatementMatcher makeAtomicAccessMatcher() {
+  return memberCallExpr().bind(AtomicAccessBindId);
+}
+
+StatementMatcher makeBranchMergeMatcher() {
+  return ifStmt().bind(BranchMergeBindId);
+}
+
 void instrumentControlFlow(
   const std::string& NseBranchStrategy,
   SourceRange SR,
   SourceManager &SM,
   const LangOptions &LO,
-  tooling::Replacements &R) {
+  NseReplacementBuffer &R) {
 
   CharSourceRange Range = Lexer::makeFileCharRange(
       CharSourceRange::getTokenRange(SR), SM, LO);
 
-  R.insert(tooling::Replacement(SM, Range.getBegin(), 0, NseBranchStrategy + "("));
-  R.insert(tooling::Replacement(SM, Range.getEnd(), 0, ")"));
+  R.insert(SM, Range.getBegin(), 0, NseBranchStrategy + "(");
+  R.insert(SM, Range.getEnd(), 0, ")");
 }
 
-void IfConditionReplacer::run(const MatchFinder::MatchResult &Result) {
-  const Expr *E = Result.Nodes.getNodeAs<Expr>(IfConditionBindId);
-  assert(E && "Bad Callback. No node provided");
+/// True if \p E depends only on concrete data, so that the runtime would
+/// never have to decide between both branches
+static bool isConcreteCondition(
+  const Expr *E,
+  const SymbolicTaintAnalysis &Taint,
+  ASTContext &Context) {
+
+  if (!E->isValueDependent() && E->isEvaluatable(Context))
+    return true;
+
+  return !Taint.isSymbolicExpr(E);
+}
+
+void NseReplacer::run(const MatchFinder::MatchResult &Result) {
+  NseStopwatch Stopwatch;
+  const size_t Size = Replace ? Replace->size() : 0;
 
-  SourceLocation Loc = E->getExprLoc();
+  ++Stats.Matched;
+  replace(Result);
+
+  if (Replace)
+    Stats.Replacements += Replace->size() - Size;
+  Stats.Seconds += Stopwatch.getSeconds();
+}
+
+bool NseReplacer::isInInstrumentedFile(
+  const MatchFinder::MatchResult &Result,
+  SourceLocation Loc) {
+
+  assert(Files && "No file filter set");
   SourceManager &SM = *Result.SourceManager;
-  if (!Result.Context->getSourceManager().isWrittenInMainFile(Loc))
-  {
-    DEBUG(llvm::errs() << "Ignore file: " << SM.getFilename(Loc) << '\n');
+  if (Files->isInstrumented(SM, Loc))
+    return true;
+
+  DEBUG(llvm::errs() << "Ignore file: " << SM.getFilename(Loc) << '\n');
+  ++Stats.NotInMainFile;
+  return false;
+}
+
+bool NseReplacer::isSupported(QualType QT) {
+  if (isSupportedType(QT))
+    return true;
+
+  ++Stats.UnsupportedType;
+  return false;
+}
+
+bool NseReplacer::isSymbolic(const SymbolicTaintAnalysis *Taint,
+  const Decl *D) {
+
+  if (Taint->isSymbolic(D))
+    return true;
+
+  ++Stats.NotSymbolic;
+  return false;
+}
+
+void ConditionReplacer::replaceCondition(
+  const MatchFinder::MatchResult &Result,
+  const Expr *E) {
+
+  SourceManager &SM = *Result.SourceManager;
+  if (!isInInstrumentedFile(Result, E->getExprLoc()))
+    return;
+
+  if (isConcreteCondition(E, *Taint, *Result.Context)) {
+    ++Branches->Pruned;
+    ++Stats.NotSymbolic;
     return;
   }
 
-  SourceRange Range = E->getSourceRange();
-  instrumentControlFlow(NseBranchStrategy, Range, SM,
-    Result.Context->getLangOpts(), *Replace);
+  // a known condition is as concrete as any other once it is folded
+  if (Folder && Folder->isConstant(E, *Result.Context) &&
+      Folder->fold(E, *Taint, *Result.Context, *Replace)) {
+    ++Branches->Pruned;
+    ++Stats.NotSymbolic;
+    return;
+  }
+
+  // no assertion depends on the direction, so it need not fork
+  if (Slice && Slice->isSlicedCondition(E)) {
+    ++Branches->Sliced;
+    instrumentControlFlow(NseSlicedBranchFunctionName, E->getSourceRange(),
+      SM, Result.Context->getLangOpts(), *Replace);
+  } else {
+    ++Branches->Instrumented;
+    instrumentControlFlow(NseBranchStrategy, E->getSourceRange(), SM,
+      Result.Context->getLangOpts(), *Replace);
+  }
+  if (Folder)
+    Folder->fold(E, *Taint, *Result.Context, *Replace);
+}
+
+void IfConditionReplacer::replace(const MatchFinder::MatchResult &Result) {
+  const Expr *E = Result.Nodes.getNodeAs<Expr>(IfConditionBindId);
+  assert(E && "Bad Callback. No node provided");
+
+  if (Merges && Merges->isMergedCondition(E))
+    return;
+
+  replaceCondition(Result, E);
 }
 
-void IfConditionVariableReplacer::run(const MatchFinder::MatchResult &Result) {
+void IfConditionVariableReplacer::replace(const MatchFinder::MatchResult &Result) {
   const Expr *E = Result.Nodes.getNodeAs<Expr>(IfConditionVariableBindId);
 
-  SourceLocation Loc = E->getExprLoc();
-  SourceManager &SM = *Result.SourceManager;
-  if (!Result.Context->getSourceManager().isWrittenInMainFile(Loc))
-  {
-    DEBUG(llvm::errs() << "Ignore file: " << SM.getFilename(Loc) << '\n');
+  if (!isInInstrumentedFile(Result, E->getExprLoc()))
     return;
-  }
 
   assert(0 && "Condition variables are currently not supported");
 }
 
-void ForConditionReplacer::run(const MatchFinder::MatchResult &Result) {
+void ForConditionReplacer::replace(const MatchFinder::MatchResult &Result) {
   const Expr *E = Result.Nodes.getNodeAs<Expr>(ForConditionBindId);
   assert(E && "Bad Callback. No node provided");
 
-  SourceLocation Loc = E->getExprLoc();
-  SourceManager &SM = *Result.SourceManager;
-  if (!Result.Context->getSourceManager().isWrittenInMainFile(Loc))
-  {
-    DEBUG(llvm::errs() << "Ignore file: " << SM.getFilename(Loc) << '\n');
+  if (Loops && Loops->isSummarizedCondition(E))
     return;
-  }
 
-  instrumentControlFlow(NseBranchStrategy, E->getSourceRange(), SM,
-    Result.Context->getLangOpts(), *Replace);
+  replaceCondition(Result, E);
 }
 
-void WhileConditionReplacer::run(const MatchFinder::MatchResult &Result) {
+void WhileConditionReplacer::replace(const MatchFinder::MatchResult &Result) {
   const Expr *E = Result.Nodes.getNodeAs<Expr>(WhileConditionBindId);
   assert(E && "Bad Callback. No node provided");
 
-  SourceLocation Loc = E->getExprLoc();
-  SourceManager &SM = *Result.SourceManager;
-  if (!Result.Context->getSourceManager().isWrittenInMainFile(Loc))
-  {
-    DEBUG(llvm::errs() << "Ignore file: " << SM.getFilename(Loc) << '\n');
+  if (Loops && Loops->isSummarizedCondition(E))
     return;
-  }
 
-  instrumentControlFlow(NseBranchStrategy, E->getSourceRange(), SM,
-    Result.Context->getLangOpts(), *Replace);
+  replaceCondition(Result, E);
 }
 
 // TODO: Fix buffer corruption issue, perhaps use clang-apply-replacements?
 void addNseHeader(
   const FileEntry *File,
-  tooling::Replacements &Replace,
+  NseReplacementBuffer &Replace,
   IncludeDirectives &Includes) {
 
   const tooling::Replacement &IncludeReplace = Includes.addAngledInclude(File, "crv.h");
@@ -203,12 +331,12 @@ void instrumentNamedVarDecl(
   SourceRange SR,
   SourceManager &SM,
   const LangOptions &LO,
-  tooling::Replacements &Replace) {
+  NseReplacementBuffer &Replace) {
 
   CharSourceRange Range = Lexer::makeFileCharRange(
       CharSourceRange::getTokenRange(SR), SM, LO);
 
-  Replace.insert(tooling::Replacement(SM, Range, (NseClassPrefix + TypeName + "> " + VariableName).str()));
+  Replace.insert(SM, Range, (NseClassPrefix + TypeName + "> " + VariableName).str());
 }
 
 void instrumentVarDecl(
@@ -216,14 +344,14 @@ void instrumentVarDecl(
   SourceRange SR,
   SourceManager &SM,
   const LangOptions &LO,
-  tooling::Replacements &Replace) {
+  NseReplacementBuffer &Replace) {
 
   const std::string NseClassSuffix = ">";
   CharSourceRange Range = Lexer::makeFileCharRange(
       CharSourceRange::getTokenRange(SR), SM, LO);
 
-  Replace.insert(tooling::Replacement(SM, Range.getBegin(), 0, NseClassPrefix));
-  Replace.insert(tooling::Replacement(SM, Range.getEnd(), 0, NseClassSuffix));
+  Replace.insert(SM, Range.getBegin(), 0, NseClassPrefix);
+  Replace.insert(SM, Range.getEnd(), 0, NseClassSuffix);
 }
 
 /// Non-void fundamental types, pointers and arrays of fundamental types
@@ -247,74 +375,119 @@ bool isSupportedType(QualType QT) {
   return false;
 }
 
-void LocalVarReplacer::run(const MatchFinder::MatchResult &Result) {
+/// Declares the array \p V of \p D as one variable per element. The text
+/// of the initializers stays, since other replacers may change it.
+static void scalarizeArrayDecl(
+  const DeclStmt *D,
+  const VarDecl *V,
+  ASTContext &Context,
+  NseReplacementBuffer &Replace) {
+
+  SourceManager &SM = Context.getSourceManager();
+  const ConstantArrayType *Array = Context.getAsConstantArrayType(V->getType());
+  const uint64_t Size = Array->getSize().getZExtValue();
+  const std::string Element = NseInternalClassName +
+    Array->getElementType().getAsString() + "> ";
+  const InitListExpr *List = V->hasInit() ?
+    cast<InitListExpr>(V->getInit()) : nullptr;
+
+  SourceLocation Begin = D->getLocStart();
+  const unsigned NumInits = List ? List->getNumInits() : 0;
+  for (unsigned I = 0; I < NumInits; ++I) {
+    CharSourceRange Init = Lexer::makeFileCharRange(
+      CharSourceRange::getTokenRange(List->getInit(I)->getSourceRange()), SM,
+      Context.getLangOpts());
+    Replace.insert(SM,
+      CharSourceRange::getCharRange(Begin, Init.getBegin()),
+      (I ? ", " : Element) + ArrayScalarization::getElementName(V, I) +
+      " = ");
+    Begin = Init.getEnd();
+  }
+
+  // elements without an initializer of their own are zero-initialized
+  std::string Rest;
+  for (uint64_t I = NumInits; I < Size; ++I)
+    Rest += (I ? ", " : Element) + ArrayScalarization::getElementName(V, I) +
+      (List ? " = 0" : "");
+  Replace.insert(SM,
+    CharSourceRange::getCharRange(Begin, D->getLocEnd()), Rest);
+}
+
+void LocalVarReplacer::replace(const MatchFinder::MatchResult &Result) {
   const DeclStmt *D = Result.Nodes.getNodeAs<DeclStmt>(LocalVarBindId);
   assert(D && "Bad Callback. No node provided");
 
   const VarDecl *V = cast<VarDecl>(*D->decl_begin());
 
-  if (!V->hasLocalStorage() || !isSupportedType(V->getType()))
+  if (!V->hasLocalStorage() || !isSupported(V->getType()) ||
+      !isSymbolic(Taint, V))
     return;
 
   SourceLocation Loc = V->getLocation();
   SourceManager &SM = *Result.SourceManager;
-  if (!Result.Context->getSourceManager().isWrittenInMainFile(Loc))
-  {
-    DEBUG(llvm::errs() << "Ignore file: " << SM.getFilename(Loc) << '\n');
+  if (!isInInstrumentedFile(Result, Loc))
+    return;
+
+  if (Arrays && Arrays->isScalarized(V)) {
+    scalarizeArrayDecl(D, V, *Result.Context, *Replace);
     return;
   }
 
   TypeLoc TL = V->getTypeSourceInfo()->getTypeLoc();
+  const char *NseClassName = Shared && Shared->isShared(V) ?
+    NseExternalClassName : NseInternalClassName;
 
   if (V->getType()->isArrayType())
-    instrumentNamedVarDecl(NseInternalClassName, V->getType().getAsString(),
+    instrumentNamedVarDecl(NseClassName, V->getType().getAsString(),
       V->getName(), TL.getSourceRange(), SM, Result.Context->getLangOpts(), *Replace);
   else
-    instrumentVarDecl(NseInternalClassName, TL.getSourceRange(), SM,
+    instrumentVarDecl(NseClassName, TL.getSourceRange(), SM,
       Result.Context->getLangOpts(), *Replace);
 
   //const FileEntry *File = SM.getFileEntryForID(SM.getFileID(TL.getBeginLoc()));
   //addNseHeader(File, *Replace, *IM->Includes);
 }
 
-void GlobalVarReplacer::run(const MatchFinder::MatchResult &Result) {
+void GlobalVarReplacer::replace(const MatchFinder::MatchResult &Result) {
   const VarDecl *V = Result.Nodes.getNodeAs<VarDecl>(GlobalVarBindId);
   assert(V && "Bad Callback. No node provided");
-  if (!V->hasGlobalStorage() || !isSupportedType(V->getType()))
+  if (!V->hasGlobalStorage() || !isSupported(V->getType()) ||
+      !isSymbolic(Taint, V))
     return;
 
   SourceLocation Loc = V->getLocation();
   SourceManager &SM = *Result.SourceManager;
-  if (!Result.Context->getSourceManager().isWrittenInMainFile(Loc))
-  {
-    DEBUG(llvm::errs() << "Ignore file: " << SM.getFilename(Loc) << '\n');
+  if (!isInInstrumentedFile(Result, Loc)) {
+    // instrumented by another translation unit, but still reinitialized
+    if (Files->isUserFile(SM, Loc))
+      GlobalVars.push_back(V);
     return;
   }
 
   GlobalVars.push_back(V);
 
   TypeLoc TL = V->getTypeSourceInfo()->getTypeLoc();
+  const char *NseClassName = Shared && Shared->isShared(V) ?
+    NseExternalClassName : NseInternalClassName;
+
   if (V->getType()->isArrayType())
-    instrumentNamedVarDecl(NseInternalClassName, V->getType().getAsString(),
+    instrumentNamedVarDecl(NseClassName, V->getType().getAsString(),
       V->getName(), TL.getSourceRange(), SM, Result.Context->getLangOpts(), *Replace);
   else
-    instrumentVarDecl(NseInternalClassName, TL.getSourceRange(), SM,
+    instrumentVarDecl(NseClassName, TL.getSourceRange(), SM,
       Result.Context->getLangOpts(), *Replace);
 }
 
-void FieldReplacer::run(const MatchFinder::MatchResult &Result) {
+void FieldReplacer::replace(const MatchFinder::MatchResult &Result) {
   const FieldDecl *V = Result.Nodes.getNodeAs<FieldDecl>(GlobalVarBindId);
   assert(V && "Bad Callback. No node provided");
-  if (!isSupportedType(V->getType()))
+  if (!isSupported(V->getType()) || !isSymbolic(Taint, V))
     return;
 
   SourceLocation Loc = V->getLocation();
   SourceManager &SM = *Result.SourceManager;
-  if (!Result.Context->getSourceManager().isWrittenInMainFile(Loc))
-  {
-    DEBUG(llvm::errs() << "Ignore file: " << SM.getFilename(Loc) << '\n');
+  if (!isInInstrumentedFile(Result, Loc))
     return;
-  }
 
   TypeLoc TL = V->getTypeSourceInfo()->getTypeLoc();
   if (V->getType()->isArrayType())
@@ -325,21 +498,19 @@ void FieldReplacer::run(const MatchFinder::MatchResult &Result) {
       Result.Context->getLangOpts(), *Replace);
 }
 
-void MainFunctionReplacer::run(const MatchFinder::MatchResult &Result) {
+void MainFunctionReplacer::replace(const MatchFinder::MatchResult &Result) {
   const FunctionDecl *D = Result.Nodes.getNodeAs<FunctionDecl>(MainFunctionBindId);
   assert(D && "Bad Callback. No node provided");
   assert(GlobalVars && "GlobalVars is NULL");
 
   SourceManager &SM = *Result.SourceManager;
   SourceLocation Loc = D->getLocation();
-  if (!Result.Context->getSourceManager().isWrittenInMainFile(Loc))
-  {
-    DEBUG(llvm::errs() << "Ignore file: " << SM.getFilename(Loc) << '\n');
+  if (!isInInstrumentedFile(Result, Loc))
     return;
-  }
 
   SourceLocation NameLocBegin = D->getNameInfo().getBeginLoc();
-  Replace->insert(tooling::Replacement(SM, NameLocBegin, 4, "nse_main"));
+  Replace->insert(SM, NameLocBegin, 4, "nse_main");
+  Instrumented = true;
 
   if (!D->hasBody())
     return;
@@ -360,50 +531,26 @@ void MainFunctionReplacer::run(const MatchFinder::MatchResult &Result) {
       MakeInits += NseMakeZero + V->getName().str() + ");\n";
     }
   }
-  Replace->insert(tooling::Replacement(SM, BodyLocBegin, 0, MakeInits));
+  Replace->insert(SM, BodyLocBegin, 0, MakeInits);
 
-  const std::string NseStrategy = NseNamespace + "::" + Strategy + "()";
   SourceLocation BodyEndLoc = FuncBody->getLocEnd().getLocWithOffset(1);
-  Replace->insert(tooling::Replacement(SM, BodyEndLoc, 0,
-    "\n\n"
-    "int main() {\n"
-    "  bool error = false;\n"
-    "  std::chrono::seconds seconds(std::chrono::seconds::zero());\n"
-    "  {\n"
-    "    smt::NonReentrantTimer<std::chrono::seconds> timer(seconds);\n"
-    "\n"
-    "    do {\n"
-    "      nse_main();\n"
-    "      error |= smt::sat == " + NseStrategy + ".check();\n"
-    "    } while (" + NseStrategy + ".find_next_path() && !error);\n"
-    "  }\n"
-    "\n"
-    "  if (error)\n"
-    "    std::cout << \"Found bug!\" << std::endl;\n"
-    "  else\n"
-    "    std::cout << \"Could not find any bugs.\" << std::endl;\n"
-    "\n"
-    "  report_statistics(" + NseStrategy + ".solver().stats(), " + NseStrategy + ".stats(), seconds);\n"
-    "\n"
-    "  return error;\n"
-    "}"));
+  Replace->insert(SM, BodyEndLoc, 0,
+    "\n\n" + HarnessMain);
+  Instrumented = true;
 }
 
 // Passes integral parameters passed by value and other types by reference
-void ParmVarReplacer::run(const MatchFinder::MatchResult &Result) {
+void ParmVarReplacer::replace(const MatchFinder::MatchResult &Result) {
   const ParmVarDecl *V = Result.Nodes.getNodeAs<ParmVarDecl>(ParmVarBindId);
   assert(V && "Bad Callback. No node provided");
 
-  if (!isSupportedType(V->getType()))
+  if (!isSupported(V->getType()) || !isSymbolic(Taint, V))
     return;
 
   SourceLocation Loc = V->getLocation();
   SourceManager &SM = *Result.SourceManager;
-  if (!Result.Context->getSourceManager().isWrittenInMainFile(Loc))
-  {
-    DEBUG(llvm::errs() << "Ignore file: " << SM.getFilename(Loc) << '\n');
+  if (!isInInstrumentedFile(Result, Loc))
     return;
-  }
 
   TypeLoc TL = V->getTypeSourceInfo()->getTypeLoc();
 
@@ -416,20 +563,18 @@ void ParmVarReplacer::run(const MatchFinder::MatchResult &Result) {
       Result.Context->getLangOpts(), *Replace);
 }
 
-void ReturnTypeReplacer::run(const MatchFinder::MatchResult &Result) {
+void ReturnTypeReplacer::replace(const MatchFinder::MatchResult &Result) {
   const FunctionDecl *D = Result.Nodes.getNodeAs<FunctionDecl>(ReturnTypeBindId);
   assert(D && "Bad Callback. No node provided");
 
-  if (D->isMain() || !isSupportedType(D->getReturnType()))
+  if (D->isMain() || !isSupported(D->getReturnType()) ||
+      !isSymbolic(Taint, D))
     return;
 
   SourceLocation Loc = D->getLocation();
   SourceManager &SM = *Result.SourceManager;
-  if (!Result.Context->getSourceManager().isWrittenInMainFile(Loc))
-  {
-    DEBUG(llvm::errs() << "Ignore file: " << SM.getFilename(Loc) << '\n');
+  if (!isInInstrumentedFile(Result, Loc))
     return;
-  }
 
   TypeLoc TL = D->getTypeSourceInfo()->getTypeLoc().
     IgnoreParens().castAs<FunctionProtoTypeLoc>().getReturnLoc();
@@ -438,53 +583,44 @@ void ReturnTypeReplacer::run(const MatchFinder::MatchResult &Result) {
     Result.Context->getLangOpts(), *Replace);
 }
 
-void AssumeReplacer::run(const MatchFinder::MatchResult &Result) {
+void AssumeReplacer::replace(const MatchFinder::MatchResult &Result) {
   const CallExpr *E = Result.Nodes.getNodeAs<CallExpr>(AssumeBindId);
   assert(E && "Bad Callback. No node provided");
 
   SourceManager &SM = *Result.SourceManager;
   SourceLocation LocBegin = E->getCallee()->getExprLoc();
 
-  if (!Result.Context->getSourceManager().isWrittenInMainFile(LocBegin))
-  {
-    DEBUG(llvm::errs() << "Ignore file: " << SM.getFilename(LocBegin) << '\n');
+  if (!isInInstrumentedFile(Result, LocBegin))
     return;
-  }
 
   const std::string NseAssume = NseStrategy + ".add_assertion";
-  Replace->insert(tooling::Replacement(SM, LocBegin, 10, NseAssume));
+  Replace->insert(SM, LocBegin, 10, NseAssume);
 }
 
-void AssertReplacer::run(const MatchFinder::MatchResult &Result) {
+void AssertReplacer::replace(const MatchFinder::MatchResult &Result) {
   const CallExpr *E = Result.Nodes.getNodeAs<CallExpr>(AssertBindId);
   assert(E && "Bad Callback. No node provided");
 
   SourceManager &SM = *Result.SourceManager;
   SourceLocation LocBegin = E->getCallee()->getExprLoc();
 
-  if (!Result.Context->getSourceManager().isWrittenInMainFile(LocBegin))
-  {
-    DEBUG(llvm::errs() << "Ignore file: " << SM.getFilename(LocBegin) << '\n');
+  if (!isInInstrumentedFile(Result, LocBegin))
     return;
-  }
 
   const std::string NseAssert = NseStrategy + ".add_error(!";
-  Replace->insert(tooling::Replacement(SM, LocBegin, 10, NseAssert));
-  Replace->insert(tooling::Replacement(SM, E->getRParenLoc(), 0, ")"));
+  Replace->insert(SM, LocBegin, 10, NseAssert);
+  Replace->insert(SM, E->getRParenLoc(), 0, ")");
 }
 
-void SymbolicReplacer::run(const MatchFinder::MatchResult &Result) {
+void SymbolicReplacer::replace(const MatchFinder::MatchResult &Result) {
   const CallExpr *E = Result.Nodes.getNodeAs<CallExpr>(SymbolicBindId);
   assert(E && "Bad Callback. No node provided");
 
   SourceManager &SM = *Result.SourceManager;
   SourceLocation Loc = E->getCallee()->getExprLoc();
 
-  if (!Result.Context->getSourceManager().isWrittenInMainFile(Loc))
-  {
-    DEBUG(llvm::errs() << "Ignore file: " << SM.getFilename(Loc) << '\n');
+  if (!isInInstrumentedFile(Result, Loc))
     return;
-  }
 
   QualType QT = E->getCallReturnType();
   SourceRange SR = E->getCallee()->getSourceRange();
@@ -492,53 +628,860 @@ void SymbolicReplacer::run(const MatchFinder::MatchResult &Result) {
       CharSourceRange::getTokenRange(SR), SM, Result.Context->getLangOpts());
 
   const std::string NseAny = NseNamespace + "::any<";
-  Replace->insert(tooling::Replacement(SM, Range, NseAny + QT.getAsString() + ">"));
+  Replace->insert(SM, Range, NseAny + QT.getAsString() + ">");
 }
 
-void MakeSymbolicReplacer::run(const MatchFinder::MatchResult &Result) {
+void MakeSymbolicReplacer::replace(const MatchFinder::MatchResult &Result) {
   const CallExpr *E = Result.Nodes.getNodeAs<CallExpr>(MakeSymbolicBindId);
   assert(E && "Bad Callback. No node provided");
 
   SourceManager &SM = *Result.SourceManager;
   SourceLocation Loc = E->getCallee()->getExprLoc();
 
-  if (!Result.Context->getSourceManager().isWrittenInMainFile(Loc))
-  {
-    DEBUG(llvm::errs() << "Ignore file: " << SM.getFilename(Loc) << '\n');
+  if (!isInInstrumentedFile(Result, Loc))
     return;
-  }
 
   SourceRange SR = E->getCallee()->getSourceRange();
   CharSourceRange Range = Lexer::makeFileCharRange(
       CharSourceRange::getTokenRange(SR), SM, Result.Context->getLangOpts());
 
   const std::string NseMakeAny = NseNamespace + "::make_any";
-  Replace->insert(tooling::Replacement(SM, Range, NseMakeAny));
+  Replace->insert(SM, Range, NseMakeAny);
 }
 
-void CStyleCastReplacer::run(const MatchFinder::MatchResult &Result) {
+void CStyleCastReplacer::replace(const MatchFinder::MatchResult &Result) {
   const CStyleCastExpr *E = Result.Nodes.getNodeAs<CStyleCastExpr>(CStyleCastBindId);
   assert(E && "Bad Callback. No node provided");
 
-  SourceManager &SM = *Result.SourceManager;
-  if (!Result.Context->getSourceManager().isWrittenInMainFile(E->getLocStart()))
-  {
-    DEBUG(llvm::errs() << "Ignore file: " << SM.getFilename(E->getLocStart()) << '\n');
+  // casts of concrete values stay native
+  if (!Taint->isSymbolicExpr(E->getSubExpr())) {
+    ++Stats.NotSymbolic;
     return;
   }
 
+  SourceManager &SM = *Result.SourceManager;
+  if (!isInInstrumentedFile(Result, E->getLocStart()))
+    return;
+
   CharSourceRange CR;
   CR.setBegin(E->getLocStart());
   CR.setEnd(E->getLocEnd());
 
-  Replace->insert(tooling::Replacement(SM, CR, NseInternalClassName +
-    E->getTypeAsWritten().getAsString()));
+  Replace->insert(SM, CR, NseInternalClassName +
+    E->getTypeAsWritten().getAsString());
 
   SourceRange SR = E->getSubExpr()->getSourceRange();
 
   CharSourceRange Range = Lexer::makeFileCharRange(
       CharSourceRange::getTokenRange(SR), SM, Result.Context->getLangOpts());
 
-  Replace->insert(tooling::Replacement(SM, Range.getBegin(), 0, ">::cast("));
-  Replace->insert(tooling::Replacement(SM, Range.getEnd(), 0, ")"));
+  Replace->insert(SM, Range.getBegin(), 0, ">::cast(");
+  Replace->insert(SM, Range.getEnd(), 0, ")");
+}
+
+void AssignmentFoldReplacer::replace(const MatchFinder::MatchResult &Result) {
+  const BinaryOperator *E = Result.Nodes.getNodeAs<BinaryOperator>(AssignmentBindId);
+  assert(E && "Bad Callback. No node provided");
+
+  if (!isInInstrumentedFile(Result, E->getOperatorLoc()))
+    return;
+
+  // values assigned to native variables stay native anyway
+  if (!Taint->isSymbolicExpr(E->getLHS())) {
+    ++Stats.NotSymbolic;
+    return;
+  }
+
+  Folder->fold(E->getRHS(), *Taint, *Result.Context, *Replace);
+}
+
+/// The variable that the expression statement \p E assigns, increments or
+/// decrements, if any
+static const VarDecl *getWrittenVar(const Expr *E) {
+  const Expr *Target = nullptr;
+  if (const BinaryOperator *B = dyn_cast<BinaryOperator>(E)) {
+    if (B->isAssignmentOp())
+      Target = B->getLHS();
+  } else if (const UnaryOperator *U = dyn_cast<UnaryOperator>(E)) {
+    if (U->isIncrementDecrementOp())
+      Target = U->getSubExpr();
+  }
+
+  const DeclRefExpr *Ref = Target ?
+    dyn_cast<DeclRefExpr>(Target->IgnoreParens()) : nullptr;
+  return Ref ? dyn_cast<VarDecl>(Ref->getDecl()) : nullptr;
+}
+
+void RangeAssumptionReplacer::replace(const MatchFinder::MatchResult &Result) {
+  const CompoundStmt *S = Result.Nodes.getNodeAs<CompoundStmt>(CompoundBindId);
+  assert(S && "Bad Callback. No node provided");
+
+  if (!isInInstrumentedFile(Result, S->getLBracLoc()))
+    return;
+
+  SourceManager &SM = *Result.SourceManager;
+  const LangOptions &LO = Result.Context->getLangOpts();
+  for (CompoundStmt::const_body_iterator I = S->body_begin(),
+       End = S->body_end(); I != End; ++I) {
+    const VarDecl *V = nullptr;
+    SourceLocation Loc;
+    if (const DeclStmt *D = dyn_cast<DeclStmt>(*I)) {
+      if (D->isSingleDecl())
+        V = dyn_cast<VarDecl>(D->getSingleDecl());
+      if (!V || !V->hasInit())
+        continue;
+      Loc = Lexer::getLocForEndOfToken(D->getLocEnd(), 0, SM, LO);
+    } else if (const Expr *E = dyn_cast<Expr>(*I)) {
+      V = getWrittenVar(E);
+      if (!V)
+        continue;
+      Loc = Lexer::findLocationAfterToken(E->getLocEnd(), tok::semi, SM, LO,
+        /*SkipTrailingWhitespaceAndNewLine=*/false);
+    } else {
+      continue;
+    }
+
+    // parameters are never bounded, so only locals are left
+    ValueRange Range, TypeRange;
+    if (Loc.isInvalid() || Loc.isMacroID() || !V->hasLocalStorage() ||
+        !isSymbolic(Taint, V) || !Ranges->getRange(V, Range) ||
+        !ValueRangeAnalysis::getTypeRange(V->getType(), *Result.Context,
+          TypeRange))
+      continue;
+
+    // bounds of the type itself would only add work for the solver
+    const std::string Name = V->getName().str();
+    std::string Bounds;
+    if (Range.Min > TypeRange.Min)
+      Bounds = std::to_string(Range.Min) + " <= " + Name;
+    if (Range.Max < TypeRange.Max)
+      Bounds += (Bounds.empty() ? "" : " && ") + Name + " <= " +
+        std::to_string(Range.Max);
+
+    Replace->insert(SM, Loc, 0,
+      " " + NseStrategy + ".add_assertion(" + Bounds + ");");
+  }
+}
+
+void ArrayElementReplacer::replace(const MatchFinder::MatchResult &Result) {
+  const ArraySubscriptExpr *E =
+    Result.Nodes.getNodeAs<ArraySubscriptExpr>(ArraySubscriptBindId);
+  assert(E && "Bad Callback. No node provided");
+
+  // must agree with LocalVarReplacer on which arrays are scalarized
+  uint64_t Index = 0;
+  const VarDecl *V = Arrays->getElement(E, Index);
+  if (!V || !isSupported(V->getType()) || !isSymbolic(Taint, V))
+    return;
+
+  SourceManager &SM = *Result.SourceManager;
+  if (!isInInstrumentedFile(Result, V->getLocation()))
+    return;
+
+  CharSourceRange Range = Lexer::makeFileCharRange(
+      CharSourceRange::getTokenRange(E->getSourceRange()), SM,
+      Result.Context->getLangOpts());
+  Replace->insert(SM, Range,
+    ArrayScalarization::getElementName(V, Index));
+}
+
+void MemoizeReplacer::replace(const MatchFinder::MatchResult &Result) {
+  const FunctionDecl *D = Result.Nodes.getNodeAs<FunctionDecl>(MemoizeBindId);
+  assert(D && "Bad Callback. No node provided");
+
+  if (!D->getIdentifier() || !D->doesThisDeclarationHaveABody() ||
+      !Purity->isPure(D))
+    return;
+
+  // the lambda refers to the parameters by name, and a function that is not
+  // instrumented builds no expressions worth caching
+  bool Symbolic = Taint->isSymbolic(D);
+  std::string Args;
+  for (const ParmVarDecl *P : D->params()) {
+    if (P->getName().empty())
+      return;
+
+    Symbolic |= Taint->isSymbolic(P);
+    Args += (Args.empty() ? "" : ", ") + P->getName().str();
+  }
+
+  if (!Symbolic) {
+    ++Stats.NotSymbolic;
+    return;
+  }
+
+  const CompoundStmt *Body = dyn_cast<CompoundStmt>(D->getBody());
+  if (!Body || Body->getLBracLoc().isMacroID() ||
+      Body->getRBracLoc().isMacroID())
+    return;
+
+  SourceManager &SM = *Result.SourceManager;
+  if (!isInInstrumentedFile(Result, D->getLocation()))
+    return;
+
+  // decltype() names the return type after ReturnTypeReplacer changed it
+  Replace->insert(SM,
+    Body->getLBracLoc().getLocWithOffset(1), 0,
+    " return nse_memoize([&]() -> decltype(" + D->getName().str() + "(" +
+    Args + ")) {");
+  Replace->insert(SM, Body->getRBracLoc(), 0,
+    "}" + (Args.empty() ? std::string() : ", " + Args) + "); ");
+  Instrumented = true;
+}
+
+/// Text of \p E as written in the file
+static std::string getSourceText(const Expr *E, SourceManager &SM,
+  const LangOptions &LO) {
+
+  return Lexer::getSourceText(Lexer::makeFileCharRange(
+    CharSourceRange::getTokenRange(E->getSourceRange()), SM, LO), SM, LO)
+    .str();
+}
+
+void LoopSummaryReplacer::replace(const MatchFinder::MatchResult &Result) {
+  const Stmt *S = Result.Nodes.getNodeAs<Stmt>(LoopSummaryBindId);
+  assert(S && "Bad Callback. No node provided");
+
+  const LoopSummary *Summary = Loops->getSummary(S);
+  if (!Summary)
+    return;
+
+  SourceManager &SM = *Result.SourceManager;
+  const LangOptions &LO = Result.Context->getLangOpts();
+  if (!isInInstrumentedFile(Result, S->getLocStart()))
+    return;
+
+  CharSourceRange Range = Lexer::makeFileCharRange(
+    CharSourceRange::getTokenRange(S->getSourceRange()), SM, LO);
+  if (Range.isInvalid())
+    return;
+
+  // the range of a body without braces stops short of its semicolon
+  SourceLocation End = Range.getEnd();
+  if (const ForStmt *For = dyn_cast<ForStmt>(S))
+    if (!isa<CompoundStmt>(For->getBody()) && !isa<NullStmt>(For->getBody())) {
+      End = Lexer::findLocationAfterToken(For->getLocEnd(), tok::semi, SM, LO,
+        false);
+      if (End.isInvalid())
+        return;
+    }
+
+  const std::string Index = Summary->Index->getName().str();
+  const std::string Bound = "(" + getSourceText(Summary->Bound, SM, LO) + ")";
+  const std::string Trips = Summary->Increasing ?
+    "(" + Bound + " - " + Index + ")" : "(" + Index + " - " + Bound + ")";
+
+  std::string Condition = Index + (Summary->Increasing ? " < " : " > ") +
+    Bound;
+  if (Taint->isSymbolicExpr(Summary->Condition)) {
+    ++Branches->Instrumented;
+    Condition = NseBranchStrategy + "(" + Condition + ")";
+  } else {
+    ++Branches->Pruned;
+  }
+
+  std::string Text = "{ ";
+  if (Summary->DeclaresIndex) {
+    const std::string Type = Summary->Index->getType().getAsString();
+    Text += (Taint->isSymbolic(Summary->Index) ?
+      NseInternalClassName + Type + ">" : Type) + " ";
+  }
+  if (Summary->Init)
+    Text += Index + " = " + getSourceText(Summary->Init, SM, LO) + "; ";
+
+  // every update reads the index before it is set to the bound
+  Text += "if (" + Condition + ") {";
+  for (const LoopSummary::Update &Update : Summary->Updates)
+    Text += " " + Update.Var->getName().str() +
+      (Update.Add ? " += " : " -= ") + Trips +
+      (Update.Step ? " * (" + getSourceText(Update.Step, SM, LO) + ")" : "") +
+      ";";
+  if (!Summary->DeclaresIndex)
+    Text += " " + Index + " = " + Bound + ";";
+  Text += " } }";
+
+  Replace->replaceExclusively(SM,
+    CharSourceRange::getCharRange(Range.getBegin(), End), Text);
+}
+
+/// The class that the std::atomic \p V is declared with, if any: External
+/// if threads share it, Internal if only one thread accesses it but it is
+/// symbolic. \p ValueType is set to the type of its value.
+static const char *getAtomicClassName(
+  const VarDecl *V,
+  const SymbolicTaintAnalysis *Taint,
+  const SharedAccessAnalysis *Shared,
+  QualType &ValueType) {
+
+  if (!Shared->isRewritableAtomic(V))
+    return nullptr;
+
+  const ClassTemplateSpecializationDecl *S =
+    dyn_cast_or_null<ClassTemplateSpecializationDecl>(
+      V->getType()->getAsCXXRecordDecl());
+  if (!S || S->getTemplateArgs().size() != 1 ||
+      S->getTemplateArgs()[0].getKind() != TemplateArgument::Type)
+    return nullptr;
+
+  ValueType = S->getTemplateArgs()[0].getAsType();
+  if (!ValueType->isIntegralOrEnumerationType() &&
+      !ValueType->isPointerType())
+    return nullptr;
+
+  if (Shared->isShared(V))
+    return NseExternalClassName;
+  return Taint->isSymbolic(V) ? NseInternalClassName : nullptr;
+}
+
+void ConcurrentTypeReplacer::replace(const MatchFinder::MatchResult &Result) {
+  const DeclaratorDecl *D =
+    Result.Nodes.getNodeAs<DeclaratorDecl>(ConcurrencyTypeBindId);
+  assert(D && "Bad Callback. No node provided");
+
+  // only the type as it is written can be replaced
+  if (!D->getTypeSourceInfo() || D->getType()->getContainedAutoType())
+    return;
+
+  TypeLoc TL = D->getTypeSourceInfo()->getTypeLoc();
+  if (ReferenceTypeLoc Ref = TL.getAs<ReferenceTypeLoc>())
+    TL = Ref.getPointeeLoc();
+  TL = TL.getUnqualifiedLoc();
+
+  const QualType T = D->getType().getNonReferenceType();
+  std::string Text;
+  if (isStdClass(T, "thread")) {
+    Text = NseNamespace + "::Thread";
+  } else if (isStdClass(T, "mutex")) {
+    Text = NseNamespace + "::Mutex";
+  } else if (isStdClass(T, "lock_guard") || isStdClass(T, "unique_lock")) {
+    Text = "std::" + T->getAsCXXRecordDecl()->getName().str() + "<" +
+      NseNamespace + "::Mutex>";
+  } else if (isStdClass(T, "atomic")) {
+    // parameters are passed by reference, so their type must not change
+    const VarDecl *V = dyn_cast<VarDecl>(D);
+    QualType ValueType;
+    const char *NseClassName = V && !isa<ParmVarDecl>(V) ?
+      getAtomicClassName(V, Taint, Shared, ValueType) : nullptr;
+    if (!NseClassName) {
+      ++Stats.NotSymbolic;
+      return;
+    }
+    Text = NseClassName + ValueType.getAsString() + ">";
+  } else {
+    return;
+  }
+
+  SourceManager &SM = *Result.SourceManager;
+  if (!isInInstrumentedFile(Result, D->getLocation()))
+    return;
+
+  CharSourceRange Range = Lexer::makeFileCharRange(
+    CharSourceRange::getTokenRange(TL.getSourceRange()), SM,
+    Result.Context->getLangOpts());
+  if (Range.isInvalid())
+    return;
+
+  Replace->insert(SM, Range, Text);
+}
+
+void AtomicAccessReplacer::replace(const MatchFinder::MatchResult &Result) {
+  const CXXMemberCallExpr *E =
+    Result.Nodes.getNodeAs<CXXMemberCallExpr>(AtomicAccessBindId);
+  assert(E && "Bad Callback. No node provided");
+
+  // operators and conversions work on the runtime classes as they are
+  const CXXMethodDecl *Method = E->getMethodDecl();
+  if (!Method || !Method->getIdentifier() ||
+      (Method->getName() != "load" && Method->getName() != "store"))
+    return;
+
+  const Expr *Object = E->getImplicitObjectArgument();
+  const DeclRefExpr *Ref = Object ?
+    dyn_cast<DeclRefExpr>(Object->IgnoreParenImpCasts()) : nullptr;
+  const VarDecl *V = Ref ? dyn_cast<VarDecl>(Ref->getDecl()) : nullptr;
+  if (!V || !isStdClass(V->getType(), "atomic"))
+    return;
+
+  // must agree with ConcurrentTypeReplacer on which atomics are rewritten
+  QualType ValueType;
+  if (!getAtomicClassName(V, Taint, Shared, ValueType)) {
+    ++Stats.NotSymbolic;
+    return;
+  }
+
+  SourceManager &SM = *Result.SourceManager;
+  const LangOptions &LO = Result.Context->getLangOpts();
+  if (!isInInstrumentedFile(Result, E->getExprLoc()))
+    return;
+
+  CharSourceRange Range = Lexer::makeFileCharRange(
+    CharSourceRange::getTokenRange(E->getSourceRange()), SM, LO);
+  if (Range.isInvalid())
+    return;
+
+  // the runtime only interleaves sequentially consistent accesses, so a
+  // weaker order is dropped, and so are the behaviors only it allows
+  const unsigned OrderArg = Method->getName() == "load" ? 0 : 1;
+  if (OrderArg < E->getNumArgs() &&
+      !isa<CXXDefaultArgExpr>(E->getArg(OrderArg))) {
+    const Expr *Order = E->getArg(OrderArg);
+    const DeclRefExpr *OrderRef =
+      dyn_cast<DeclRefExpr>(Order->IgnoreParenImpCasts());
+    if (!OrderRef || !OrderRef->getDecl()->getIdentifier() ||
+        OrderRef->getDecl()->getName() != "memory_order_seq_cst") {
+      DiagnosticsEngine &Diags = Result.Context->getDiagnostics();
+      const unsigned ID = Diags.getCustomDiagID(DiagnosticsEngine::Warning,
+        "memory order of %0() is treated as memory_order_seq_cst");
+      Diags.Report(Order->getExprLoc(), ID) << Method->getName();
+    }
+  }
+
+  const std::string Name = V->getName().str();
+  if (Method->getName() == "load" || E->getNumArgs() == 0) {
+    Replace->insert(SM, Range, Name);
+    return;
+  }
+
+  CharSourceRange Value = Lexer::makeFileCharRange(
+    CharSourceRange::getTokenRange(E->getArg(0)->getSourceRange()), SM, LO);
+  if (Value.isInvalid())
+    return;
+
+  Replace->insert(SM,
+    CharSourceRange::getCharRange(Range.getBegin(), Value.getBegin()),
+    "(" + Name + " = (");
+  Replace->insert(SM,
+    CharSourceRange::getCharRange(Value.getEnd(), Range.getEnd()), "))");
+}
+
+void BranchMergeReplacer::replace(const MatchFinder::MatchResult &Result) {
+  const IfStmt *S = Result.Nodes.getNodeAs<IfStmt>(BranchMergeBindId);
+  assert(S && "Bad Callback. No node provided");
+
+  const BranchMerge *Merge = Merges->getMerge(S);
+  if (!Merge)
+    return;
+
+  SourceManager &SM = *Result.SourceManager;
+  const LangOptions &LO = Result.Context->getLangOpts();
+  if (!isInInstrumentedFile(Result, S->getLocStart()))
+    return;
+
+  CharSourceRange Range = Lexer::makeFileCharRange(
+    CharSourceRange::getTokenRange(S->getSourceRange()), SM, LO);
+  if (Range.isInvalid())
+    return;
+
+  // the range of an else branch without braces stops short of its semicolon
+  SourceLocation End = Range.getEnd();
+  if (!isa<CompoundStmt>(S->getElse())) {
+    End = Lexer::findLocationAfterToken(S->getLocEnd(), tok::semi, SM, LO,
+      false);
+    if (End.isInvalid())
+      return;
+  }
+
+  // none of the values reads an assigned variable, so the order is free
+  const std::string NseIte = NseNamespace + "::ite(";
+  const std::string Condition = getSourceText(Merge->Condition, SM, LO);
+  std::string Text = "{";
+  for (const BranchMerge::Assignment &Assignment : Merge->Assignments) {
+    const std::string Name = Assignment.Var->getName().str();
+    Text += " " + Name + " = " + NseIte + Condition + ", " +
+      (Assignment.Then ? getSourceText(Assignment.Then, SM, LO) : Name) +
+      ", " +
+      (Assignment.Else ? getSourceText(Assignment.Else, SM, LO) : Name) +
+      ");";
+  }
+  Text += " }";
+
+  Replace->replaceExclusively(SM,
+    CharSourceRange::getCharRange(Range.getBegin(), End), Text);
+  ++Branches->Merged;
+}
+
+std::string NseOptions::getKey() const {
+  std::string Key = NseNamespace + '\0' + NseBranch + '\0' + Strategy;
+  Key += '\0';
+  Key += WrapAll ? "wrap-all" : "taint";
+
+  // both engines produce the same replacements, but parsing alone does not
+  if (Engine == ParseOnlyEngine) {
+    Key += '\0';
+    Key += "parse-only";
+  }
+
+  if (Headers) {
+    Key += '\0';
+    Key += "headers";
+  }
+
+  if (FoldConstants) {
+    Key += '\0';
+    Key += "fold-constants";
+  }
+
+  if (RangeAnalysis) {
+    Key += '\0';
+    Key += "range-analysis";
+  }
+
+  if (ScalarizeArrays) {
+    Key += '\0';
+    Key += "scalarize-arrays";
+  }
+
+  if (SummarizeLoops) {
+    Key += '\0';
+    Key += "summarize-loops";
+  }
+
+  if (Concurrent) {
+    Key += '\0';
+    Key += "concurrent";
+  }
+
+  if (MergeBranches) {
+    Key += '\0';
+    Key += "merge-branches";
+  }
+
+  Key += '\0';
+  Key += std::to_string(Harness.Kind) + '\0' + std::to_string(Harness.Jobs) +
+    '\0' + std::to_string(Harness.SplitDepth) + '\0' +
+    std::to_string(Harness.MaxSnapshots);
+  if (Harness.Memoize) {
+    Key += '\0';
+    Key += "memoize";
+  }
+  if (Harness.Slice) {
+    Key += '\0';
+    Key += "slice";
+  }
+  return Key;
+}
+
+NseInstrumenter::NseInstrumenter(
+  const NseOptions &Options,
+  tooling::Replacements *Replace,
+  NseHeaderRegistry *Registry)
+    : Options(Options),
+      Replace(Replace),
+      Buffer(),
+      NseStrategy(Options.NseNamespace + "::" + Options.Strategy + "()"),
+      NseBranchStrategy(getHarnessBranchFunction(NseStrategy,
+        Options.NseBranch, Options.Harness)),
+      NseHarnessPrologue(makeHarnessPrologue(NseStrategy, Options.NseBranch,
+        Options.Harness)),
+      NseHarnessMain(makeHarnessMain(NseStrategy, Options.Harness)),
+      OwnRegistry(Options.Headers && !Registry ? new NseHeaderRegistry()
+        : nullptr),
+      Files(Options.Headers ? (Registry ? Registry : OwnRegistry.get())
+        : nullptr),
+      Taint(Options.WrapAll, Options.Headers),
+      Folder(),
+      Ranges(),
+      Arrays(),
+      Purity(),
+      Loops(),
+      Shared(),
+      Merges(),
+      Slice(),
+      Branches(),
+      IM(),
+      IfStmts(NseBranchStrategy, &Taint,
+        Options.FoldConstants ? &Folder : nullptr,
+        Options.MergeBranches ? &Merges : nullptr,
+        Options.Harness.Slice ? &Slice : nullptr, &Branches, &Buffer),
+      IfConditionVariableStmts(),
+      ForStmts(NseBranchStrategy, &Taint,
+        Options.FoldConstants ? &Folder : nullptr,
+        Options.SummarizeLoops ? &Loops : nullptr,
+        Options.Harness.Slice ? &Slice : nullptr, &Branches, &Buffer),
+      WhileStmts(NseBranchStrategy, &Taint,
+        Options.FoldConstants ? &Folder : nullptr,
+        Options.SummarizeLoops ? &Loops : nullptr,
+        Options.Harness.Slice ? &Slice : nullptr, &Branches, &Buffer),
+      LocalVarDecls(&Taint, Options.ScalarizeArrays ? &Arrays : nullptr,
+        Options.Concurrent ? &Shared : nullptr, &Buffer),
+      GlobalVarDecls(&Taint, Options.Concurrent ? &Shared : nullptr, &Buffer),
+      FieldDecls(&Taint, &Buffer),
+      MainFunction(this->Options.NseNamespace, NseHarnessMain,
+        &Buffer, &GlobalVarDecls.GlobalVars, &IM),
+      ParmVarDecls(&Taint, &Buffer),
+      ReturnTypes(&Taint, &Buffer),
+      Assumptions(NseStrategy, &Buffer),
+      Assertions(NseStrategy, &Buffer),
+      Symbolics(this->Options.NseNamespace, &Buffer),
+      MakeSymbolics(this->Options.NseNamespace, &Buffer),
+      CStyleCasts(this->Options.NseNamespace, &Taint, &Buffer),
+      Assignments(&Taint, &Folder, &Buffer),
+      RangeAssumptions(NseStrategy, &Taint, &Ranges, &Buffer),
+      ArrayElements(&Taint, &Arrays, &Buffer),
+      MemoizedFunctions(&Taint, &Purity, &Buffer),
+      ForLoops(NseBranchStrategy, &Taint, &Loops, &Branches, &Buffer),
+      WhileLoops(NseBranchStrategy, &Taint, &Loops, &Branches, &Buffer),
+      ConcurrentVars(this->Options.NseNamespace, &Taint, &Shared, &Buffer),
+      ConcurrentFields(this->Options.NseNamespace, &Taint, &Shared, &Buffer),
+      AtomicAccesses(&Taint, &Shared, &Buffer),
+      MergedBranches(this->Options.NseNamespace, &Merges, &Branches, &Buffer),
+      Finder(),
+      NodeFinders(),
+      Matchers(),
+      ParseStopwatch(),
+      FileStats() {
+
+  NodeFinders.Profile = Options.Stats;
+
+  addMatcher(makeIfConditionMatcher(), NodeFinders.IfStmts, &IfStmts);
+  addMatcher(makeIfConditionVariableMatcher(), NodeFinders.IfStmts,
+    &IfConditionVariableStmts);
+  addMatcher(makeForConditionMatcher(), NodeFinders.ForStmts, &ForStmts);
+  addMatcher(makeWhileConditionMatcher(), NodeFinders.WhileStmts, &WhileStmts);
+  addMatcher(makeLocalVarMatcher(), NodeFinders.DeclStmts, &LocalVarDecls);
+  addMatcher(makeGlobalVarMatcher(), NodeFinders.VarDecls, &GlobalVarDecls);
+  addMatcher(makeFieldMatcher(), NodeFinders.FieldDecls, &FieldDecls);
+
+  // requires GlobalVarDecls to run first, so order matters
+  addMatcher(makeMainFunctionMatcher(), NodeFinders.FunctionDecls,
+    &MainFunction);
+  addMatcher(makeParmVarDeclMatcher(), NodeFinders.ParmVarDecls,
+    &ParmVarDecls);
+  addMatcher(makeReturnTypeMatcher(), NodeFinders.FunctionDecls, &ReturnTypes);
+  addMatcher(makeAssumeMatcher(), NodeFinders.CallExprs, &Assumptions);
+  addMatcher(makeAssertMatcher(), NodeFinders.CallExprs, &Assertions);
+  addMatcher(makeSymbolicMatcher(), NodeFinders.CallExprs, &Symbolics);
+  addMatcher(makeMakeSymbolicMatcher(), NodeFinders.CallExprs, &MakeSymbolics);
+  addMatcher(makeCStyleCastMatcher(), NodeFinders.CStyleCastExprs,
+    &CStyleCasts);
+
+  if (Options.FoldConstants)
+    addMatcher(makeAssignmentMatcher(), NodeFinders.BinaryOperators,
+      &Assignments);
+  if (Options.RangeAnalysis)
+    addMatcher(makeCompoundMatcher(), NodeFinders.CompoundStmts,
+      &RangeAssumptions);
+  if (Options.ScalarizeArrays)
+    addMatcher(makeArraySubscriptMatcher(), NodeFinders.ArraySubscriptExprs,
+      &ArrayElements);
+  if (Options.Harness.Memoize)
+    addMatcher(makeMemoizeMatcher(), NodeFinders.FunctionDecls,
+      &MemoizedFunctions);
+  if (Options.SummarizeLoops) {
+    addMatcher(makeForLoopMatcher(), NodeFinders.ForStmts, &ForLoops);
+    addMatcher(makeWhileLoopMatcher(), NodeFinders.WhileStmts, &WhileLoops);
+  }
+  if (Options.Concurrent) {
+    addMatcher(makeConcurrentVarMatcher(), NodeFinders.VarDecls,
+      &ConcurrentVars);
+    addMatcher(makeConcurrentFieldMatcher(), NodeFinders.FieldDecls,
+      &ConcurrentFields);
+    addMatcher(makeAtomicAccessMatcher(), NodeFinders.CallExprs,
+      &AtomicAccesses);
+  }
+  if (Options.MergeBranches)
+    addMatcher(makeBranchMergeMatcher(), NodeFinders.IfStmts,
+      &MergedBranches);
+}
+
+template <typename MatcherT>
+void NseInstrumenter::addMatcher(
+  const MatcherT &NodeMatch,
+  NseNodeFinder &NodeFinder,
+  NseReplacer *Callback) {
+
+  Callback->setFileFilter(&Files);
+  Finder.addMatcher(NodeMatch, Callback);
+  NodeFinder.Finder.addMatcher(NodeMatch, Callback);
+
+  NodeFinder.Matchers.emplace_back(new NseNodeMatcher(Callback));
+  NodeFinder.Matchers.back()->Finder.addMatcher(NodeMatch, Callback);
+  Matchers.push_back(NodeFinder.Matchers.back().get());
+}
+
+namespace {
+
+class NseASTConsumer : public ASTConsumer {
+public :
+  NseASTConsumer(NseInstrumenter &Instrumenter)
+      : Instrumenter(Instrumenter) {}
+
+  virtual void HandleTranslationUnit(ASTContext &Context) override {
+    Instrumenter.instrumentAST(Context);
+  }
+
+private:
+  NseInstrumenter &Instrumenter;
+};
+
+class NseFrontendAction : public ASTFrontendAction {
+public :
+  NseFrontendAction(NseInstrumenter &Instrumenter)
+      : Instrumenter(Instrumenter) {}
+
+protected:
+  virtual ASTConsumer *CreateASTConsumer(CompilerInstance &CI,
+      StringRef InFile) override {
+    return new NseASTConsumer(Instrumenter);
+  }
+
+  virtual bool BeginSourceFileAction(CompilerInstance &CI,
+      StringRef Filename) override {
+    return Instrumenter.handleBeginSource(CI, Filename);
+  }
+
+private:
+  NseInstrumenter &Instrumenter;
+};
+
+class NseFrontendActionFactory : public tooling::FrontendActionFactory {
+public :
+  NseFrontendActionFactory(NseInstrumenter &Instrumenter)
+      : Instrumenter(Instrumenter) {}
+
+  virtual FrontendAction *create() override {
+    return new NseFrontendAction(Instrumenter);
+  }
+
+private:
+  NseInstrumenter &Instrumenter;
+};
+
+} // end anonymous namespace
+
+std::unique_ptr<tooling::FrontendActionFactory>
+NseInstrumenter::newFrontendActionFactory() {
+  return std::unique_ptr<tooling::FrontendActionFactory>(
+    new NseFrontendActionFactory(*this));
+}
+
+void NseInstrumenter::beginSource() {
+  // global variables of previous translation units must not leak into
+  // the nse_main() initializers of this one
+  GlobalVarDecls.GlobalVars.clear();
+  ParseStopwatch = NseStopwatch();
+  Files.reset();
+}
+
+bool NseInstrumenter::handleBeginSource(CompilerInstance &CI,
+  StringRef Filename) {
+
+  beginSource();
+  return IM.handleBeginSource(CI, Filename);
+}
+
+void NseInstrumenter::instrumentUnit(ASTContext &Context) {
+  beginSource();
+  instrumentAST(Context);
+}
+
+void NseInstrumenter::instrumentAST(ASTContext &Context) {
+  const double ParseSeconds = ParseStopwatch.getSeconds();
+  const size_t Size = Replace->size();
+  for (NseNodeMatcher *Matcher : Matchers) {
+    Matcher->Replacer->resetStats();
+    Matcher->Seconds = 0;
+  }
+
+  NseStopwatch MatchStopwatch;
+  Branches = BranchStats();
+  MainFunction.Instrumented = false;
+  MemoizedFunctions.Instrumented = false;
+  Taint.analyze(Context);
+  if (Options.FoldConstants)
+    Folder.analyze(Context);
+  if (Options.RangeAnalysis)
+    Ranges.analyze(Context);
+  if (Options.ScalarizeArrays)
+    Arrays.analyze(Context);
+  if (Options.Harness.Memoize)
+    Purity.analyze(Context);
+  if (Options.SummarizeLoops)
+    Loops.analyze(Context, Taint);
+  if (Options.Concurrent)
+    Shared.analyze(Context);
+  if (Options.MergeBranches)
+    Merges.analyze(Context, Taint);
+  if (Options.Harness.Slice)
+    Slice.analyze(Context);
+
+  switch (Options.Engine) {
+  case MatcherEngine:
+    Finder.matchAST(Context);
+    break;
+  case TraversalEngine:
+    traverseMainFile(Context, NodeFinders, Files);
+    break;
+  case ParseOnlyEngine:
+    break;
+  }
+
+  // every translation unit that calls the harness must see its definitions,
+  // including those whose headers were instrumented by another one
+  if (!NseHarnessPrologue.empty() && (Options.Headers ||
+      Branches.Instrumented > 0 || Branches.Sliced > 0 ||
+      MainFunction.Instrumented ||
+      MemoizedFunctions.Instrumented)) {
+    const SourceManager &SM = Context.getSourceManager();
+    Buffer.insert(SM,
+      SM.getLocForStartOfFile(SM.getMainFileID()), 0, NseHarnessPrologue);
+  }
+
+  // overlaps are left to removeConflicts(), like those between translation
+  // units
+  const unsigned Overlaps = Buffer.flush(*Replace);
+  (void)Overlaps;
+  DEBUG(llvm::dbgs() << "NseInstrumenter: " << Overlaps
+                     << " overlapping replacements\n");
+
+  if (Options.Stats)
+    addFileStats(Context, ParseSeconds, MatchStopwatch.getSeconds(),
+      Replace->size() - Size);
+
+  if (Options.BranchReport) {
+    const SourceManager &SM = Context.getSourceManager();
+    const FileEntry *File = SM.getFileEntryForID(SM.getMainFileID());
+
+    // a single write keeps the lines of parallel workers apart
+    std::string Report;
+    llvm::raw_string_ostream OS(Report);
+    OS << (File ? File->getName() : "<unknown>") << ": "
+       << Branches.Instrumented << " branches instrumented, "
+       << Branches.Pruned << " pruned as concrete";
+    if (Options.MergeBranches)
+      OS << ", " << Branches.Merged << " merged";
+    if (Options.Harness.Slice)
+      OS << ", " << Branches.Sliced << " sliced";
+    OS << '\n';
+    llvm::errs() << OS.str();
+  }
+}
+
+void NseInstrumenter::addFileStats(
+  ASTContext &Context,
+  double ParseSeconds,
+  double MatchSeconds,
+  size_t Replacements) {
+
+  const SourceManager &SM = Context.getSourceManager();
+  const FileEntry *File = SM.getFileEntryForID(SM.getMainFileID());
+
+  NseFileStats Stats;
+  Stats.File = File ? File->getName() : "<unknown>";
+  Stats.ParseSeconds = ParseSeconds;
+  Stats.MatchSeconds = MatchSeconds;
+  Stats.Replacements = Replacements;
+
+  for (const NseNodeMatcher *Matcher : Matchers) {
+    MatcherStats M;
+    M.Name = Matcher->Replacer->getName();
+    M.Replacer = Matcher->Replacer->getStats();
+
+    // MatchFinder cannot be profiled, only the traversal engine can
+    if (Options.Engine == TraversalEngine)
+      M.MatchSeconds = std::max(0.0, Matcher->Seconds - M.Replacer.Seconds);
+    Stats.Matchers.push_back(M);
+  }
+
+  FileStats.push_back(Stats);
 }
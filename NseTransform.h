@@ -5,7 +5,21 @@
 #include "clang/ASTMatchers/ASTMatchFinder.h"
 #include "clang/Tooling/Refactoring.h"
 #include "IncludeDirectives.h"
-
+#include "NseFileFilter.h"
+#include "NseFold.h"
+#include "NseHarness.h"
+#include "NseLoopSummary.h"
+#include "NseMerge.h"
+#include "NsePurity.h"
+#include "NseRange.h"
+#include "NseReplacementBuffer.h"
+#include "NseScalarize.h"
+#include "NseShared.h"
+#include "NseSlice.h"
+#include "NseStats.h"
+#include "NseTaint.h"
+
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -16,6 +30,7 @@ using namespace clang;
 using namespace clang::ast_matchers;
 
 extern const char *NseInternalClassName;
+extern const char *NseExternalClassName;
 extern const char *NseAssumeFunctionName;
 extern const char *NseAssertFunctionName;
 extern const char *NseSymbolicFunctionRegex;
@@ -32,6 +47,14 @@ extern const char *FieldBindId;
 extern const char *ParmVarBindId;
 extern const char *ReturnTypeBindId;
 extern const char *CStyleCastBindId;
+extern const char *AssignmentBindId;
+extern const char *CompoundBindId;
+extern const char *ArraySubscriptBindId;
+extern const char *MemoizeBindId;
+extern const char *LoopSummaryBindId;
+extern const char *ConcurrencyTypeBindId;
+extern const char *AtomicAccessBindId;
+extern const char *BranchMergeBindId;
 
 StatementMatcher makeIfConditionMatcher();
 StatementMatcher makeIfConditionVariableMatcher();
@@ -48,12 +71,25 @@ StatementMatcher makeAssertMatcher();
 StatementMatcher makeSymbolicMatcher();
 StatementMatcher makeMakeSymbolicMatcher();
 StatementMatcher makeCStyleCastMatcher();
+StatementMatcher makeAssignmentMatcher();
+StatementMatcher makeCompoundMatcher();
+StatementMatcher makeArraySubscriptMatcher();
+DeclarationMatcher makeMemoizeMatcher();
+StatementMatcher makeForLoopMatcher();
+StatementMatcher makeWhileLoopMatcher();
+DeclarationMatcher makeConcurrentVarMatcher();
+DeclarationMatcher makeConcurrentFieldMatcher();
+StatementMatcher makeAtomicAccessMatcher();
+StatementMatcher makeBranchMergeMatcher();
+
+/// Non-void fundamental types, pointers and arrays of fundamental types
+bool isSupportedType(QualType QT);
 
 void instrumentVarDecl(
   StringRef crvClass,
   SourceRange SR,
   SourceManager &SM,
-  tooling::Replacements &R);
+  NseReplacementBuffer &R);
 
 void instrumentNamedVarDecl(
   StringRef NseClassPrefix,
@@ -62,7 +98,7 @@ void instrumentNamedVarDecl(
   SourceRange SR,
   SourceManager &SM,
   const LangOptions &LO,
-  tooling::Replacements &Replace);
+  NseReplacementBuffer &Replace);
 
 struct IncludesManager : public tooling::SourceFileCallbacks {
   IncludesManager()
@@ -78,225 +114,801 @@ struct IncludesManager : public tooling::SourceFileCallbacks {
       override;
 };
 
-class IfConditionReplacer : public MatchFinder::MatchCallback {
+/// Control-flow statements of the current translation unit whose condition
+/// was instrumented, left native because it is provably concrete, merged
+/// into a select expression, or decided without forking because it is
+/// outside of the assertion slice
+struct BranchStats {
+  BranchStats()
+      : Instrumented(0), Pruned(0), Merged(0), Sliced(0) {}
+
+  unsigned Instrumented;
+  unsigned Pruned;
+  unsigned Merged;
+  unsigned Sliced;
+};
+
+/// Base of all replacers. Times every callback and counts the nodes that
+/// each of the filters rejects, see ReplacerStats.
+class NseReplacer : public MatchFinder::MatchCallback {
 public :
-  IfConditionReplacer(
-    const std::string& NseBranchStrategy,
-    tooling::Replacements *Replace)
-      : NseBranchStrategy(NseBranchStrategy),
-        Replace(Replace) {}
+  NseReplacer(
+    const char *Name,
+    NseReplacementBuffer *Replace)
+      : Name(Name),
+        Replace(Replace),
+        Files(nullptr) {}
 
   virtual void run(const MatchFinder::MatchResult &Result)
-      override;
+      override final;
+
+  const char *getName() const { return Name; }
+  const ReplacerStats &getStats() const { return Stats; }
+  void resetStats() { Stats = ReplacerStats(); }
+
+  /// Must be called before the first match
+  void setFileFilter(NseFileFilter *Filter) { Files = Filter; }
+
+protected:
+  virtual void replace(const MatchFinder::MatchResult &Result) = 0;
+
+  /// Whether \p Loc is written in a file that the current translation unit
+  /// instruments, see NseFileFilter; counts it otherwise
+  bool isInInstrumentedFile(const MatchFinder::MatchResult &Result,
+    SourceLocation Loc);
+
+  /// isSupportedType() that counts unsupported types
+  bool isSupported(QualType QT);
+
+  /// SymbolicTaintAnalysis::isSymbolic() that counts concrete declarations
+  bool isSymbolic(const SymbolicTaintAnalysis *Taint, const Decl *D);
+
+  const char *Name;
+  NseReplacementBuffer *Replace;
+  NseFileFilter *Files;
+  ReplacerStats Stats;
+};
+
+/// Base of the replacers of control-flow conditions. If \p Folder is not
+/// null, known conditions are replaced by a literal and known
+/// subexpressions of the others are folded. If \p Slice is not null, the
+/// conditions outside of the slice are passed to nse_sliced_branch()
+/// instead of the strategy.
+class ConditionReplacer : public NseReplacer {
+public :
+  ConditionReplacer(
+    const char *Name,
+    const std::string& NseBranchStrategy,
+    const SymbolicTaintAnalysis *Taint,
+    const ConstantFolder *Folder,
+    const AssertionSlice *Slice,
+    BranchStats *Branches,
+    NseReplacementBuffer *Replace)
+      : NseReplacer(Name, Replace),
+        NseBranchStrategy(NseBranchStrategy),
+        Taint(Taint),
+        Folder(Folder),
+        Slice(Slice),
+        Branches(Branches) {}
+
+protected:
+  /// Leaves the condition \p E native if it is concrete or known, and
+  /// passes it to the strategy or to nse_sliced_branch() otherwise
+  void replaceCondition(const MatchFinder::MatchResult &Result,
+    const Expr *E);
 
 private:
   const std::string& NseBranchStrategy;
-  tooling::Replacements *Replace;
+  const SymbolicTaintAnalysis *Taint;
+  const ConstantFolder *Folder;
+  const AssertionSlice *Slice;
+  BranchStats *Branches;
 };
 
-class IfConditionVariableReplacer : public MatchFinder::MatchCallback {
+class IfConditionReplacer : public ConditionReplacer {
 public :
-  virtual void run(const MatchFinder::MatchResult &Result)
+  /// If \p Merges is not null, the conditions of the if statements it
+  /// merges are left to BranchMergeReplacer
+  IfConditionReplacer(
+    const std::string& NseBranchStrategy,
+    const SymbolicTaintAnalysis *Taint,
+    const ConstantFolder *Folder,
+    const BranchMerging *Merges,
+    const AssertionSlice *Slice,
+    BranchStats *Branches,
+    NseReplacementBuffer *Replace)
+      : ConditionReplacer("IfConditionReplacer", NseBranchStrategy, Taint,
+          Folder, Slice, Branches, Replace),
+        Merges(Merges) {}
+
+  virtual void replace(const MatchFinder::MatchResult &Result)
+      override;
+
+private:
+  const BranchMerging *Merges;
+};
+
+class IfConditionVariableReplacer : public NseReplacer {
+public :
+  IfConditionVariableReplacer()
+      : NseReplacer("IfConditionVariableReplacer", nullptr) {}
+
+  virtual void replace(const MatchFinder::MatchResult &Result)
       override;
 };
 
-class ForConditionReplacer : public MatchFinder::MatchCallback {
+class ForConditionReplacer : public ConditionReplacer {
 public :
+  /// If \p Loops is not null, the conditions of the loops it summarizes
+  /// are left to LoopSummaryReplacer
   ForConditionReplacer(
     const std::string& NseBranchStrategy,
-    tooling::Replacements *Replace)
-      : NseBranchStrategy(NseBranchStrategy),
-        Replace(Replace) {}
-
-  virtual void run(const MatchFinder::MatchResult &Result)
+    const SymbolicTaintAnalysis *Taint,
+    const ConstantFolder *Folder,
+    const LoopSummarization *Loops,
+    const AssertionSlice *Slice,
+    BranchStats *Branches,
+    NseReplacementBuffer *Replace)
+      : ConditionReplacer("ForConditionReplacer", NseBranchStrategy, Taint,
+          Folder, Slice, Branches, Replace),
+        Loops(Loops) {}
+
+  virtual void replace(const MatchFinder::MatchResult &Result)
       override;
 
 private:
-  const std::string& NseBranchStrategy;
-  tooling::Replacements *Replace;
+  const LoopSummarization *Loops;
 };
 
-class WhileConditionReplacer : public MatchFinder::MatchCallback {
+class WhileConditionReplacer : public ConditionReplacer {
 public :
+  /// If \p Loops is not null, the conditions of the loops it summarizes
+  /// are left to LoopSummaryReplacer
   WhileConditionReplacer(
     const std::string& NseBranchStrategy,
-    tooling::Replacements *Replace)
-      : NseBranchStrategy(NseBranchStrategy),
-        Replace(Replace) {}
-
-  virtual void run(const MatchFinder::MatchResult &Result)
+    const SymbolicTaintAnalysis *Taint,
+    const ConstantFolder *Folder,
+    const LoopSummarization *Loops,
+    const AssertionSlice *Slice,
+    BranchStats *Branches,
+    NseReplacementBuffer *Replace)
+      : ConditionReplacer("WhileConditionReplacer", NseBranchStrategy, Taint,
+          Folder, Slice, Branches, Replace),
+        Loops(Loops) {}
+
+  virtual void replace(const MatchFinder::MatchResult &Result)
       override;
 
 private:
-  const std::string& NseBranchStrategy;
-  tooling::Replacements *Replace;
+  const LoopSummarization *Loops;
 };
 
-class LocalVarReplacer : public MatchFinder::MatchCallback {
+class LocalVarReplacer : public NseReplacer {
 public :
-  LocalVarReplacer(tooling::Replacements *Replace)
-      : Replace(Replace) {}
-
-  virtual void run(const MatchFinder::MatchResult &Result)
+  /// If \p Arrays is not null, the arrays it scalarizes are declared as
+  /// one variable per element. If \p Shared is not null, the variables
+  /// it finds shared are declared External.
+  LocalVarReplacer(
+    const SymbolicTaintAnalysis *Taint,
+    const ArrayScalarization *Arrays,
+    const SharedAccessAnalysis *Shared,
+    NseReplacementBuffer *Replace)
+      : NseReplacer("LocalVarReplacer", Replace),
+        Taint(Taint),
+        Arrays(Arrays),
+        Shared(Shared) {}
+
+  virtual void replace(const MatchFinder::MatchResult &Result)
       override;
 
 private:
-  tooling::Replacements *Replace;
+  const SymbolicTaintAnalysis *Taint;
+  const ArrayScalarization *Arrays;
+  const SharedAccessAnalysis *Shared;
 };
 
-class GlobalVarReplacer : public MatchFinder::MatchCallback {
+class GlobalVarReplacer : public NseReplacer {
 public :
-  GlobalVarReplacer(tooling::Replacements *Replace)
-      : GlobalVars(), Replace(Replace) {}
-
-  virtual void run(const MatchFinder::MatchResult &Result)
+  /// If \p Shared is not null, the variables it finds shared are declared
+  /// External
+  GlobalVarReplacer(
+    const SymbolicTaintAnalysis *Taint,
+    const SharedAccessAnalysis *Shared,
+    NseReplacementBuffer *Replace)
+      : NseReplacer("GlobalVarReplacer", Replace),
+        GlobalVars(), Taint(Taint), Shared(Shared) {}
+
+  virtual void replace(const MatchFinder::MatchResult &Result)
       override;
 
   std::vector<const VarDecl *> GlobalVars;
 
 private:
-  tooling::Replacements *Replace;
+  const SymbolicTaintAnalysis *Taint;
+  const SharedAccessAnalysis *Shared;
 };
 
-class FieldReplacer : public MatchFinder::MatchCallback {
+class FieldReplacer : public NseReplacer {
 public :
-  FieldReplacer(tooling::Replacements *Replace)
-      : Replace(Replace) {}
+  FieldReplacer(
+    const SymbolicTaintAnalysis *Taint,
+    NseReplacementBuffer *Replace)
+      : NseReplacer("FieldReplacer", Replace),
+        Taint(Taint) {}
 
-  virtual void run(const MatchFinder::MatchResult &Result)
+  virtual void replace(const MatchFinder::MatchResult &Result)
       override;
 
 private:
-  tooling::Replacements *Replace;
+  const SymbolicTaintAnalysis *Taint;
 };
 
-class MainFunctionReplacer : public MatchFinder::MatchCallback {
+class MainFunctionReplacer : public NseReplacer {
 public :
   MainFunctionReplacer(
     const std::string& NseNamespace,
-    const std::string& Strategy,
-    tooling::Replacements *Replace,
+    const std::string& HarnessMain,
+    NseReplacementBuffer *Replace,
     std::vector<const VarDecl *> *GlobalVars,
     IncludesManager* IM)
-      : NseNamespace(NseNamespace),
-        Strategy(Strategy),
-        Replace(Replace),
+      : NseReplacer("MainFunctionReplacer", Replace),
+        Instrumented(false),
+        NseNamespace(NseNamespace),
+        HarnessMain(HarnessMain),
         GlobalVars(GlobalVars),
         IM(IM) {}
 
-  virtual void run(const MatchFinder::MatchResult &Result)
+  virtual void replace(const MatchFinder::MatchResult &Result)
       override;
 
+  /// Whether the main() of the current translation unit was replaced
+  bool Instrumented;
+
 private:
   const std::string& NseNamespace;
-  const std::string& Strategy;
-  tooling::Replacements *Replace;
+  const std::string& HarnessMain;
   std::vector<const VarDecl *> *GlobalVars;
   IncludesManager* IM;
 };
 
-class ParmVarReplacer : public MatchFinder::MatchCallback {
+class ParmVarReplacer : public NseReplacer {
 public :
-  ParmVarReplacer(tooling::Replacements *Replace)
-      : Replace(Replace) {}
+  ParmVarReplacer(
+    const SymbolicTaintAnalysis *Taint,
+    NseReplacementBuffer *Replace)
+      : NseReplacer("ParmVarReplacer", Replace),
+        Taint(Taint) {}
 
-  virtual void run(const MatchFinder::MatchResult &Result)
+  virtual void replace(const MatchFinder::MatchResult &Result)
       override;
 
 private:
-  tooling::Replacements *Replace;
+  const SymbolicTaintAnalysis *Taint;
 };
 
-class ReturnTypeReplacer : public MatchFinder::MatchCallback {
+class ReturnTypeReplacer : public NseReplacer {
 public :
-  ReturnTypeReplacer(tooling::Replacements *Replace)
-      : Replace(Replace) {}
+  ReturnTypeReplacer(
+    const SymbolicTaintAnalysis *Taint,
+    NseReplacementBuffer *Replace)
+      : NseReplacer("ReturnTypeReplacer", Replace),
+        Taint(Taint) {}
 
-  virtual void run(const MatchFinder::MatchResult &Result)
+  virtual void replace(const MatchFinder::MatchResult &Result)
       override;
 
 private:
-  tooling::Replacements *Replace;
+  const SymbolicTaintAnalysis *Taint;
 };
 
-class AssumeReplacer : public MatchFinder::MatchCallback {
+class AssumeReplacer : public NseReplacer {
 public :
   AssumeReplacer(
     const std::string& NseStrategy,
-    tooling::Replacements *Replace)
-      : NseStrategy(NseStrategy),
-        Replace(Replace) {}
+    NseReplacementBuffer *Replace)
+      : NseReplacer("AssumeReplacer", Replace),
+        NseStrategy(NseStrategy) {}
 
-  virtual void run(const MatchFinder::MatchResult &Result)
+  virtual void replace(const MatchFinder::MatchResult &Result)
       override;
 
 private:
   const std::string& NseStrategy;
-  tooling::Replacements *Replace;
 };
 
-class AssertReplacer : public MatchFinder::MatchCallback {
+class AssertReplacer : public NseReplacer {
 public :
   AssertReplacer(
     const std::string& NseStrategy,
-    tooling::Replacements *Replace)
-      : NseStrategy(NseStrategy),
-        Replace(Replace) {}
+    NseReplacementBuffer *Replace)
+      : NseReplacer("AssertReplacer", Replace),
+        NseStrategy(NseStrategy) {}
 
-  virtual void run(const MatchFinder::MatchResult &Result)
+  virtual void replace(const MatchFinder::MatchResult &Result)
       override;
 
 private:
   const std::string& NseStrategy;
-  tooling::Replacements *Replace;
 };
 
-class SymbolicReplacer : public MatchFinder::MatchCallback {
+class SymbolicReplacer : public NseReplacer {
 public :
   SymbolicReplacer(
     const std::string& NseNamespace,
-    tooling::Replacements *Replace)
-      : NseNamespace(NseNamespace),
-        Replace(Replace) {}
+    NseReplacementBuffer *Replace)
+      : NseReplacer("SymbolicReplacer", Replace),
+        NseNamespace(NseNamespace) {}
 
-  virtual void run(const MatchFinder::MatchResult &Result)
+  virtual void replace(const MatchFinder::MatchResult &Result)
       override;
 
 private:
   const std::string& NseNamespace;
-  tooling::Replacements *Replace;
 };
 
-class MakeSymbolicReplacer : public MatchFinder::MatchCallback {
+class MakeSymbolicReplacer : public NseReplacer {
 public :
   MakeSymbolicReplacer(
     const std::string& NseNamespace,
-    tooling::Replacements *Replace)
-      : NseNamespace(NseNamespace),
-        Replace(Replace) {}
+    NseReplacementBuffer *Replace)
+      : NseReplacer("MakeSymbolicReplacer", Replace),
+        NseNamespace(NseNamespace) {}
 
-  virtual void run(const MatchFinder::MatchResult &Result)
+  virtual void replace(const MatchFinder::MatchResult &Result)
       override;
 
 private:
   const std::string& NseNamespace;
-  tooling::Replacements *Replace;
 };
 
-class CStyleCastReplacer : public MatchFinder::MatchCallback {
+class CStyleCastReplacer : public NseReplacer {
 public :
   CStyleCastReplacer(
     const std::string& NseNamespace,
-    tooling::Replacements *Replace)
-      : NseNamespace(NseNamespace),
-        Replace(Replace) {}
+    const SymbolicTaintAnalysis *Taint,
+    NseReplacementBuffer *Replace)
+      : NseReplacer("CStyleCastReplacer", Replace),
+        NseNamespace(NseNamespace),
+        Taint(Taint) {}
 
-  virtual void run(const MatchFinder::MatchResult &Result)
+  virtual void replace(const MatchFinder::MatchResult &Result)
       override;
 
 private:
   const std::string& NseNamespace;
+  const SymbolicTaintAnalysis *Taint;
+};
+
+/// Folds the known subexpressions of values assigned to instrumented
+/// variables, see ConstantFolder
+class AssignmentFoldReplacer : public NseReplacer {
+public :
+  AssignmentFoldReplacer(
+    const SymbolicTaintAnalysis *Taint,
+    const ConstantFolder *Folder,
+    NseReplacementBuffer *Replace)
+      : NseReplacer("AssignmentFoldReplacer", Replace),
+        Taint(Taint),
+        Folder(Folder) {}
+
+  virtual void replace(const MatchFinder::MatchResult &Result)
+      override;
+
+private:
+  const SymbolicTaintAnalysis *Taint;
+  const ConstantFolder *Folder;
+};
+
+/// Assumes the bounds that ValueRangeAnalysis proves for an instrumented
+/// local variable right after every statement that writes it, so that the
+/// solver need not consider the rest of its bit-vector
+class RangeAssumptionReplacer : public NseReplacer {
+public :
+  RangeAssumptionReplacer(
+    const std::string& NseStrategy,
+    const SymbolicTaintAnalysis *Taint,
+    const ValueRangeAnalysis *Ranges,
+    NseReplacementBuffer *Replace)
+      : NseReplacer("RangeAssumptionReplacer", Replace),
+        NseStrategy(NseStrategy),
+        Taint(Taint),
+        Ranges(Ranges) {}
+
+  virtual void replace(const MatchFinder::MatchResult &Result)
+      override;
+
+private:
+  const std::string& NseStrategy;
+  const SymbolicTaintAnalysis *Taint;
+  const ValueRangeAnalysis *Ranges;
+};
+
+/// Replaces the subscripts of the arrays that LocalVarReplacer scalarizes by
+/// the variable of the element, see ArrayScalarization
+class ArrayElementReplacer : public NseReplacer {
+public :
+  ArrayElementReplacer(
+    const SymbolicTaintAnalysis *Taint,
+    const ArrayScalarization *Arrays,
+    NseReplacementBuffer *Replace)
+      : NseReplacer("ArrayElementReplacer", Replace),
+        Taint(Taint),
+        Arrays(Arrays) {}
+
+  virtual void replace(const MatchFinder::MatchResult &Result)
+      override;
+
+private:
+  const SymbolicTaintAnalysis *Taint;
+  const ArrayScalarization *Arrays;
+};
+
+/// Wraps the body of every instrumented pure function in nse_memoize(), so
+/// that calls with arguments it has seen before return the earlier result,
+/// see PurityAnalysis
+class MemoizeReplacer : public NseReplacer {
+public :
+  MemoizeReplacer(
+    const SymbolicTaintAnalysis *Taint,
+    const PurityAnalysis *Purity,
+    NseReplacementBuffer *Replace)
+      : NseReplacer("MemoizeReplacer", Replace),
+        Instrumented(false),
+        Taint(Taint),
+        Purity(Purity) {}
+
+  virtual void replace(const MatchFinder::MatchResult &Result)
+      override;
+
+  /// Whether a function of the current translation unit was wrapped
+  bool Instrumented;
+
+private:
+  const SymbolicTaintAnalysis *Taint;
+  const PurityAnalysis *Purity;
+};
+
+/// Replaces a counted loop by its closed form with a single instrumented
+/// branch, see LoopSummarization. The replacement is exclusive, so the
+/// replacements of other replacers within the loop are dropped.
+class LoopSummaryReplacer : public NseReplacer {
+public :
+  LoopSummaryReplacer(
+    const std::string& NseBranchStrategy,
+    const SymbolicTaintAnalysis *Taint,
+    const LoopSummarization *Loops,
+    BranchStats *Branches,
+    NseReplacementBuffer *Replace)
+      : NseReplacer("LoopSummaryReplacer", Replace),
+        NseBranchStrategy(NseBranchStrategy),
+        Taint(Taint),
+        Loops(Loops),
+        Branches(Branches) {}
+
+  virtual void replace(const MatchFinder::MatchResult &Result)
+      override;
+
+private:
+  const std::string& NseBranchStrategy;
+  const SymbolicTaintAnalysis *Taint;
+  const LoopSummarization *Loops;
+  BranchStats *Branches;
+};
+
+/// Replaces an if statement that only chooses the values of instrumented
+/// locals by one ite() of the runtime per variable, see BranchMerging. Like
+/// LoopSummaryReplacer, it replaces the if statement exclusively.
+class BranchMergeReplacer : public NseReplacer {
+public :
+  BranchMergeReplacer(
+    const std::string& NseNamespace,
+    const BranchMerging *Merges,
+    BranchStats *Branches,
+    NseReplacementBuffer *Replace)
+      : NseReplacer("BranchMergeReplacer", Replace),
+        NseNamespace(NseNamespace),
+        Merges(Merges),
+        Branches(Branches) {}
+
+  virtual void replace(const MatchFinder::MatchResult &Result)
+      override;
+
+private:
+  const std::string& NseNamespace;
+  const BranchMerging *Merges;
+  BranchStats *Branches;
+};
+
+/// Declares std::thread and std::mutex variables, fields and parameters
+/// with the Thread and Mutex classes of the runtime, including the mutex of
+/// a std::lock_guard or std::unique_lock, and instrumented std::atomic
+/// variables as External ones, see SharedAccessAnalysis
+class ConcurrentTypeReplacer : public NseReplacer {
+public :
+  ConcurrentTypeReplacer(
+    const std::string& NseNamespace,
+    const SymbolicTaintAnalysis *Taint,
+    const SharedAccessAnalysis *Shared,
+    NseReplacementBuffer *Replace)
+      : NseReplacer("ConcurrentTypeReplacer", Replace),
+        NseNamespace(NseNamespace),
+        Taint(Taint),
+        Shared(Shared) {}
+
+  virtual void replace(const MatchFinder::MatchResult &Result)
+      override;
+
+private:
+  const std::string& NseNamespace;
+  const SymbolicTaintAnalysis *Taint;
+  const SharedAccessAnalysis *Shared;
+};
+
+/// Turns load() and store() of the std::atomic variables that
+/// ConcurrentTypeReplacer declares External into plain reads and writes
+class AtomicAccessReplacer : public NseReplacer {
+public :
+  AtomicAccessReplacer(
+    const SymbolicTaintAnalysis *Taint,
+    const SharedAccessAnalysis *Shared,
+    NseReplacementBuffer *Replace)
+      : NseReplacer("AtomicAccessReplacer", Replace),
+        Taint(Taint),
+        Shared(Shared) {}
+
+  virtual void replace(const MatchFinder::MatchResult &Result)
+      override;
+
+private:
+  const SymbolicTaintAnalysis *Taint;
+  const SharedAccessAnalysis *Shared;
+};
+
+/// Ways of finding the nodes that need to be instrumented
+enum NseEngine {
+  /// One MatchFinder pass over the whole translation unit
+  MatcherEngine,
+
+  /// A single traversal of the main file that hands each node only to
+  /// the matchers rooted at its kind, see traverseMainFile()
+  TraversalEngine,
+
+  /// Parse without instrumenting, to measure the cost of the other engines
+  ParseOnlyEngine
+};
+
+/// One matcher of the traversal engine in a MatchFinder of its own, to
+/// measure the time spent in it
+struct NseNodeMatcher {
+  NseNodeMatcher(NseReplacer *Replacer)
+      : Finder(),
+        Replacer(Replacer),
+        Seconds(0) {}
+
+  MatchFinder Finder;
+  NseReplacer *Replacer;
+
+  /// Time spent in Finder, including Replacer
+  double Seconds;
+};
+
+/// The matchers rooted at one kind of node
+struct NseNodeFinder {
+  MatchFinder Finder;
+
+  /// The same matchers one by one, only used when profiling
+  std::vector<std::unique_ptr<NseNodeMatcher>> Matchers;
+};
+
+/// NseNodeFinders for each kind of node that a matcher is rooted at
+struct NseNodeFinders {
+  NseNodeFinders()
+      : Profile(false) {}
+
+  NseNodeFinder IfStmts;
+  NseNodeFinder ForStmts;
+  NseNodeFinder WhileStmts;
+  NseNodeFinder DeclStmts;
+  NseNodeFinder CallExprs;
+  NseNodeFinder CStyleCastExprs;
+  NseNodeFinder BinaryOperators;
+  NseNodeFinder CompoundStmts;
+  NseNodeFinder ArraySubscriptExprs;
+  NseNodeFinder VarDecls;
+  NseNodeFinder FieldDecls;
+  NseNodeFinder FunctionDecls;
+  NseNodeFinder ParmVarDecls;
+
+  /// Run the matchers one by one and measure each of them
+  bool Profile;
+};
+
+/// Visits every node of the translation unit once, except for declarations
+/// outside of the main file and, in project mode, user headers, whose
+/// subtrees are skipped altogether, and runs the matchers in \p Finders that
+/// are rooted at the node's kind. The nodes are visited in the order in which
+/// a MatchFinder would visit them.
+void traverseMainFile(ASTContext &Context, NseNodeFinders &Finders,
+  const NseFileFilter &Files);
+
+/// Options that determine how translation units are instrumented
+struct NseOptions {
+  NseOptions()
+      : NseNamespace("crv"),
+        NseBranch("branch"),
+        Strategy("sequential_dfs_checker"),
+        WrapAll(false),
+        BranchReport(false),
+        Engine(MatcherEngine),
+        Harness(),
+        Stats(false),
+        Headers(false),
+        FoldConstants(false),
+        RangeAnalysis(false),
+        ScalarizeArrays(false),
+        SummarizeLoops(false),
+        Concurrent(false),
+        MergeBranches(false) {}
+
+  /// Serializes every option, e.g. to key cached instrumentation results
+  std::string getKey() const;
+
+  std::string NseNamespace;
+  std::string NseBranch;
+  std::string Strategy;
+
+  /// Instrument all supported declarations, not only symbolic ones
+  bool WrapAll;
+
+  /// Print the BranchStats of every translation unit
+  bool BranchReport;
+
+  NseEngine Engine;
+
+  NseHarnessOptions Harness;
+
+  /// Collect the NseFileStats of every translation unit
+  bool Stats;
+
+  /// Instrument user headers as well as main files, see NseFileFilter
+  bool Headers;
+
+  /// Replace known subexpressions of instrumented conditions and
+  /// assignments by literals, see ConstantFolder
+  bool FoldConstants;
+
+  /// Assume the bounds of instrumented local variables, see
+  /// ValueRangeAnalysis
+  bool RangeAnalysis;
+
+  /// Declare local arrays that are only subscripted with constant indices
+  /// as one variable per element, see ArrayScalarization
+  bool ScalarizeArrays;
+
+  /// Replace counted loops by their closed form, see LoopSummarization
+  bool SummarizeLoops;
+
+  /// Rewrite threads, mutexes and atomics onto the runtime and declare the
+  /// instrumented variables that threads share External, see
+  /// SharedAccessAnalysis
+  bool Concurrent;
+
+  /// Replace if statements that only choose the values of instrumented
+  /// locals by select expressions, see BranchMerging
+  bool MergeBranches;
+};
+
+/// Owns one complete set of replacers together with the MatchFinder that
+/// drives them and the analyses they consult. None of them are thread-safe,
+/// so every thread that instruments translation units needs its own
+/// NseInstrumenter.
+class NseInstrumenter {
+public :
+  /// In project mode, \p Registry is shared by all instrumenters of the
+  /// project; if it is null, this instrumenter uses its own.
+  NseInstrumenter(
+    const NseOptions &Options,
+    tooling::Replacements *Replace,
+    NseHeaderRegistry *Registry = nullptr);
+
+  /// Creates actions that call handleBeginSource() and instrumentAST()
+  std::unique_ptr<tooling::FrontendActionFactory> newFrontendActionFactory();
+
+  bool handleBeginSource(CompilerInstance &CI, StringRef Filename);
+
+  /// Runs the analyses and all replacers on a parsed translation unit
+  void instrumentAST(ASTContext &Context);
+
+  /// Instruments a translation unit that was parsed without the actions of
+  /// newFrontendActionFactory(), such as a reparsed ASTUnit
+  void instrumentUnit(ASTContext &Context);
+
+  /// Statistics of every instrumented translation unit if Options.Stats
+  const std::vector<NseFileStats> &getFileStats() const { return FileStats; }
+
+private:
+  /// Forgets the state of the previous translation unit
+  void beginSource();
+
+  /// Registers \p Callback with both engines
+  template <typename MatcherT>
+  void addMatcher(
+    const MatcherT &NodeMatch,
+    NseNodeFinder &NodeFinder,
+    NseReplacer *Callback);
+
+  /// Appends the statistics of the translation unit that was just
+  /// instrumented to FileStats
+  void addFileStats(
+    ASTContext &Context,
+    double ParseSeconds,
+    double MatchSeconds,
+    size_t Replacements);
+
+  const NseOptions Options;
   tooling::Replacements *Replace;
+
+  // collects the replacements of the current translation unit until it is
+  // done, see NseReplacementBuffer
+  NseReplacementBuffer Buffer;
+
+  // fully qualified function name without parenthesis
+  const std::string NseStrategy;
+  const std::string NseBranchStrategy;
+
+  // generated code, see NseHarness.h
+  const std::string NseHarnessPrologue;
+  const std::string NseHarnessMain;
+
+  std::unique_ptr<NseHeaderRegistry> OwnRegistry;
+  NseFileFilter Files;
+
+  SymbolicTaintAnalysis Taint;
+  ConstantFolder Folder;
+  ValueRangeAnalysis Ranges;
+  ArrayScalarization Arrays;
+  PurityAnalysis Purity;
+  LoopSummarization Loops;
+  SharedAccessAnalysis Shared;
+  BranchMerging Merges;
+  AssertionSlice Slice;
+  BranchStats Branches;
+
+  IncludesManager IM;
+  IfConditionReplacer IfStmts;
+  IfConditionVariableReplacer IfConditionVariableStmts;
+  ForConditionReplacer ForStmts;
+  WhileConditionReplacer WhileStmts;
+  LocalVarReplacer LocalVarDecls;
+  GlobalVarReplacer GlobalVarDecls;
+  FieldReplacer FieldDecls;
+  MainFunctionReplacer MainFunction;
+  ParmVarReplacer ParmVarDecls;
+  ReturnTypeReplacer ReturnTypes;
+  AssumeReplacer Assumptions;
+  AssertReplacer Assertions;
+  SymbolicReplacer Symbolics;
+  MakeSymbolicReplacer MakeSymbolics;
+  CStyleCastReplacer CStyleCasts;
+  AssignmentFoldReplacer Assignments;
+  RangeAssumptionReplacer RangeAssumptions;
+  ArrayElementReplacer ArrayElements;
+  MemoizeReplacer MemoizedFunctions;
+  LoopSummaryReplacer ForLoops;
+  LoopSummaryReplacer WhileLoops;
+  ConcurrentTypeReplacer ConcurrentVars;
+  ConcurrentTypeReplacer ConcurrentFields;
+  AtomicAccessReplacer AtomicAccesses;
+  BranchMergeReplacer MergedBranches;
+  MatchFinder Finder;
+  NseNodeFinders NodeFinders;
+
+  /// Every replacer and its matcher in the traversal engine, in the order
+  /// in which they were registered
+  std::vector<NseNodeMatcher *> Matchers;
+
+  NseStopwatch ParseStopwatch;
+  std::vector<NseFileStats> FileStats;
 };
 
 #endif
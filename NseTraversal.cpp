@@ -0,0 +1,142 @@
+//===-- NseTraversal.cpp - Single-pass instrumentation engine -------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief Finds the nodes to instrument in a single traversal of the AST
+///
+/// A MatchFinder tries every registered matcher on every node, including
+/// the many thousands of declarations that come from headers, only for the
+/// replacers to discard them again. Instead, this traversal skips every
+/// declaration outside of the main file, or in project mode outside of the
+/// user headers, together with its subtree, and gives each remaining node
+/// only to the matchers rooted at its kind.
+///
+//===----------------------------------------------------------------------===//
+
+#include "clang/AST/RecursiveASTVisitor.h"
+#include "clang/Basic/SourceManager.h"
+#include "NseTransform.h"
+
+namespace {
+
+class MainFileTraversal : public RecursiveASTVisitor<MainFileTraversal> {
+public :
+  MainFileTraversal(
+    ASTContext &Context,
+    NseNodeFinders &Finders,
+    const NseFileFilter &Files)
+      : Context(Context),
+        SM(Context.getSourceManager()),
+        Finders(Finders),
+        Files(Files) {}
+
+  // visit the same nodes as a MatchFinder does
+  bool shouldVisitTemplateInstantiations() const { return true; }
+  bool shouldVisitImplicitCode() const { return true; }
+
+  bool TraverseDecl(Decl *D) {
+    if (D && !isa<TranslationUnitDecl>(D) &&
+        !Files.isUserFile(SM, SM.getExpansionLoc(D->getLocation())))
+      return true;
+
+    return RecursiveASTVisitor<MainFileTraversal>::TraverseDecl(D);
+  }
+
+  bool VisitIfStmt(IfStmt *S) {
+    return match(Finders.IfStmts, S);
+  }
+
+  bool VisitForStmt(ForStmt *S) {
+    return match(Finders.ForStmts, S);
+  }
+
+  bool VisitWhileStmt(WhileStmt *S) {
+    return match(Finders.WhileStmts, S);
+  }
+
+  bool VisitCompoundStmt(CompoundStmt *S) {
+    return match(Finders.CompoundStmts, S);
+  }
+
+  bool VisitDeclStmt(DeclStmt *S) {
+    return match(Finders.DeclStmts, S);
+  }
+
+  bool VisitCallExpr(CallExpr *E) {
+    return match(Finders.CallExprs, E);
+  }
+
+  bool VisitCStyleCastExpr(CStyleCastExpr *E) {
+    return match(Finders.CStyleCastExprs, E);
+  }
+
+  bool VisitArraySubscriptExpr(ArraySubscriptExpr *E) {
+    return match(Finders.ArraySubscriptExprs, E);
+  }
+
+  // also called for compound assignments
+  bool VisitBinaryOperator(BinaryOperator *E) {
+    return match(Finders.BinaryOperators, E);
+  }
+
+  // also called for parameters, which a varDecl() matcher matches as well
+  bool VisitVarDecl(VarDecl *D) {
+    return match(Finders.VarDecls, D);
+  }
+
+  bool VisitParmVarDecl(ParmVarDecl *D) {
+    return match(Finders.ParmVarDecls, D);
+  }
+
+  bool VisitFieldDecl(FieldDecl *D) {
+    return match(Finders.FieldDecls, D);
+  }
+
+  bool VisitFunctionDecl(FunctionDecl *D) {
+    return match(Finders.FunctionDecls, D);
+  }
+
+private:
+  bool match(NseNodeFinder &NodeFinder, const Stmt *S) {
+    return matchNode(NodeFinder, *S);
+  }
+
+  bool match(NseNodeFinder &NodeFinder, const Decl *D) {
+    return matchNode(NodeFinder, *D);
+  }
+
+  template <typename NodeT>
+  bool matchNode(NseNodeFinder &NodeFinder, const NodeT &Node) {
+    if (!Finders.Profile) {
+      NodeFinder.Finder.match(Node, Context);
+      return true;
+    }
+
+    for (const std::unique_ptr<NseNodeMatcher> &Matcher : NodeFinder.Matchers) {
+      NseStopwatch Stopwatch;
+      Matcher->Finder.match(Node, Context);
+      Matcher->Seconds += Stopwatch.getSeconds();
+    }
+    return true;
+  }
+
+  ASTContext &Context;
+  const SourceManager &SM;
+  NseNodeFinders &Finders;
+  const NseFileFilter &Files;
+};
+
+} // end anonymous namespace
+
+void traverseMainFile(ASTContext &Context, NseNodeFinders &Finders,
+  const NseFileFilter &Files) {
+
+  MainFileTraversal Traversal(Context, Finders, Files);
+  Traversal.TraverseDecl(Context.getTranslationUnitDecl());
+}
@@ -0,0 +1,40 @@
+#!/bin/bash
+#
+# Compares the matching phase of clang-nse's engines. Every engine runs on a
+# fresh copy of each file; the fastest of RUNS runs is kept. The parse-only
+# engine measures parsing alone, so subtracting its time from that of an
+# engine yields the time spent finding and instrumenting nodes.
+#
+# Usage: compare-engines.sh [file.cpp...]
+
+CLANG_NSE=${CLANG_NSE:-clang-nse}
+RUNS=${RUNS:-5}
+CXXFLAGS=${CXXFLAGS:--std=c++11}
+DIR=$(cd "$(dirname "$0")" && pwd)
+FILES=${@:-${DIR}/corpus/header_heavy.cpp}
+TMP=$(mktemp -d)
+trap "rm -rf ${TMP}" EXIT
+
+# prints the fastest wall-clock time in milliseconds
+time_engine() {
+  local engine=$1 file=$2 best=
+  for run in $(seq ${RUNS}); do
+    cp "${file}" "${TMP}/input.cpp"
+    local start=$(date +%s%N)
+    ${CLANG_NSE} --engine=${engine} "${TMP}/input.cpp" -- ${CXXFLAGS} || exit 1
+    local elapsed=$(( ($(date +%s%N) - start) / 1000000 ))
+    if [ -z "${best}" ] || [ ${elapsed} -lt ${best} ]; then
+      best=${elapsed}
+    fi
+  done
+  echo ${best}
+}
+
+printf "%-32s %10s %10s %10s %8s\n" file parse-ms matchers-ms traversal-ms speedup
+for file in ${FILES}; do
+  parse=$(time_engine parse-only "${file}")
+  matchers=$(( $(time_engine matchers "${file}") - parse ))
+  traversal=$(( $(time_engine traversal "${file}") - parse ))
+  speedup=$(awk "BEGIN { printf \"%.1fx\", ${matchers} / (${traversal} > 0 ? ${traversal} : 1) }")
+  printf "%-32s %10d %10d %10d %8s\n" "$(basename ${file})" ${parse} ${matchers} ${traversal} ${speedup}
+done
@@ -0,0 +1,31 @@
+// Arrays indexed by concrete and symbolic values.
+int nse_symbolic_int();
+void nse_assume(bool);
+void nse_assert(bool);
+
+int Table[8];
+
+int lookup(int i) {
+  if (i < 0 || i >= 8)
+    return -1;
+  return Table[i];
+}
+
+int main() {
+  int values[8];
+  for (int i = 0; i < 8; i++) {
+    values[i] = i * i;
+    Table[i] = nse_symbolic_int();
+  }
+
+  int i = nse_symbolic_int();
+  nse_assume(0 <= i && i < 8);
+
+  int max = values[0];
+  for (int j = 1; j < 8; j++)
+    if (Table[j] > max)
+      max = Table[j];
+
+  nse_assert(lookup(i) <= max || lookup(i) == values[0]);
+  return 0;
+}
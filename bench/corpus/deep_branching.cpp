@@ -0,0 +1,18 @@
+// A long chain of independent symbolic branches, i.e. 2^12 paths, with a
+// bug on exactly one of them to measure the time to the first bug.
+int nse_symbolic_int();
+void nse_assert(bool);
+
+int main() {
+  int bits = 0;
+  for (int i = 0; i < 12; i++) {
+    int x = nse_symbolic_int();
+    if (x > 0)
+      bits = bits * 2 + 1;
+    else
+      bits = bits * 2;
+  }
+
+  nse_assert(bits != 2730);
+  return 0;
+}
@@ -0,0 +1,31 @@
+// State kept in globals across calls, which must be reinitialized on
+// every explored path.
+int nse_symbolic_int();
+void nse_assume(bool);
+void nse_assert(bool);
+
+int Balance = 100;
+int Withdrawals;
+int Limit = 3;
+
+bool withdraw(int amount) {
+  if (amount <= 0 || Withdrawals >= Limit)
+    return false;
+  if (amount > Balance)
+    return false;
+  Balance -= amount;
+  Withdrawals++;
+  return true;
+}
+
+int main() {
+  for (int i = 0; i < 4; i++) {
+    int amount = nse_symbolic_int();
+    nse_assume(amount < 200);
+    withdraw(amount);
+  }
+
+  nse_assert(Balance >= 0);
+  nse_assert(Withdrawals <= Limit);
+  return 0;
+}
@@ -0,0 +1,41 @@
+// Few instrumentable nodes in the main file, but tens of thousands of
+// declarations from standard library headers that every matcher visits.
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+int nse_symbolic_int();
+void nse_assert(bool);
+
+int Counter;
+
+int clamp(int x, int lo, int hi) {
+  if (x < lo)
+    return lo;
+  if (x > hi)
+    return hi;
+  return x;
+}
+
+int main() {
+  std::vector<int> values(8);
+  int x = nse_symbolic_int();
+  int y = clamp(x, 0, 100);
+
+  for (int i = 0; i < 8; i++)
+    values[i] = i;
+
+  while (Counter < 4)
+    Counter++;
+
+  nse_assert(y <= 100);
+  return 0;
+}
@@ -0,0 +1,29 @@
+// Nested loops whose bounds are concrete but whose bodies branch on
+// symbolic data, so every iteration contributes a branch decision.
+int nse_symbolic_int();
+void nse_assume(bool);
+void nse_assert(bool);
+
+int main() {
+  int x = nse_symbolic_int();
+  int y = nse_symbolic_int();
+  nse_assume(0 <= x && x < 16);
+  nse_assume(0 <= y && y < 16);
+
+  int sum = 0;
+  for (int i = 0; i < 4; i++) {
+    for (int j = 0; j < 3; j++) {
+      if (x > i + j)
+        sum += x;
+      else
+        sum -= y;
+    }
+  }
+
+  int k = 0;
+  while (k < y && k < 6)
+    k++;
+
+  nse_assert(k <= 6);
+  return 0;
+}
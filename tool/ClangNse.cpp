@@ -14,13 +14,38 @@
 ///
 //===----------------------------------------------------------------------===//
 
+#include "clang/Basic/Diagnostic.h"
+#include "clang/Basic/DiagnosticOptions.h"
+#include "clang/Basic/FileManager.h"
+#include "clang/Basic/SourceManager.h"
+#include "clang/Basic/Version.h"
 #include "clang/Frontend/FrontendActions.h"
+#include "clang/Frontend/TextDiagnosticPrinter.h"
+#include "clang/Rewrite/Core/Rewriter.h"
 #include "clang/Tooling/CommonOptionsParser.h"
 #include "clang/Tooling/Tooling.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
 #include "llvm/Support/Signals.h"
+#include "llvm/Support/TargetSelect.h"
 
+#include "NseCache.h"
+#include "NseReplacementIO.h"
+#include "NseRewrite.h"
+#include "NseRuntimePCH.h"
+#include "NseServer.h"
 #include "NseTransform.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <iterator>
+#include <map>
+#include <set>
+#include <thread>
+
 namespace cl = llvm::cl;
 
 static cl::OptionCategory NseOptionCategory("Native symbolic execution options");
@@ -43,55 +68,897 @@ static cl::opt<std::string> StrategyOpt(
   cl::desc("Extern function that determines the symbolic execution path search strategy (default=sequential_dfs_checker)."),
   cl::cat(NseOptionCategory));
 
+static cl::opt<bool> WrapAllOpt(
+  "wrap-all",
+  cl::desc("Instrument every supported declaration instead of only those that symbolic values can flow into."),
+  cl::cat(NseOptionCategory));
+
+static cl::opt<bool> BranchReportOpt(
+  "branch-report",
+  cl::desc("Print how many branches of each file were instrumented and how many were left native because their condition is concrete."),
+  cl::cat(NseOptionCategory));
+
+static cl::opt<NseEngine> EngineOpt(
+  "engine",
+  cl::desc("How nodes to instrument are found (default=matchers)."),
+  cl::values(
+    clEnumValN(MatcherEngine, "matchers",
+      "Run every AST matcher on the whole translation unit"),
+    clEnumValN(TraversalEngine, "traversal",
+      "Visit each node of the main file once, skipping header declarations"),
+    clEnumValN(ParseOnlyEngine, "parse-only",
+      "Parse without instrumenting, to benchmark the other engines"),
+    clEnumValEnd),
+  cl::init(MatcherEngine),
+  cl::cat(NseOptionCategory));
+
+static cl::opt<unsigned> JobsOpt(
+  "j",
+  cl::init(1),
+  cl::desc("Number of translation units to instrument in parallel, 0 uses all cores (default=1)."),
+  cl::cat(NseOptionCategory));
+
+static cl::opt<std::string> CacheDirOpt(
+  "cache-dir",
+  cl::desc("Directory of the instrumentation cache; unchanged translation units are not re-instrumented."),
+  cl::cat(NseOptionCategory));
+
+static cl::opt<NseHarnessKind> HarnessOpt(
+  "harness",
+  cl::desc("How the instrumented program explores its paths (default=sequential)."),
+  cl::values(
+    clEnumValN(SequentialHarness, "sequential",
+      "Let the strategy explore one path after another"),
+    clEnumValN(ParallelHarness, "parallel",
+      "Partition the paths by their first branch decisions among forked workers"),
+    clEnumValN(SnapshotHarness, "snapshot",
+      "Fork at symbolic branches to resume the other direction without replaying"),
+    clEnumValEnd),
+  cl::init(SequentialHarness),
+  cl::cat(NseOptionCategory));
+
+static cl::opt<unsigned> HarnessJobsOpt(
+  "harness-jobs",
+  cl::init(0),
+  cl::desc("Number of worker processes of the parallel harness, 0 uses all cores at runtime (default=0)."),
+  cl::cat(NseOptionCategory));
+
+static cl::opt<unsigned> SplitDepthOpt(
+  "split-depth",
+  cl::init(0),
+  cl::desc("Number of branch decisions that partition the paths of the parallel harness, 0 chooses about four partitions per worker (default=0)."),
+  cl::cat(NseOptionCategory));
+
+static cl::opt<unsigned> MaxSnapshotsOpt(
+  "max-snapshots",
+  cl::init(32),
+  cl::desc("Maximum number of suspended processes per path of the snapshot harness before it falls back to replaying (default=32)."),
+  cl::cat(NseOptionCategory));
+
+static cl::opt<bool> StatsOpt(
+  "stats",
+  cl::desc("Print the time spent parsing, matching and saving and the counters of every replacer."),
+  cl::cat(NseOptionCategory));
+
+static cl::opt<std::string> StatsJSONOpt(
+  "stats-json",
+  cl::desc("Write the statistics of --stats as JSON to the given file."),
+  cl::cat(NseOptionCategory));
+
+static cl::opt<bool> HeadersOpt(
+  "headers",
+  cl::desc("Also instrument the user headers of the project, each of them only once; system headers are left alone."),
+  cl::cat(NseOptionCategory));
+
+static cl::opt<bool> FoldConstantsOpt(
+  "fold-constants",
+  cl::desc("Replace subexpressions of instrumented conditions and assignments whose value is known at compile time by literals."),
+  cl::cat(NseOptionCategory));
+
+static cl::opt<bool> RangeAnalysisOpt(
+  "range-analysis",
+  cl::desc("Prove bounds on the values of instrumented local variables and assume them after every statement that writes one."),
+  cl::cat(NseOptionCategory));
+
+static cl::opt<bool> ScalarizeArraysOpt(
+  "scalarize-arrays",
+  cl::desc("Declare instrumented local arrays whose indices are all known at compile time as one variable per element."),
+  cl::cat(NseOptionCategory));
+
+static cl::opt<bool> SummarizeLoopsOpt(
+  "summarize-loops",
+  cl::desc("Replace instrumented counted loops that only add loop-invariant values to variables by their closed form with a single branch."),
+  cl::cat(NseOptionCategory));
+
+static cl::opt<bool> MergeBranchesOpt(
+  "merge-branches",
+  cl::desc("Replace symbolic if statements whose arms only assign simple values to instrumented locals by select expressions without a branch."),
+  cl::cat(NseOptionCategory));
+
+static cl::opt<bool> ConcurrentOpt(
+  "concurrent",
+  cl::desc("Rewrite std::thread, std::mutex and std::atomic onto the runtime and declare only the instrumented variables that threads share External; implies --strategy=dfs_checker unless given. Atomic accesses are modeled as memory_order_seq_cst."),
+  cl::cat(NseOptionCategory));
+
+static cl::opt<bool> MemoizeOpt(
+  "memoize",
+  cl::desc("Cache the results of instrumented pure functions by their arguments and report the cache hits and misses."),
+  cl::cat(NseOptionCategory));
+
+static cl::opt<bool> SliceOpt(
+  "slice",
+  cl::desc("Decide symbolic branches that no nse_assert() or nse_assume() depends on without forking."),
+  cl::cat(NseOptionCategory));
+
+static cl::opt<bool> RewriteMacrosOpt(
+  "rewrite-macros",
+  cl::desc("Expand the macros of every main file before instrumenting it, like clang -cc1 -rewrite-macros but without a separate pass over the file on disk."),
+  cl::cat(NseOptionCategory));
+
+static cl::opt<bool> IncludeRuntimeHeadersOpt(
+  "include-runtime-headers",
+  cl::desc("Prepend the includes of the CRV runtime to every main file."),
+  cl::cat(NseOptionCategory));
+
+static cl::opt<std::string> RuntimePCHOpt(
+  "runtime-pch",
+  cl::desc("Precompile the CRV runtime headers in the given directory once per set of compile flags; main files include them through the precompiled header, which --emit-obj uses."),
+  cl::cat(NseOptionCategory));
+
+static cl::opt<std::string> OutputDirOpt(
+  "output-dir",
+  cl::desc("Write the instrumented files under the given directory instead of overwriting the sources."),
+  cl::cat(NseOptionCategory));
+
+static cl::opt<std::string> ExportReplacementsOpt(
+  "export-replacements",
+  cl::desc("Write the replacements of every translation unit as a stream under the given directory instead of applying them; nse-apply applies the streams later."),
+  cl::cat(NseOptionCategory));
+
+static cl::opt<bool> StdoutOpt(
+  "stdout",
+  cl::desc("Print the instrumented main file instead of overwriting it; requires a single source file."),
+  cl::cat(NseOptionCategory));
+
+static cl::opt<std::string> ServeOpt(
+  "serve",
+  cl::desc("Keep running and instrument the files of every request on the given Unix domain socket; the sources on the command line are parsed at startup."),
+  cl::cat(NseOptionCategory));
+
+static cl::opt<bool> EmitObjOpt(
+  "emit-obj",
+  cl::desc("Compile the instrumented main files in process to object files instead of writing the instrumented sources."),
+  cl::cat(NseOptionCategory));
+
+static NseOptions getNseOptions() {
+  NseOptions Options;
+  Options.NseNamespace = NamespaceOpt;
+  Options.NseBranch = BranchOpt;
+  Options.Strategy = StrategyOpt;
+  Options.WrapAll = WrapAllOpt;
+  Options.BranchReport = BranchReportOpt;
+  Options.Engine = EngineOpt;
+  Options.Harness.Kind = HarnessOpt;
+  Options.Harness.Jobs = HarnessJobsOpt;
+  Options.Harness.SplitDepth = SplitDepthOpt;
+  Options.Harness.MaxSnapshots = MaxSnapshotsOpt;
+  Options.Harness.Memoize = MemoizeOpt;
+  Options.Harness.Slice = SliceOpt;
+  Options.Stats = StatsOpt || !StatsJSONOpt.empty();
+  Options.Headers = HeadersOpt;
+  Options.FoldConstants = FoldConstantsOpt;
+  Options.RangeAnalysis = RangeAnalysisOpt;
+  Options.ScalarizeArrays = ScalarizeArraysOpt;
+  Options.SummarizeLoops = SummarizeLoopsOpt;
+  Options.Concurrent = ConcurrentOpt;
+  Options.MergeBranches = MergeBranchesOpt;
+
+  // the sequential strategy knows nothing about threads
+  if (ConcurrentOpt && StrategyOpt.getNumOccurrences() == 0)
+    Options.Strategy = "dfs_checker";
+  return Options;
+}
+
+/// Identifies this clang-nse binary together with every option that
+/// influences the replacements, so that cache entries never outlive them
+static std::string getToolKey(const char *Argv0) {
+  std::string Key = getNseOptions().getKey();
+  if (RewriteMacrosOpt)
+    Key += '\0' + std::string("rewrite-macros");
+
+  static int StaticSymbol;
+  std::string Executable =
+    llvm::sys::fs::getMainExecutable(Argv0, &StaticSymbol);
+
+  llvm::sys::fs::file_status Status;
+  if (!llvm::sys::fs::status(Executable, Status))
+    Key += '\0' + Executable + '\0' + std::to_string(Status.getSize()) +
+      '\0' + std::to_string(Status.getLastModificationTime().toEpochTime());
+
+  return Key;
+}
+
+/// The directory clang-nse was started in. ClangTool::run() chdir()s into
+/// the directory of every compile command, so the current directory changes
+/// under the feet of parallel workers; see AbsoluteCompilationDatabase.
+static std::string InitialDirectory;
+
+/// Resolves \p Path against \p Directory unless it is absolute or empty
+static std::string makeAbsolute(StringRef Directory, StringRef Path) {
+  if (Path.empty() || llvm::sys::path::is_absolute(Path))
+    return Path;
+
+  SmallString<128> Absolute(Directory);
+  llvm::sys::path::append(Absolute, Path);
+  return Absolute.str();
+}
+
+namespace {
+
+/// The compile commands of a fixed set of absolute source paths in which
+/// the directory and every relative path are resolved before any worker
+/// starts. ClangTool::run() chdir()s into the directory of each command,
+/// which is thread-hostile since the working directory belongs to the whole
+/// process: without this, one worker would resolve its sources and include
+/// paths against the directory of another. Relative paths are recognized
+/// as the values of the include and output options and as arguments that
+/// name an existing file; paths elsewhere, such as in response files or in
+/// -Wp, options, are left alone and must be absolute with -j.
+class AbsoluteCompilationDatabase : public tooling::CompilationDatabase {
+public :
+  AbsoluteCompilationDatabase(
+    const tooling::CompilationDatabase &Base,
+    const std::vector<std::string> &Files) {
+
+    for (const std::string &File : Files) {
+      std::vector<tooling::CompileCommand> &FileCommands = Commands[File];
+      FileCommands = Base.getCompileCommands(File);
+      for (tooling::CompileCommand &Command : FileCommands)
+        resolve(Command);
+    }
+  }
+
+  virtual std::vector<tooling::CompileCommand> getCompileCommands(
+      StringRef FilePath) const override {
+    std::map<std::string, std::vector<tooling::CompileCommand>>::const_iterator
+      Known = Commands.find(FilePath);
+    if (Known == Commands.end())
+      return std::vector<tooling::CompileCommand>();
+    return Known->second;
+  }
+
+  virtual std::vector<std::string> getAllFiles() const override {
+    std::vector<std::string> Files;
+    for (const auto &File : Commands)
+      Files.push_back(File.first);
+    return Files;
+  }
+
+  virtual std::vector<tooling::CompileCommand> getAllCompileCommands() const
+      override {
+    std::vector<tooling::CompileCommand> All;
+    for (const auto &File : Commands)
+      All.insert(All.end(), File.second.begin(), File.second.end());
+    return All;
+  }
+
+private:
+  static void resolve(tooling::CompileCommand &Command) {
+    static const char *const PathOptions[] = {
+      "-I", "-F", "-isystem", "-iquote", "-idirafter", "-iprefix",
+      "-isysroot", "-include", "-include-pch", "-imacros", "-MF", "-o"
+    };
+    static const char *const JoinedPathOptions[] = {
+      "-I", "-F", "-isystem", "-iquote", "-idirafter", "--sysroot="
+    };
+
+    const std::string Directory =
+      makeAbsolute(InitialDirectory, Command.Directory);
+    Command.Directory = Directory;
+
+    std::vector<std::string> &Args = Command.CommandLine;
+    for (size_t I = 1; I < Args.size(); ++I) {
+      StringRef Arg = Args[I];
+      if (std::find(std::begin(PathOptions), std::end(PathOptions), Arg) !=
+          std::end(PathOptions)) {
+        if (I + 1 < Args.size()) {
+          Args[I + 1] = makeAbsolute(Directory, Args[I + 1]);
+          ++I;
+        }
+        continue;
+      }
+
+      bool Joined = false;
+      for (const char *Option : JoinedPathOptions) {
+        if (Arg.startswith(Option) && Arg.size() > strlen(Option)) {
+          Args[I] = Option + makeAbsolute(Directory, Arg.substr(strlen(Option)));
+          Joined = true;
+          break;
+        }
+      }
+
+      // the values of other options, such as -x c++, name no file
+      if (!Joined && !Arg.startswith("-")) {
+        const std::string Path = makeAbsolute(Directory, Arg);
+        if (llvm::sys::fs::exists(Path))
+          Args[I] = Path;
+      }
+    }
+  }
+
+  std::map<std::string, std::vector<tooling::CompileCommand>> Commands;
+};
+
+} // end anonymous namespace
+
+/// Writes \p Replace, the replacements of the translation unit \p MainFile,
+/// to its stream under --export-replacements. The stream is written even if
+/// it is empty, so that every translation unit that was instrumented has one.
+static bool exportReplacements(
+  const std::string &MainFile,
+  const tooling::Replacements &Replace) {
+
+  std::string Stream;
+  llvm::raw_string_ostream OS(Stream);
+  writeReplacements(Replace, OS);
+  OS.flush();
+
+  const std::string Path = getOutputPath(ExportReplacementsOpt, MainFile,
+    InitialDirectory) +
+    NseReplacementsExtension;
+  if (!writeFileAtomically(Path, Stream)) {
+    llvm::errs() << Path << ": could not be written\n";
+    return false;
+  }
+
+  return true;
+}
+
+/// Instruments the translation unit \p File unless \p Cache, if any,
+/// already holds its replacements. Appends the statistics of an
+/// instrumented file to \p Stats. With --export-replacements, the
+/// replacements of \p File are also written to its stream.
+///
+/// If \p ExpandedFiles is set, the macros of \p File are expanded first,
+/// and the expanded text is instrumented instead of the file on disk and
+/// stored in \p ExpandedFiles under the absolute path of \p File.
+static int instrumentFile(
+  const tooling::CompilationDatabase &Compilations,
+  const std::string &File,
+  NseCache *Cache,
+  NseHeaderRegistry *Headers,
+  tooling::Replacements &Replace,
+  std::vector<NseFileStats> &Stats,
+  std::map<std::string, std::string> *ExpandedFiles) {
+
+  const std::string MainFile = tooling::getAbsolutePath(File);
+  std::string Expanded;
+  if (ExpandedFiles) {
+    if (!rewriteMacros(Compilations, File, Expanded))
+      return 1;
+    (*ExpandedFiles)[MainFile] = Expanded;
+  }
+
+  // the expanded text is a function of the files the cache key covers
+  std::string Key;
+  tooling::Replacements FileReplace;
+  int Result = 0;
+  if (!Cache || !Cache->lookup(Compilations, File, Key, FileReplace)) {
+    tooling::ClangTool Tool(Compilations, File);
+    if (ExpandedFiles)
+      Tool.mapVirtualFile(MainFile, Expanded);
+    NseInstrumenter Instrumenter(getNseOptions(), &FileReplace, Headers);
+
+    Result = Tool.run(Instrumenter.newFrontendActionFactory().get());
+    if (Result == 0 && Cache && !Key.empty())
+      Cache->store(Key, FileReplace);
+
+    const std::vector<NseFileStats> &FileStats = Instrumenter.getFileStats();
+    Stats.insert(Stats.end(), FileStats.begin(), FileStats.end());
+  }
+
+  // exported replacements need not stay in memory until all files are done
+  if (!ExportReplacementsOpt.empty()) {
+    if (Result == 0 && !exportReplacements(MainFile, FileReplace))
+      Result = 1;
+    return Result;
+  }
+
+  Replace.insert(FileReplace.begin(), FileReplace.end());
+  return Result;
+}
+
+/// Instruments every file in \p Files on \p Jobs worker threads. Each worker
+/// pulls the next file from a shared index and builds its own ClangTool and
+/// NseInstrumenter, so no AST or replacer state is shared between threads,
+/// except for \p Headers, if any, which assigns each header to one of them.
+///
+/// The per-worker replacements are merged into \p Replace after all workers
+/// have finished. Since tooling::Replacements is ordered by file path, offset,
+/// length and text, the merged set, and therefore the rewritten files, do not
+/// depend on how files were distributed among workers.
+static int instrumentFiles(
+  const tooling::CompilationDatabase &Compilations,
+  const std::vector<std::string> &Files,
+  unsigned Jobs,
+  NseCache *Cache,
+  NseHeaderRegistry *Headers,
+  tooling::Replacements &Replace,
+  std::vector<NseFileStats> &Stats,
+  std::map<std::string, std::string> *ExpandedFiles) {
+
+  std::atomic<size_t> NextFile(0);
+  std::vector<tooling::Replacements> WorkerReplaces(Jobs);
+  std::vector<std::vector<NseFileStats>> WorkerStats(Jobs);
+  std::vector<std::map<std::string, std::string>> WorkerExpanded(Jobs);
+  std::vector<int> WorkerResults(Jobs, 0);
+  std::vector<std::thread> Workers;
+
+  for (unsigned I = 0; I < Jobs; ++I) {
+    Workers.push_back(std::thread([&, I]() {
+      for (size_t F = NextFile++; F < Files.size(); F = NextFile++) {
+        if (int Result = instrumentFile(Compilations, Files[F], Cache,
+              Headers, WorkerReplaces[I], WorkerStats[I],
+              ExpandedFiles ? &WorkerExpanded[I] : nullptr))
+          WorkerResults[I] = Result;
+      }
+    }));
+  }
+
+  for (std::thread &Worker : Workers)
+    Worker.join();
+
+  for (const tooling::Replacements &R : WorkerReplaces)
+    Replace.insert(R.begin(), R.end());
+
+  for (const std::vector<NseFileStats> &S : WorkerStats)
+    Stats.insert(Stats.end(), S.begin(), S.end());
+  if (ExpandedFiles) {
+    for (const std::map<std::string, std::string> &E : WorkerExpanded)
+      ExpandedFiles->insert(E.begin(), E.end());
+  }
+  std::sort(Stats.begin(), Stats.end(),
+    [](const NseFileStats &A, const NseFileStats &B) {
+      return A.File < B.File;
+    });
+
+  return *std::max_element(WorkerResults.begin(), WorkerResults.end());
+}
+
+/// Applies \p Replace to the files on disk like RefactoringTool::runAndSave
+static int saveReplacements(const tooling::Replacements &Replace) {
+  LangOptions DefaultLangOptions;
+  IntrusiveRefCntPtr<DiagnosticOptions> DiagOpts = new DiagnosticOptions();
+  TextDiagnosticPrinter DiagnosticPrinter(llvm::errs(), &*DiagOpts);
+  DiagnosticsEngine Diagnostics(
+      IntrusiveRefCntPtr<DiagnosticIDs>(new DiagnosticIDs()),
+      &*DiagOpts, &DiagnosticPrinter, false);
+  FileManager Files((FileSystemOptions()));
+  SourceManager Sources(Diagnostics, Files);
+  Rewriter Rewrite(Sources, DefaultLangOptions);
+
+  if (!tooling::applyAllReplacements(Replace, Rewrite))
+    llvm::errs() << "Skipped some replacements.\n";
+
+  return Rewrite.overwriteChangedFiles() ? 1 : 0;
+}
+
+/// Generates or reuses the runtime PCH of --runtime-pch for every main file
+/// in \p Sources and maps the absolute path of each to its runtime header
+static void getRuntimeHeaders(
+  const tooling::CompilationDatabase &Compilations,
+  const std::vector<std::string> &Sources,
+  std::map<std::string, std::string> &RuntimeHeaders) {
+
+  NseRuntimePCH PCH(tooling::getAbsolutePath(RuntimePCHOpt));
+  for (const std::string &Source : Sources) {
+    const std::string Header = PCH.getHeader(Compilations, Source);
+    if (Header.empty())
+      llvm::errs() << Source << ": runtime PCH could not be generated\n";
+    else
+      RuntimeHeaders[tooling::getAbsolutePath(Source)] = Header;
+  }
+
+  llvm::errs() << "Runtime PCH: " << PCH.getGenerated() << " generated, "
+               << PCH.getReused() << " reused\n";
+}
+
+/// Computes the instrumented text of every file with replacements and of
+/// every main file into \p Instrumented. A main file starts from its text in
+/// \p ExpandedFiles, if any, and includes the runtime through its header in
+/// \p RuntimeHeaders, if any, or directly if --include-runtime-headers or
+/// --runtime-pch is set. Files whose text did not change are added to
+/// \p Unchanged.
+static int getInstrumentedFiles(
+  const tooling::Replacements &Replace,
+  const std::vector<std::string> &Sources,
+  const std::map<std::string, std::string> &ExpandedFiles,
+  const std::map<std::string, std::string> &RuntimeHeaders,
+  const std::set<std::string> &ConflictingFiles,
+  std::map<std::string, std::string> &Instrumented,
+  std::set<std::string> &Unchanged) {
+
+  std::set<std::string> MainFiles;
+  for (const std::string &Source : Sources)
+    MainFiles.insert(tooling::getAbsolutePath(Source));
+
+  std::set<std::string> Files(MainFiles);
+  for (const tooling::Replacement &R : Replace)
+    Files.insert(R.getFilePath());
+
+  int Result = 0;
+  for (const std::string &File : Files) {
+    if (ConflictingFiles.count(File))
+      continue;
+
+    std::unique_ptr<llvm::MemoryBuffer> Buffer;
+    StringRef Code;
+    std::map<std::string, std::string>::const_iterator Expanded =
+      ExpandedFiles.find(File);
+    if (Expanded != ExpandedFiles.end()) {
+      Code = Expanded->second;
+    } else {
+      llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> Original =
+        llvm::MemoryBuffer::getFile(File);
+      if (!Original) {
+        llvm::errs() << File << ": " << Original.getError().message() << '\n';
+        Result = 1;
+        continue;
+      }
+      Buffer = std::move(*Original);
+      Code = Buffer->getBuffer();
+    }
+
+    std::string &Text = Instrumented[File];
+    if (!applyFileReplacements(File, Code, Replace, Text)) {
+      llvm::errs() << File << ": skipped, replacements do not apply\n";
+      Instrumented.erase(File);
+      Result = 1;
+      continue;
+    }
+
+    if (MainFiles.count(File)) {
+      std::map<std::string, std::string>::const_iterator Runtime =
+        RuntimeHeaders.find(File);
+      if (Runtime != RuntimeHeaders.end())
+        Text.insert(0, "#include \"" + Runtime->second + "\"\n");
+      else if (IncludeRuntimeHeadersOpt || !RuntimePCHOpt.empty())
+        Text.insert(0, NseRuntimeIncludes);
+    }
+
+    if (Buffer && Text == Code)
+      Unchanged.insert(File);
+  }
+
+  return Result;
+}
+
+/// Writes \p Instrumented in place, under --output-dir or to stdout. Adds
+/// the paths of all written files to \p Written, if any.
+static int writeInstrumentedFiles(
+  const std::map<std::string, std::string> &Instrumented,
+  const std::set<std::string> &Unchanged,
+  std::vector<std::string> *Written = nullptr) {
+
+  int Result = 0;
+  for (const std::pair<const std::string, std::string> &File : Instrumented) {
+    if (StdoutOpt) {
+      llvm::outs() << File.second;
+      continue;
+    }
+
+    // leave untouched sources alone so that build systems do not rebuild them
+    if (OutputDirOpt.empty() && Unchanged.count(File.first))
+      continue;
+
+    const std::string Path = OutputDirOpt.empty() ? File.first :
+      getOutputPath(OutputDirOpt, File.first, InitialDirectory);
+    if (!writeFileAtomically(Path, File.second)) {
+      llvm::errs() << Path << ": could not be written\n";
+      Result = 1;
+    } else if (Written) {
+      Written->push_back(Path);
+    }
+  }
+
+  return Result;
+}
+
+/// Compiles every main file in \p Sources that is in \p Instrumented on
+/// \p Jobs worker threads to an object file, which is named like the main
+/// file and placed in the current directory or mirrored under --output-dir.
+/// The compiler reads all files in \p Instrumented from memory, so
+/// instrumented headers are seen, too, and uses the PCH of the runtime
+/// header of a main file in \p RuntimeHeaders, if any.
+static int compileInstrumentedFiles(
+  const tooling::CompilationDatabase &Compilations,
+  const std::vector<std::string> &Sources,
+  unsigned Jobs,
+  const std::map<std::string, std::string> &Instrumented,
+  const std::map<std::string, std::string> &RuntimeHeaders) {
+
+  std::atomic<size_t> NextFile(0);
+  std::vector<int> WorkerResults(Jobs, 0);
+  std::vector<std::thread> Workers;
+
+  for (unsigned I = 0; I < Jobs; ++I) {
+    Workers.push_back(std::thread([&, I]() {
+      for (size_t F = NextFile++; F < Sources.size(); F = NextFile++) {
+        const std::string MainFile = tooling::getAbsolutePath(Sources[F]);
+        if (!Instrumented.count(MainFile))
+          continue;
+
+        SmallString<128> Object(OutputDirOpt.empty() ?
+          llvm::sys::path::filename(MainFile).str() :
+          getOutputPath(OutputDirOpt, MainFile, InitialDirectory));
+        llvm::sys::path::replace_extension(Object, "o");
+
+        std::vector<std::string> ExtraArgs;
+        std::map<std::string, std::string>::const_iterator Runtime =
+          RuntimeHeaders.find(MainFile);
+        if (Runtime != RuntimeHeaders.end()) {
+          ExtraArgs.push_back("-include-pch");
+          ExtraArgs.push_back(NseRuntimePCH::getPCHPath(Runtime->second));
+        }
+
+        if (!emitObject(Compilations, Sources[F], Instrumented, ExtraArgs,
+              Object)) {
+          llvm::errs() << Sources[F] << ": compilation failed\n";
+          WorkerResults[I] = 1;
+        }
+      }
+    }));
+  }
+
+  for (std::thread &Worker : Workers)
+    Worker.join();
+
+  return *std::max_element(WorkerResults.begin(), WorkerResults.end());
+}
+
+/// Answers the requests of --serve:
+///
+///   instrument  responds with the replacements of the files, encoded like
+///               the entries of --cache-dir
+///   write       writes the instrumented files under --output-dir like a
+///               normal run and responds with their paths, one per line
+///   shutdown    stops the server
+static bool handleRequest(NseUnitCache &Units, const NseRequest &Request,
+  llvm::raw_ostream &Response) {
+
+  if (Request.Command == "shutdown") {
+    Response << "ok\n";
+    return false;
+  }
+
+  if (Request.Command != "instrument" && Request.Command != "write") {
+    Response << "error unknown command " << Request.Command << '\n';
+    return true;
+  }
+
+  // the cached units would reparse the instrumented sources and instrument
+  // them again on the next request
+  if (Request.Command == "write" && OutputDirOpt.empty()) {
+    Response << "error write requires --output-dir\n";
+    return true;
+  }
+
+  std::unique_ptr<NseHeaderRegistry> Headers;
+  if (HeadersOpt)
+    Headers.reset(new NseHeaderRegistry());
+
+  tooling::Replacements Replace;
+  for (const std::string &File : Request.Files) {
+    ASTUnit *Unit = Units.getUnit(File);
+    if (!Unit) {
+      Response << "error " << File << " could not be parsed\n";
+      return true;
+    }
+
+    NseInstrumenter Instrumenter(getNseOptions(), &Replace, Headers.get());
+    Instrumenter.instrumentUnit(Unit->getASTContext());
+  }
+
+  std::set<std::string> ConflictingFiles;
+  if (removeConflicts(Replace, ConflictingFiles)) {
+    Response << "error conflicting replacements\n";
+    return true;
+  }
+
+  if (Request.Command == "instrument") {
+    Response << "ok\n";
+    writeReplacements(Replace, Response);
+    return true;
+  }
+
+  std::map<std::string, std::string> Instrumented;
+  std::set<std::string> Unchanged;
+  std::vector<std::string> Written;
+  if (getInstrumentedFiles(Replace, Request.Files,
+        std::map<std::string, std::string>(),
+        std::map<std::string, std::string>(), ConflictingFiles, Instrumented,
+        Unchanged) ||
+      writeInstrumentedFiles(Instrumented, Unchanged, &Written)) {
+    Response << "error files could not be written\n";
+    return true;
+  }
+
+  Response << "ok\n";
+  for (const std::string &Path : Written)
+    Response << Path << '\n';
+  return true;
+}
+
+/// Keeps the compilation database and the parsed translation units of
+/// \p Files alive between the requests on the socket of --serve
+static int serve(const tooling::CompilationDatabase &Compilations,
+  const std::vector<std::string> &Files) {
+
+  NseUnitCache Units(Compilations);
+  for (const std::string &File : Files) {
+    if (!Units.getUnit(File))
+      llvm::errs() << File << ": could not be parsed\n";
+  }
+
+  llvm::errs() << "Serving " << Units.size() << " translation units on "
+               << ServeOpt << '\n';
+  return serveRequests(ServeOpt,
+    [&Units](const NseRequest &Request, llvm::raw_ostream &Response) {
+      return handleRequest(Units, Request, Response);
+    });
+}
+
 int main(int argc, const char **argv) {
   llvm::sys::PrintStackTraceOnErrorSignal();
 
   tooling::CommonOptionsParser OptionsParser(argc, argv, NseOptionCategory);
-  tooling::RefactoringTool Tool(OptionsParser.getCompilations(),
-    OptionsParser.getSourcePathList());
-
-  // fully qualified function name without parenthesis
-  const std::string NseStrategy = NamespaceOpt + "::" + StrategyOpt + "()";
-  const std::string NseBranchStrategy = NseStrategy + "." + BranchOpt;
-
-  IncludesManager IM;
-  tooling::Replacements *Replace = &Tool.getReplacements();
-  IfConditionReplacer IfStmts(NseBranchStrategy, Replace);
-  IfConditionVariableReplacer IfConditionVariableStmts;
-  ForConditionReplacer ForStmts(NseBranchStrategy, Replace);
-  WhileConditionReplacer WhileStmts(NseBranchStrategy, Replace);
-  LocalVarReplacer LocalVarDecls(Replace);
-  GlobalVarReplacer GlobalVarDecls(Replace);
-  FieldReplacer FieldDecls(Replace);
-  MainFunctionReplacer MainFunction(NamespaceOpt, StrategyOpt,
-    Replace, &GlobalVarDecls.GlobalVars, &IM);
-
-  ParmVarReplacer ParmVarDecls(Replace);
-  ReturnTypeReplacer ReturnTypes(Replace);
-  AssumeReplacer Assumptions(NseStrategy, Replace);
-  AssertReplacer Assertions(NseStrategy, Replace);
-  SymbolicReplacer Symbolics(NamespaceOpt, Replace);
-  MakeSymbolicReplacer MakeSymbolics(NamespaceOpt, Replace);
-  CStyleCastReplacer CStyleCasts(NamespaceOpt, Replace);
-
-  MatchFinder Finder;
-  Finder.addMatcher(makeIfConditionMatcher(), &IfStmts);
-  Finder.addMatcher(makeIfConditionVariableMatcher(), &IfConditionVariableStmts);
-  Finder.addMatcher(makeForConditionMatcher(), &ForStmts);
-  Finder.addMatcher(makeWhileConditionMatcher(), &WhileStmts);
-  Finder.addMatcher(makeLocalVarMatcher(), &LocalVarDecls);
-  Finder.addMatcher(makeGlobalVarMatcher(), &GlobalVarDecls);
-  Finder.addMatcher(makeFieldMatcher(), &FieldDecls);
-
-  // requires GlobalVarDecls to run first, so order matters
-  Finder.addMatcher(makeMainFunctionMatcher(), &MainFunction);
-  Finder.addMatcher(makeParmVarDeclMatcher(), &ParmVarDecls);
-  Finder.addMatcher(makeReturnTypeMatcher(), &ReturnTypes);
-  Finder.addMatcher(makeAssumeMatcher(), &Assumptions);
-  Finder.addMatcher(makeAssertMatcher(), &Assertions);
-  Finder.addMatcher(makeSymbolicMatcher(), &Symbolics);
-  Finder.addMatcher(makeMakeSymbolicMatcher(), &MakeSymbolics);
-  Finder.addMatcher(makeCStyleCastMatcher(), &CStyleCasts);
-
-  return Tool.runAndSave(tooling::newFrontendActionFactory(&Finder, &IM).get());
+  const std::vector<std::string> &Files = OptionsParser.getSourcePathList();
+
+  unsigned Jobs = JobsOpt;
+  if (Jobs == 0)
+    Jobs = std::max(1u, std::thread::hardware_concurrency());
+  Jobs = std::max<size_t>(1, std::min<size_t>(Jobs, Files.size()));
+
+  if (StdoutOpt && (Files.size() != 1 || HeadersOpt ||
+                    !OutputDirOpt.empty() || EmitObjOpt)) {
+    llvm::errs() << "--stdout requires a single source file and neither "
+                    "--headers, --output-dir nor --emit-obj\n";
+    return 1;
+  }
+
+  if (!ExportReplacementsOpt.empty() && (RewriteMacrosOpt ||
+      IncludeRuntimeHeadersOpt || !RuntimePCHOpt.empty() ||
+      !OutputDirOpt.empty() || StdoutOpt || EmitObjOpt ||
+      !ServeOpt.empty())) {
+    llvm::errs() << "--export-replacements supports neither --rewrite-macros, "
+                    "--include-runtime-headers, --runtime-pch, --output-dir, "
+                    "--stdout, --emit-obj nor --serve\n";
+    return 1;
+  }
+
+  if (!ServeOpt.empty()) {
+    if (RewriteMacrosOpt || EmitObjOpt || StdoutOpt ||
+        !RuntimePCHOpt.empty()) {
+      llvm::errs() << "--serve supports neither --rewrite-macros, --emit-obj, "
+                      "--stdout nor --runtime-pch\n";
+      return 1;
+    }
+    return serve(OptionsParser.getCompilations(), Files);
+  }
+
+  if (EmitObjOpt) {
+    llvm::InitializeAllTargets();
+    llvm::InitializeAllTargetMCs();
+    llvm::InitializeAllAsmPrinters();
+    llvm::InitializeAllAsmParsers();
+  }
+
+  // anything beyond instrumenting the sources in place
+  const bool Rewrite = RewriteMacrosOpt || IncludeRuntimeHeadersOpt ||
+    !RuntimePCHOpt.empty() || !OutputDirOpt.empty() || StdoutOpt || EmitObjOpt;
+
+  const NseOptions Options = getNseOptions();
+  if (Jobs == 1 && CacheDirOpt.empty() && !Options.Stats &&
+      !Options.Headers && !Rewrite && ExportReplacementsOpt.empty()) {
+    tooling::RefactoringTool Tool(OptionsParser.getCompilations(), Files);
+    NseInstrumenter Instrumenter(Options, &Tool.getReplacements());
+
+    return Tool.runAndSave(Instrumenter.newFrontendActionFactory().get());
+  }
+
+  // ClangTool::run() changes the working directory, so every path that
+  // outlives a run must be absolute before the first one starts
+  SmallString<128> CurrentPath;
+  if (llvm::sys::fs::current_path(CurrentPath)) {
+    llvm::errs() << "The current directory could not be determined\n";
+    return 1;
+  }
+  InitialDirectory = CurrentPath.str();
+  CacheDirOpt = makeAbsolute(InitialDirectory, CacheDirOpt);
+  ExportReplacementsOpt = makeAbsolute(InitialDirectory, ExportReplacementsOpt);
+  OutputDirOpt = makeAbsolute(InitialDirectory, OutputDirOpt);
+  RuntimePCHOpt = makeAbsolute(InitialDirectory, RuntimePCHOpt);
+  StatsJSONOpt = makeAbsolute(InitialDirectory, StatsJSONOpt);
+
+  std::vector<std::string> Sources;
+  for (const std::string &File : Files)
+    Sources.push_back(makeAbsolute(InitialDirectory, File));
+  const AbsoluteCompilationDatabase Compilations(
+    OptionsParser.getCompilations(), Sources);
+
+  std::unique_ptr<NseCache> Cache;
+  if (!CacheDirOpt.empty())
+    Cache.reset(new NseCache(CacheDirOpt, getToolKey(argv[0])));
+
+  std::unique_ptr<NseHeaderRegistry> Headers;
+  if (Options.Headers)
+    Headers.reset(new NseHeaderRegistry());
+
+  tooling::Replacements Replace;
+  std::vector<NseFileStats> Stats;
+  std::map<std::string, std::string> ExpandedFiles;
+  int Result = instrumentFiles(Compilations, Sources, Jobs,
+    Cache.get(), Headers.get(), Replace, Stats,
+    RewriteMacrosOpt ? &ExpandedFiles : nullptr);
+
+  if (Cache)
+    llvm::errs() << "Instrumentation cache: " << Cache->getHits() << " hits, "
+                 << Cache->getMisses() << " misses\n";
+
+  if (Headers)
+    llvm::errs() << "Headers: " << Headers->size()
+                 << " instrumented once each\n";
+
+  // nse-apply merges and checks the exported streams
+  double SaveSeconds = -1;
+  if (!ExportReplacementsOpt.empty()) {
+    if (Result == 0)
+      llvm::errs() << "Exported the replacements of " << Files.size()
+                   << " translation units to " << ExportReplacementsOpt
+                   << '\n';
+  } else if (Result == 0) {
+    NseStopwatch SaveStopwatch;
+    std::set<std::string> ConflictingFiles;
+    const unsigned Conflicts = removeConflicts(Replace, ConflictingFiles);
+    if (Rewrite) {
+      std::map<std::string, std::string> RuntimeHeaders;
+      if (!RuntimePCHOpt.empty())
+        getRuntimeHeaders(Compilations, Sources,
+          RuntimeHeaders);
+
+      std::map<std::string, std::string> Instrumented;
+      std::set<std::string> Unchanged;
+      Result = getInstrumentedFiles(Replace, Sources, ExpandedFiles,
+        RuntimeHeaders, ConflictingFiles, Instrumented, Unchanged);
+      if (Result == 0 && EmitObjOpt)
+        Result = compileInstrumentedFiles(Compilations,
+          Sources, Jobs, Instrumented, RuntimeHeaders);
+      else if (Result == 0)
+        Result = writeInstrumentedFiles(Instrumented, Unchanged);
+    } else {
+      Result = saveReplacements(Replace);
+    }
+    SaveSeconds = SaveStopwatch.getSeconds();
+
+    if (Conflicts) {
+      llvm::errs() << Conflicts << " conflicts\n";
+      Result = 1;
+    }
+  }
+
+  if (StatsOpt)
+    printStats(Stats, SaveSeconds, llvm::errs());
+
+  if (!StatsJSONOpt.empty()) {
+    std::string ErrorInfo;
+    llvm::raw_fd_ostream OS(StatsJSONOpt.c_str(), ErrorInfo,
+      llvm::sys::fs::F_Text);
+    if (!ErrorInfo.empty()) {
+      llvm::errs() << StatsJSONOpt << ": " << ErrorInfo << '\n';
+      return 1;
+    }
+    writeStatsJSON(Stats, SaveSeconds, OS);
+  }
+
+  return Result;
 }
@@ -0,0 +1,239 @@
+//===-- NseApply.cpp - Applies exported replacement streams ---------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief Second phase of a batch instrumentation with clang-nse
+///
+/// clang-nse --export-replacements writes the replacements of every
+/// translation unit to a stream of its own instead of rewriting any file.
+/// nse-apply reads all streams in parallel, merges them, drops duplicates,
+/// such as those of a header that several translation units instrumented,
+/// and leaves out every file with overlapping replacements. Then it rewrites
+/// each remaining file on its own worker thread, reading it through a
+/// memory-mapped buffer. A stream that cannot be read stops nse-apply
+/// before any file is written, so a batch can simply be resumed by
+/// exporting the missing translation units again:
+///
+///   clang-nse --export-replacements=streams -j 0 -p build src/*.cpp
+///   nse-apply -j 0 --output-dir=instrumented streams
+///
+//===----------------------------------------------------------------------===//
+
+#include "clang/Tooling/Refactoring.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Signals.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "NseReplacementIO.h"
+#include "NseRewrite.h"
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <set>
+#include <thread>
+
+using namespace clang;
+
+namespace cl = llvm::cl;
+
+static cl::list<std::string> InputsOpt(
+  cl::Positional,
+  cl::desc("<stream or directory of streams> ..."),
+  cl::OneOrMore);
+
+static cl::opt<unsigned> JobsOpt(
+  "j",
+  cl::init(0),
+  cl::desc("Number of streams to read and files to write in parallel, 0 uses all cores (default=0)."));
+
+static cl::opt<std::string> OutputDirOpt(
+  "output-dir",
+  cl::desc("Write the instrumented files under the given directory instead of overwriting the sources."));
+
+/// Adds every input that is a file and every stream below an input that is
+/// a directory to \p Streams. Returns false if a directory cannot be read.
+static bool collectStreams(
+  const std::vector<std::string> &Inputs,
+  std::vector<std::string> &Streams) {
+
+  for (const std::string &Input : Inputs) {
+    bool IsDirectory = false;
+    if (llvm::sys::fs::is_directory(Input, IsDirectory) || !IsDirectory) {
+      Streams.push_back(Input);
+      continue;
+    }
+
+    std::error_code EC;
+    for (llvm::sys::fs::recursive_directory_iterator I(Input, EC), E;
+         I != E && !EC; I.increment(EC)) {
+      if (StringRef(I->path()).endswith(NseReplacementsExtension))
+        Streams.push_back(I->path());
+    }
+
+    if (EC) {
+      llvm::errs() << Input << ": " << EC.message() << '\n';
+      return false;
+    }
+  }
+
+  std::sort(Streams.begin(), Streams.end());
+  return true;
+}
+
+/// Reads \p Streams on \p Jobs worker threads and merges their replacements
+/// into \p Replace, which drops duplicates. Returns nonzero if any stream
+/// is missing, malformed or truncated.
+static int readStreams(
+  const std::vector<std::string> &Streams,
+  unsigned Jobs,
+  tooling::Replacements &Replace) {
+
+  std::atomic<size_t> NextStream(0);
+  std::vector<tooling::Replacements> WorkerReplaces(Jobs);
+  std::vector<int> WorkerResults(Jobs, 0);
+  std::vector<std::thread> Workers;
+
+  for (unsigned I = 0; I < Jobs; ++I) {
+    Workers.push_back(std::thread([&, I]() {
+      for (size_t S = NextStream++; S < Streams.size(); S = NextStream++) {
+        llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> Buffer =
+          llvm::MemoryBuffer::getFile(Streams[S], -1,
+            /*RequiresNullTerminator=*/false);
+        if (!Buffer) {
+          llvm::errs() << Streams[S] << ": " << Buffer.getError().message()
+                       << '\n';
+          WorkerResults[I] = 1;
+        } else if (!readReplacements((*Buffer)->getBuffer(),
+                     WorkerReplaces[I])) {
+          llvm::errs() << Streams[S] << ": malformed or truncated stream\n";
+          WorkerResults[I] = 1;
+        }
+      }
+    }));
+  }
+
+  for (std::thread &Worker : Workers)
+    Worker.join();
+
+  for (const tooling::Replacements &R : WorkerReplaces)
+    Replace.insert(R.begin(), R.end());
+
+  return *std::max_element(WorkerResults.begin(), WorkerResults.end());
+}
+
+/// Rewrites every file in \p FileReplaces on \p Jobs worker threads, in
+/// place or mirrored under --output-dir. Sources whose text does not change
+/// are not overwritten. Counts the written files in \p Written.
+static int applyFiles(
+  const std::map<std::string, tooling::Replacements> &FileReplaces,
+  unsigned Jobs,
+  unsigned &Written) {
+
+  typedef std::map<std::string, tooling::Replacements>::const_iterator
+    FileIterator;
+  std::vector<FileIterator> Files;
+  for (FileIterator I = FileReplaces.begin(), E = FileReplaces.end(); I != E;
+       ++I)
+    Files.push_back(I);
+
+  std::atomic<size_t> NextFile(0);
+  std::atomic<unsigned> WrittenFiles(0);
+  std::vector<int> WorkerResults(Jobs, 0);
+  std::vector<std::thread> Workers;
+
+  for (unsigned I = 0; I < Jobs; ++I) {
+    Workers.push_back(std::thread([&, I]() {
+      for (size_t F = NextFile++; F < Files.size(); F = NextFile++) {
+        const std::string &File = Files[F]->first;
+        llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> Buffer =
+          llvm::MemoryBuffer::getFile(File, -1,
+            /*RequiresNullTerminator=*/false);
+        if (!Buffer) {
+          llvm::errs() << File << ": " << Buffer.getError().message() << '\n';
+          WorkerResults[I] = 1;
+          continue;
+        }
+
+        const StringRef Code = (*Buffer)->getBuffer();
+        std::string Text;
+        if (!applyFileReplacements(File, Code, Files[F]->second, Text)) {
+          llvm::errs() << File << ": skipped, replacements do not apply\n";
+          WorkerResults[I] = 1;
+          continue;
+        }
+
+        if (OutputDirOpt.empty() && Text == Code)
+          continue;
+
+        const std::string Path = OutputDirOpt.empty() ? File :
+          getOutputPath(OutputDirOpt, File);
+        if (!writeFileAtomically(Path, Text)) {
+          llvm::errs() << Path << ": could not be written\n";
+          WorkerResults[I] = 1;
+          continue;
+        }
+        ++WrittenFiles;
+      }
+    }));
+  }
+
+  for (std::thread &Worker : Workers)
+    Worker.join();
+
+  Written = WrittenFiles;
+  return *std::max_element(WorkerResults.begin(), WorkerResults.end());
+}
+
+int main(int argc, const char **argv) {
+  llvm::sys::PrintStackTraceOnErrorSignal();
+  cl::ParseCommandLineOptions(argc, argv,
+    "Applies the replacement streams of clang-nse --export-replacements\n");
+
+  std::vector<std::string> Streams;
+  if (!collectStreams(InputsOpt, Streams))
+    return 1;
+
+  unsigned Jobs = JobsOpt;
+  if (Jobs == 0)
+    Jobs = std::max(1u, std::thread::hardware_concurrency());
+
+  tooling::Replacements Replace;
+  if (readStreams(Streams,
+        std::max<size_t>(1, std::min<size_t>(Jobs, Streams.size())),
+        Replace)) {
+    llvm::errs() << "No file written\n";
+    return 1;
+  }
+
+  std::set<std::string> ConflictingFiles;
+  const unsigned Conflicts = removeConflicts(Replace, ConflictingFiles);
+
+  std::map<std::string, tooling::Replacements> FileReplaces;
+  for (const tooling::Replacement &R : Replace)
+    FileReplaces[R.getFilePath()].insert(R);
+
+  unsigned Written = 0;
+  int Result = applyFiles(FileReplaces,
+    std::max<size_t>(1, std::min<size_t>(Jobs, FileReplaces.size())),
+    Written);
+
+  llvm::errs() << "Applied " << Replace.size() << " replacements of "
+               << Streams.size() << " streams, " << Written
+               << " files written\n";
+
+  if (Conflicts) {
+    llvm::errs() << Conflicts << " conflicts\n";
+    Result = 1;
+  }
+
+  return Result;
+}
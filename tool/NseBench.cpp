@@ -0,0 +1,534 @@
+//===-- NseBench.cpp - Benchmarks of the Clang CRV instrumentation --------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief Measures the front-end and, optionally, the instrumented programs
+///
+/// Every file is instrumented several times in memory, without touching the
+/// file itself, to measure the throughput of the front-end. With --run, the
+/// instrumented programs are also compiled against the CRV runtime and
+/// executed to measure how fast their paths are explored, and with --pch,
+/// how much a precompiled CRV runtime saves at compile time. The results
+/// are printed as JSON, for example:
+///
+///   nse-bench --run --cxxflags="-I/path/to/smt-kit/include ..." \
+///     bench/corpus/*.cpp -- -std=c++11
+///
+//===----------------------------------------------------------------------===//
+
+#include "clang/Basic/Version.h"
+#include "clang/Tooling/CommonOptionsParser.h"
+#include "clang/Tooling/Tooling.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Program.h"
+#include "llvm/Support/Signals.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "NseRewrite.h"
+#include "NseRuntimePCH.h"
+#include "NseTransform.h"
+
+#include <algorithm>
+#include <chrono>
+#include <sys/resource.h>
+
+namespace cl = llvm::cl;
+
+static cl::OptionCategory BenchOptionCategory("Benchmark options");
+
+static cl::opt<unsigned> IterationsOpt(
+  "iterations",
+  cl::init(5),
+  cl::desc("Number of times each file is instrumented (default=5)."),
+  cl::cat(BenchOptionCategory));
+
+static cl::opt<NseEngine> EngineOpt(
+  "engine",
+  cl::desc("How nodes to instrument are found (default=matchers)."),
+  cl::values(
+    clEnumValN(MatcherEngine, "matchers",
+      "Run every AST matcher on the whole translation unit"),
+    clEnumValN(TraversalEngine, "traversal",
+      "Visit each node of the main file once, skipping header declarations"),
+    clEnumValN(ParseOnlyEngine, "parse-only",
+      "Parse without instrumenting"),
+    clEnumValEnd),
+  cl::init(MatcherEngine),
+  cl::cat(BenchOptionCategory));
+
+static cl::opt<bool> WrapAllOpt(
+  "wrap-all",
+  cl::desc("Instrument every supported declaration instead of only those that symbolic values can flow into."),
+  cl::cat(BenchOptionCategory));
+
+static cl::opt<bool> RunOpt(
+  "run",
+  cl::desc("Compile and execute the instrumented programs."),
+  cl::cat(BenchOptionCategory));
+
+static cl::opt<std::string> CxxOpt(
+  "cxx",
+  cl::init("clang++"),
+  cl::desc("Compiler for the instrumented programs (default=clang++)."),
+  cl::cat(BenchOptionCategory));
+
+static cl::opt<std::string> CxxFlagsOpt(
+  "cxxflags",
+  cl::init("-std=c++11 -O2"),
+  cl::desc("Space-separated flags that compile and link an instrumented program with the CRV runtime (default=-std=c++11 -O2)."),
+  cl::cat(BenchOptionCategory));
+
+static cl::opt<bool> PCHOpt(
+  "pch",
+  cl::desc("With --run, also compile every program with a precompiled CRV runtime and compare the compile times; requires clang."),
+  cl::cat(BenchOptionCategory));
+
+static cl::opt<unsigned> TimeoutOpt(
+  "timeout",
+  cl::init(600),
+  cl::desc("Seconds after which an instrumented program is stopped (default=600)."),
+  cl::cat(BenchOptionCategory));
+
+static cl::opt<std::string> OutputOpt(
+  "o",
+  cl::init("-"),
+  cl::desc("File that the JSON results are written to (default=stdout)."),
+  cl::cat(BenchOptionCategory));
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+struct RunResult {
+  RunResult()
+      : Compiled(false),
+        Completed(false),
+        FoundBug(false),
+        ExitCode(-1),
+        Seconds(0),
+        Paths(0),
+        CompileSeconds(0),
+        PCHCompileSeconds(-1) {}
+
+  bool Compiled;
+
+  /// Whether the program finished before the timeout
+  bool Completed;
+
+  bool FoundBug;
+  int ExitCode;
+  double Seconds;
+
+  /// Number of explored paths the harness reported, 0 if it did not
+  unsigned long Paths;
+
+  double CompileSeconds;
+
+  /// Compile time with the runtime PCH, -1 if it was not measured
+  double PCHCompileSeconds;
+};
+
+struct FileResult {
+  FileResult()
+      : Failed(false),
+        BestSeconds(0),
+        TotalSeconds(0),
+        Replacements(0) {}
+
+  std::string File;
+  bool Failed;
+  double BestSeconds;
+  double TotalSeconds;
+  size_t Replacements;
+  std::string Instrumented;
+  RunResult Run;
+};
+
+} // end anonymous namespace
+
+static double secondsSince(Clock::time_point Start) {
+  return std::chrono::duration<double>(Clock::now() - Start).count();
+}
+
+/// Peak resident set size of this process in kilobytes
+static long getPeakRSS() {
+  struct rusage Usage;
+  if (getrusage(RUSAGE_SELF, &Usage))
+    return 0;
+  return Usage.ru_maxrss;
+}
+
+static const char *getEngineName(NseEngine Engine) {
+  switch (Engine) {
+  case MatcherEngine:
+    return "matchers";
+  case TraversalEngine:
+    return "traversal";
+  case ParseOnlyEngine:
+    return "parse-only";
+  }
+  return "unknown";
+}
+
+/// Applies those replacements in \p Replace that belong to \p File
+static bool applyToFile(const std::string &File,
+  const tooling::Replacements &Replace, std::string &Result) {
+
+  llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> Buffer =
+    llvm::MemoryBuffer::getFile(File);
+  if (!Buffer)
+    return false;
+
+  tooling::Replacements FileReplace;
+  for (const tooling::Replacement &R : Replace) {
+    bool Equivalent = false;
+    if (!llvm::sys::fs::equivalent(R.getFilePath(), File, Equivalent) &&
+        Equivalent)
+      FileReplace.insert(R);
+  }
+
+  Result = tooling::applyAllReplacements((*Buffer)->getBuffer(), FileReplace);
+  return !Result.empty() || (*Buffer)->getBufferSize() == 0;
+}
+
+static void instrumentFile(
+  const tooling::CompilationDatabase &Compilations,
+  const NseOptions &Options,
+  FileResult &FR) {
+
+  for (unsigned I = 0; I < IterationsOpt; ++I) {
+    tooling::Replacements Replace;
+    tooling::ClangTool Tool(Compilations, FR.File);
+    NseInstrumenter Instrumenter(Options, &Replace);
+
+    Clock::time_point Start = Clock::now();
+    int Result = Tool.run(Instrumenter.newFrontendActionFactory().get());
+    double Seconds = secondsSince(Start);
+
+    if (Result) {
+      FR.Failed = true;
+      return;
+    }
+
+    FR.TotalSeconds += Seconds;
+    if (I == 0 || Seconds < FR.BestSeconds)
+      FR.BestSeconds = Seconds;
+
+    // all iterations yield the same replacements
+    if (I == 0) {
+      FR.Replacements = Replace.size();
+      if (RunOpt && !applyToFile(FR.File, Replace, FR.Instrumented))
+        FR.Failed = true;
+    }
+  }
+}
+
+/// Runs \p Program with \p Args and its output redirected to \p Output
+static int execute(const std::string &Program,
+  const std::vector<std::string> &Args,
+  StringRef Output, unsigned Timeout, bool *ExecutionFailed) {
+
+  std::vector<const char *> Argv;
+  Argv.push_back(Program.c_str());
+  for (const std::string &Arg : Args)
+    Argv.push_back(Arg.c_str());
+  Argv.push_back(nullptr);
+
+  StringRef Empty;
+  const StringRef *Redirects[] = { &Empty, &Output, &Output };
+  std::string ErrMsg;
+  int Result = llvm::sys::ExecuteAndWait(Program, Argv.data(), nullptr,
+    Redirects, Timeout, 0, &ErrMsg, ExecutionFailed);
+
+  if (!ErrMsg.empty())
+    llvm::errs() << Program << ": " << ErrMsg << '\n';
+  return Result;
+}
+
+/// Returns the flags of --cxxflags
+static std::vector<std::string> getCxxFlags() {
+  std::vector<std::string> Args;
+  SmallVector<StringRef, 8> Flags;
+  StringRef(CxxFlagsOpt).split(Flags, " ", -1, false);
+  for (StringRef Flag : Flags)
+    Args.push_back(Flag);
+  return Args;
+}
+
+/// Precompiles nse_runtime.h in \p Dir with --cxxflags and returns the path
+/// of the PCH, or an empty string on failure
+static std::string buildRuntimePCH(StringRef Dir, double &Seconds) {
+  const std::string Cxx = llvm::sys::FindProgramByName(CxxOpt);
+  if (Cxx.empty())
+    return std::string();
+
+  SmallString<128> Header(Dir), Output(Dir);
+  llvm::sys::path::append(Header, "nse_runtime.h");
+  llvm::sys::path::append(Output, "nse_runtime.h.out");
+  if (!writeFileAtomically(Header, getRuntimeHeader()))
+    return std::string();
+
+  const std::string PCH = NseRuntimePCH::getPCHPath(Header);
+  std::vector<std::string> Args = getCxxFlags();
+  Args.push_back("-x");
+  Args.push_back("c++-header");
+  Args.push_back("-o");
+  Args.push_back(PCH);
+  Args.push_back(Header.str());
+
+  bool ExecutionFailed = false;
+  Clock::time_point Start = Clock::now();
+  if (execute(Cxx, Args, Output, 0, &ExecutionFailed) || ExecutionFailed) {
+    llvm::errs() << "Cannot precompile the runtime, see " << Output << '\n';
+    return std::string();
+  }
+  Seconds = secondsSince(Start);
+  return PCH;
+}
+
+/// Compiles the instrumented program in \p Dir and runs it. If \p PCH is
+/// not empty, the program is compiled once more with it.
+static void runFile(StringRef Dir, unsigned Index, StringRef PCH,
+  FileResult &FR) {
+  const std::string Cxx = llvm::sys::FindProgramByName(CxxOpt);
+  if (Cxx.empty()) {
+    llvm::errs() << "Cannot find " << CxxOpt << '\n';
+    return;
+  }
+
+  const std::string Stem = std::to_string(Index) + "-" +
+    llvm::sys::path::stem(FR.File).str();
+  SmallString<128> Source(Dir), Executable(Dir), Output(Dir);
+  llvm::sys::path::append(Source, Stem + ".cpp");
+  llvm::sys::path::append(Executable, Stem);
+  llvm::sys::path::append(Output, Stem + ".out");
+
+  {
+    std::string ErrorInfo;
+    llvm::raw_fd_ostream OS(Source.c_str(), ErrorInfo, llvm::sys::fs::F_None);
+    if (!ErrorInfo.empty()) {
+      llvm::errs() << Source << ": " << ErrorInfo << '\n';
+      return;
+    }
+
+    // like clang-nse --include-runtime-headers
+    OS << NseRuntimeIncludes << FR.Instrumented;
+  }
+
+  std::vector<std::string> Args = getCxxFlags();
+  Args.push_back("-o");
+  Args.push_back(Executable.str());
+  Args.push_back(Source.str());
+
+  bool ExecutionFailed = false;
+  Clock::time_point CompileStart = Clock::now();
+  if (execute(Cxx, Args, Output, 0, &ExecutionFailed) || ExecutionFailed) {
+    llvm::errs() << FR.File << ": compilation failed, see " << Output << '\n';
+    return;
+  }
+  FR.Run.CompileSeconds = secondsSince(CompileStart);
+  FR.Run.Compiled = true;
+
+  if (!PCH.empty()) {
+    // the includes of the source are skipped, the PCH already has them
+    Args = getCxxFlags();
+    Args.push_back("-include-pch");
+    Args.push_back(PCH);
+    Args.push_back("-o");
+    Args.push_back(Executable.str() + "-pch");
+    Args.push_back(Source.str());
+
+    CompileStart = Clock::now();
+    if (execute(Cxx, Args, Output, 0, &ExecutionFailed) || ExecutionFailed)
+      llvm::errs() << FR.File << ": compilation with PCH failed, see "
+                   << Output << '\n';
+    else
+      FR.Run.PCHCompileSeconds = secondsSince(CompileStart);
+  }
+
+  Clock::time_point Start = Clock::now();
+  FR.Run.ExitCode = execute(Executable.str(), std::vector<std::string>(), Output,
+    TimeoutOpt, &ExecutionFailed);
+  FR.Run.Seconds = secondsSince(Start);
+  FR.Run.Completed = !ExecutionFailed && FR.Run.ExitCode >= 0;
+
+  llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> Buffer =
+    llvm::MemoryBuffer::getFile(Output.str());
+  if (!Buffer)
+    return;
+
+  // the harnesses stop at the first bug and print these lines at the end
+  StringRef Text = (*Buffer)->getBuffer();
+  FR.Run.FoundBug = Text.find("Found bug!") != StringRef::npos;
+
+  size_t Pos = Text.find("Explored ");
+  if (Pos != StringRef::npos) {
+    StringRef Count = Text.substr(Pos + 9);
+    Count = Count.substr(0, Count.find(' '));
+    if (Text.substr(Pos + 9 + Count.size()).startswith(" paths"))
+      Count.getAsInteger(10, FR.Run.Paths);
+  }
+}
+
+static void writeResults(llvm::raw_ostream &OS,
+  const std::vector<FileResult> &Results, double Seconds, long PeakRSS,
+  double PCHSeconds) {
+
+  unsigned TUs = 0;
+  size_t Replacements = 0;
+  double InstrumentSeconds = 0;
+  for (const FileResult &FR : Results) {
+    if (FR.Failed)
+      continue;
+    TUs += IterationsOpt;
+    Replacements += FR.Replacements * IterationsOpt;
+    InstrumentSeconds += FR.TotalSeconds;
+  }
+
+  OS << "{\n";
+  OS << "  \"clang\": ";
+  writeJSONString(OS, getClangFullVersion());
+  OS << ",\n";
+  OS << "  \"engine\": ";
+  writeJSONString(OS, getEngineName(EngineOpt));
+  OS << ",\n";
+  OS << "  \"wrap_all\": " << (WrapAllOpt ? "true" : "false") << ",\n";
+  OS << "  \"iterations\": " << IterationsOpt << ",\n";
+  OS << "  \"seconds\": " << Seconds << ",\n";
+  OS << "  \"instrumentation\": {\n";
+  OS << "    \"tus\": " << TUs << ",\n";
+  OS << "    \"seconds\": " << InstrumentSeconds << ",\n";
+  OS << "    \"tus_per_second\": "
+     << (InstrumentSeconds > 0 ? TUs / InstrumentSeconds : 0) << ",\n";
+  OS << "    \"replacements_per_second\": "
+     << (InstrumentSeconds > 0 ? Replacements / InstrumentSeconds : 0) << ",\n";
+  OS << "    \"peak_rss_kb\": " << PeakRSS << "\n";
+  OS << "  },\n";
+
+  if (PCHSeconds >= 0) {
+    // only programs that compiled both ways are compared
+    double CompileSeconds = 0, PCHCompileSeconds = 0;
+    for (const FileResult &FR : Results) {
+      if (FR.Failed || FR.Run.PCHCompileSeconds < 0)
+        continue;
+      CompileSeconds += FR.Run.CompileSeconds;
+      PCHCompileSeconds += FR.Run.PCHCompileSeconds;
+    }
+
+    OS << "  \"runtime_pch\": {\n";
+    OS << "    \"build_seconds\": " << PCHSeconds << ",\n";
+    OS << "    \"compile_seconds\": " << CompileSeconds << ",\n";
+    OS << "    \"pch_compile_seconds\": " << PCHCompileSeconds << ",\n";
+    OS << "    \"reduction\": "
+       << (CompileSeconds > 0 ? 1 - PCHCompileSeconds / CompileSeconds : 0)
+       << "\n";
+    OS << "  },\n";
+  }
+
+  OS << "  \"files\": [";
+
+  for (size_t I = 0; I < Results.size(); ++I) {
+    const FileResult &FR = Results[I];
+    OS << (I ? ",\n" : "\n") << "    {\n";
+    OS << "      \"file\": ";
+    writeJSONString(OS, FR.File);
+    OS << ",\n";
+    OS << "      \"failed\": " << (FR.Failed ? "true" : "false") << ",\n";
+    OS << "      \"replacements\": " << FR.Replacements << ",\n";
+    OS << "      \"best_seconds\": " << FR.BestSeconds << ",\n";
+    OS << "      \"mean_seconds\": "
+       << (FR.Failed ? 0 : FR.TotalSeconds / IterationsOpt);
+
+    if (RunOpt && !FR.Failed) {
+      const RunResult &R = FR.Run;
+      OS << ",\n      \"run\": {\n";
+      OS << "        \"compiled\": " << (R.Compiled ? "true" : "false") << ",\n";
+      OS << "        \"completed\": " << (R.Completed ? "true" : "false")
+         << ",\n";
+      OS << "        \"exit_code\": " << R.ExitCode << ",\n";
+      OS << "        \"compile_seconds\": " << R.CompileSeconds << ",\n";
+      if (R.PCHCompileSeconds >= 0)
+        OS << "        \"pch_compile_seconds\": " << R.PCHCompileSeconds
+           << ",\n";
+      OS << "        \"seconds\": " << R.Seconds << ",\n";
+      OS << "        \"paths\": " << R.Paths << ",\n";
+      OS << "        \"paths_per_second\": "
+         << (R.Seconds > 0 ? R.Paths / R.Seconds : 0) << ",\n";
+      OS << "        \"found_bug\": " << (R.FoundBug ? "true" : "false")
+         << ",\n";
+      OS << "        \"time_to_first_bug_seconds\": ";
+      if (R.FoundBug)
+        OS << R.Seconds;
+      else
+        OS << "null";
+      OS << "\n      }";
+    }
+    OS << "\n    }";
+  }
+
+  OS << "\n  ]\n}\n";
+}
+
+int main(int argc, const char **argv) {
+  llvm::sys::PrintStackTraceOnErrorSignal();
+
+  tooling::CommonOptionsParser OptionsParser(argc, argv, BenchOptionCategory);
+  const std::vector<std::string> &Files = OptionsParser.getSourcePathList();
+
+  NseOptions Options;
+  Options.WrapAll = WrapAllOpt;
+  Options.Engine = EngineOpt;
+
+  Clock::time_point Start = Clock::now();
+  std::vector<FileResult> Results(Files.size());
+  for (size_t I = 0; I < Files.size(); ++I) {
+    Results[I].File = Files[I];
+    instrumentFile(OptionsParser.getCompilations(), Options, Results[I]);
+  }
+
+  // the instrumented programs run in child processes and are not included
+  long PeakRSS = getPeakRSS();
+
+  double PCHSeconds = -1;
+  if (RunOpt) {
+    SmallString<128> Dir;
+    if (llvm::sys::fs::createUniqueDirectory("nse-bench", Dir)) {
+      llvm::errs() << "Cannot create a temporary directory\n";
+      return 1;
+    }
+
+    std::string PCH;
+    if (PCHOpt)
+      PCH = buildRuntimePCH(Dir, PCHSeconds);
+
+    for (size_t I = 0; I < Results.size(); ++I)
+      if (!Results[I].Failed)
+        runFile(Dir, I, PCH, Results[I]);
+
+    llvm::errs() << "Instrumented programs are kept in " << Dir << '\n';
+  }
+
+  std::string ErrorInfo;
+  llvm::raw_fd_ostream OS(OutputOpt.c_str(), ErrorInfo,
+    llvm::sys::fs::F_Text);
+  if (!ErrorInfo.empty()) {
+    llvm::errs() << OutputOpt << ": " << ErrorInfo << '\n';
+    return 1;
+  }
+
+  writeResults(OS, Results, secondsSince(Start), PeakRSS, PCHSeconds);
+
+  for (const FileResult &FR : Results)
+    if (FR.Failed)
+      return 1;
+  return 0;
+}
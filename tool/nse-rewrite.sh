@@ -1,10 +1,8 @@
 #!/bin/bash
 
 FILENAME=$1
-TMP=.${FILENAME}.tmp
 CLANG_NSE=clang-nse
-CLANG_CPP=/usr/bin/clang++
 
-${CLANG_CPP} -cc1 -rewrite-macros ${FILENAME} > ${TMP} && mv ${TMP} ${FILENAME}
-${CLANG_NSE} ${FILENAME} --
-echo -e "#include <nse_sequential.h>\n#include <nse_report.h>" > ${TMP} && cat ${FILENAME} >> ${TMP} && mv ${TMP} ${FILENAME}
+# Expands macros, instruments and prepends nse_sequential.h and nse_report.h
+# in a single run; use --output-dir or --stdout to leave the source alone.
+${CLANG_NSE} --rewrite-macros --include-runtime-headers ${FILENAME} --